@@ -0,0 +1,197 @@
+#ifndef ANIMATION_HPP
+#define ANIMATION_HPP
+
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <map>
+#include "scene.hpp"
+
+using namespace std;
+
+// Camera placement at a keyframe
+class CameraKey {
+public:
+    int frame;
+    Vector3D eye, viewDir, upDir;
+
+    CameraKey(int frame, Vector3D eye, Vector3D viewDir, Vector3D upDir)
+            : frame(frame), eye(eye), viewDir(viewDir), upDir(upDir) {}
+};
+
+// Offset of objects from their position in the base scene at a keyframe
+class TranslationKey {
+public:
+    int frame;
+    Vector3D offset;
+
+    TranslationKey(int frame, Vector3D offset) : frame(frame), offset(offset) {}
+};
+
+// Keyframed translation of a range of spheres or triangles (0-based, in order of the base scene file)
+class ObjectTrack {
+public:
+    bool isSphere;
+    int first, last;
+    vector<TranslationKey> keys;
+
+    ObjectTrack() : isSphere(true), first(0), last(0) {}
+
+    ObjectTrack(bool isSphere, int first, int last) : isSphere(isSphere), first(first), last(last) {}
+};
+
+// Returns parameter (0 - 1) of frame between keys a and b
+inline float keyFraction(int frame, int a, int b) {
+    return b == a ? 0 : (float) (frame - a) / (b - a);
+}
+
+// Keyframed camera and object transforms applied to a base scene, one image per frame
+// Values between keyframes are linearly interpolated, values outside them are held
+class AnimationTrack {
+public:
+    const string filename;
+    int frames;
+    vector<CameraKey> cameraKeys;
+    vector<ObjectTrack> objectTracks;
+
+    // this is to easily print a given object to std for debugging
+    friend std::ostream &operator<<(std::ostream &, const AnimationTrack &);
+
+    AnimationTrack(const string &filename) : filename(filename), frames(0) {}
+
+    // Reads the track description and validates it against the base scene
+    // If everything is valid returns true else returns false and prints and error message
+    bool parse(const Scene &base) {
+        ifstream input(this->filename.c_str());
+        if (input.fail()) {
+            cerr << "Track file named \"" << this->filename
+                 << "\" could not be opened. Maybe it doesn't exist or has insufficient permissions." << endl;
+            return false;
+        }
+        // Keys of same objects are collected together
+        map<string, ObjectTrack> tracks;
+        cout << "Parsing track file \"" << this->filename << "\"." << endl;
+        string line;
+        while (getline(input, line)) {
+            string keyword;
+            istringstream iss(line);
+            if (!(iss >> keyword) || keyword == "#") {
+                continue;
+            }
+            if (keyword == "frames") {
+                if (!(iss >> frames) || frames <= 0) {
+                    cerr << "Number of frames is incomplete or non-positive" << endl;
+                    return false;
+                }
+            } else if (keyword == "camera") {
+                int frame;
+                float ex, ey, ez, vx, vy, vz, ux, uy, uz;
+                if (!(iss >> frame >> ex >> ey >> ez >> vx >> vy >> vz >> ux >> uy >> uz)) {
+                    cerr << "Camera key incomplete" << endl;
+                    return false;
+                }
+                if (Vector3D(vx, vy, vz).abs() < 1e-6 || Vector3D(ux, uy, uz).abs() < 1e-6) {
+                    cerr << "Camera key view or up direction is zero" << endl;
+                    return false;
+                }
+                cameraKeys.emplace_back(frame, Vector3D(ex, ey, ez), Vector3D(vx, vy, vz).unit(),
+                                        Vector3D(ux, uy, uz).unit());
+            } else if (keyword == "sphere" || keyword == "triangles") {
+                bool isSphere = keyword == "sphere";
+                int first, last, frame;
+                float x, y, z;
+                if (!(iss >> first) || (!isSphere && !(iss >> last)) || !(iss >> frame >> x >> y >> z)) {
+                    cerr << "Object key incomplete" << endl;
+                    return false;
+                }
+                if (isSphere) {
+                    last = first;
+                }
+                int count = isSphere ? base.spheres.size() : base.triangles.size();
+                if (first < 1 || last < first || last > count) {
+                    cerr << "Object key indices out of bounds" << endl;
+                    return false;
+                }
+                string key = keyword + " " + to_string(first) + " " + to_string(last);
+                if (tracks.find(key) == tracks.end()) {
+                    tracks[key] = ObjectTrack(isSphere, first - 1, last - 1);
+                }
+                tracks[key].keys.emplace_back(frame, Vector3D(x, y, z));
+            } else {
+                cerr << "Invalid keyword found: " << keyword << ". Ignoring it" << endl;
+            }
+        }
+        if (frames <= 0) {
+            cerr << "Critical information missing: frames" << endl;
+            return false;
+        }
+        auto byFrame = [](const TranslationKey &a, const TranslationKey &b) { return a.frame < b.frame; };
+        for (auto &track : tracks) {
+            stable_sort(track.second.keys.begin(), track.second.keys.end(), byFrame);
+            objectTracks.push_back(track.second);
+        }
+        stable_sort(cameraKeys.begin(), cameraKeys.end(),
+                    [](const CameraKey &a, const CameraKey &b) { return a.frame < b.frame; });
+        return true;
+    }
+
+    // Places camera and objects of target as they are at given frame
+    // Target must be a copy of base; only what the track animates is touched
+    void apply(int frame, const Scene &base, Scene &target) const {
+        if (!cameraKeys.empty()) {
+            size_t b = 0;
+            while (b < cameraKeys.size() && cameraKeys[b].frame < frame) { b++; }
+            // Before first or after last key, hold it
+            const CameraKey &from = cameraKeys[b == 0 ? 0 : b - 1];
+            const CameraKey &to = cameraKeys[b == cameraKeys.size() ? b - 1 : b];
+            float f = keyFraction(frame, from.frame, to.frame);
+            target.eye = from.eye + (to.eye - from.eye) * f;
+            target.viewDir = (from.viewDir + (to.viewDir - from.viewDir) * f).unit();
+            target.upDir = (from.upDir + (to.upDir - from.upDir) * f).unit();
+        }
+        if (objectTracks.empty()) {
+            return;
+        }
+        vector<Vector3D> sphereOffsets(base.spheres.size());
+        vector<Vector3D> triangleOffsets(base.triangles.size());
+        for (const auto &track : objectTracks) {
+            Vector3D offset = offsetAt(track.keys, frame);
+            vector<Vector3D> &offsets = track.isSphere ? sphereOffsets : triangleOffsets;
+            for (int k = track.first; k <= track.last; ++k) {
+                offsets[k] = offsets[k] + offset;
+            }
+        }
+        // Objects have constant members, so they are re-created rather than assigned
+        target.spheres.clear();
+        for (size_t k = 0; k < base.spheres.size(); ++k) {
+            target.spheres.push_back(base.spheres[k].translated(sphereOffsets[k]));
+        }
+        target.triangles.clear();
+        for (size_t k = 0; k < base.triangles.size(); ++k) {
+            target.triangles.push_back(base.triangles[k].translated(triangleOffsets[k]));
+        }
+    }
+
+private:
+    static Vector3D offsetAt(const vector<TranslationKey> &keys, int frame) {
+        size_t b = 0;
+        while (b < keys.size() && keys[b].frame < frame) { b++; }
+        if (b == 0) {
+            return keys.front().offset;
+        }
+        if (b == keys.size()) {
+            return keys.back().offset;
+        }
+        float f = keyFraction(frame, keys[b - 1].frame, keys[b].frame);
+        return keys[b - 1].offset + (keys[b].offset - keys[b - 1].offset) * f;
+    }
+
+};
+
+inline std::ostream &operator<<(std::ostream &out, const AnimationTrack &a) {
+    out << "AnimationTrack:" << "\t" << a.frames << " frames\t" << a.cameraKeys.size() << " camera keys\t"
+        << a.objectTracks.size() << " object tracks";
+    return out;
+}
+
+#endif
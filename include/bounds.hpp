@@ -0,0 +1,124 @@
+#ifndef BOUNDS_HPP
+#define BOUNDS_HPP
+
+#include <cfloat>
+#include <algorithm>
+#include "ray.hpp"
+#include "sphere.hpp"
+#include "triangle.hpp"
+
+using namespace std;
+
+// Axis aligned bounding box
+class Bounds {
+public:
+    Vector3D min, max;
+
+    // this is to easily print a given object to std for debugging
+    friend std::ostream &operator<<(std::ostream &, const Bounds &);
+
+    // Empty box, expanding it with anything yields that thing's box
+    Bounds() : min(Vector3D(FLT_MAX, FLT_MAX, FLT_MAX)), max(Vector3D(-FLT_MAX, -FLT_MAX, -FLT_MAX)) {}
+
+    Bounds(Vector3D min, Vector3D max) : min(min), max(max) {}
+
+    bool isEmpty() const {
+        return min.x > max.x || min.y > max.y || min.z > max.z;
+    }
+
+    bool operator==(const Bounds &b) const {
+        return min == b.min && max == b.max;
+    }
+
+    void expand(const Vector3D &p) {
+        min = Vector3D(std::min(min.x, p.x), std::min(min.y, p.y), std::min(min.z, p.z));
+        max = Vector3D(std::max(max.x, p.x), std::max(max.y, p.y), std::max(max.z, p.z));
+    }
+
+    void expand(const Bounds &b) {
+        if (b.isEmpty()) { return; }
+        expand(b.min);
+        expand(b.max);
+    }
+
+    Bounds padded(float margin) const {
+        if (isEmpty()) { return *this; }
+        return Bounds(min - Vector3D(margin, margin, margin), max + Vector3D(margin, margin, margin));
+    }
+
+    bool overlaps(const Bounds &b) const {
+        if (isEmpty() || b.isEmpty()) { return false; }
+        return min.x <= b.max.x && b.min.x <= max.x
+               && min.y <= b.max.y && b.min.y <= max.y
+               && min.z <= b.max.z && b.min.z <= max.z;
+    }
+
+    bool contains(const Bounds &b) const {
+        if (b.isEmpty()) { return true; }
+        if (isEmpty()) { return false; }
+        return min.x <= b.min.x && b.max.x <= max.x
+               && min.y <= b.min.y && b.max.y <= max.y
+               && min.z <= b.min.z && b.max.z <= max.z;
+    }
+
+    Vector3D centroid() const {
+        return (min + max) * 0.5;
+    }
+
+    // Surface area, used to weigh splits of bounding volume hierarchies
+    float area() const {
+        if (isEmpty()) { return 0; }
+        Vector3D e = max - min;
+        return 2 * (e.x * e.y + e.y * e.z + e.z * e.x);
+    }
+
+    // Clips [tMin, tMax] interval of ray parameter to the part inside the box (slab test)
+    // Returns false if the ray does not pass through the box within the interval
+    bool clip(const Ray &ray, float &tMin, float &tMax) const {
+        if (isEmpty()) { return false; }
+        const float origin[3] = {ray.origin.x, ray.origin.y, ray.origin.z};
+        const float direction[3] = {ray.direction.x, ray.direction.y, ray.direction.z};
+        const float lo[3] = {min.x, min.y, min.z};
+        const float hi[3] = {max.x, max.y, max.z};
+        for (int axis = 0; axis < 3; ++axis) {
+            if (direction[axis] == 0) {
+                if (origin[axis] < lo[axis] || origin[axis] > hi[axis]) { return false; }
+                continue;
+            }
+            float inv = 1 / direction[axis];
+            float t0 = (lo[axis] - origin[axis]) * inv;
+            float t1 = (hi[axis] - origin[axis]) * inv;
+            if (t0 > t1) { swap(t0, t1); }
+            tMin = std::max(tMin, t0);
+            tMax = std::min(tMax, t1);
+            if (tMin > tMax) { return false; }
+        }
+        return true;
+    }
+
+};
+
+// Box enclosing the sphere
+inline Bounds boundsOf(const Sphere &sphere) {
+    Vector3D r(sphere.radius, sphere.radius, sphere.radius);
+    return Bounds(sphere.center - r, sphere.center + r);
+}
+
+// Box enclosing every point smallestNonNegativeT may report as a hit on the triangle
+// The inside test tolerates 1e-3 of excess area, which lets hits lie up to 1e-3 / (shortest edge) outside it
+inline Bounds boundsOf(const Triangle &triangle) {
+    Bounds b;
+    b.expand(triangle.v1);
+    b.expand(triangle.v2);
+    b.expand(triangle.v3);
+    float shortestEdge = std::min((triangle.v2 - triangle.v1).abs(),
+                                  std::min((triangle.v3 - triangle.v2).abs(), (triangle.v1 - triangle.v3).abs()));
+    return b.padded(2e-3 / std::max(shortestEdge, 1e-6f));
+}
+
+inline std::ostream &operator<<(std::ostream &out, const Bounds &b) {
+    out << "Bounds:" << "\t" << b.min << "\t" << b.max;
+    return out;
+}
+
+#endif
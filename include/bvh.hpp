@@ -0,0 +1,335 @@
+#ifndef BVH_HPP
+#define BVH_HPP
+
+#include <vector>
+#include <algorithm>
+#include "bounds.hpp"
+#include "trianglestore.hpp"
+#include "packet.hpp"
+#include "instance.hpp"
+
+using namespace std;
+
+#define BVH_LEAF_SIZE 4
+// Number of triangles whose hierarchy is built in the background while the scene file is still being parsed
+#define BVH_CHUNK_SIZE 4096
+
+class BVHNode {
+public:
+    Bounds bounds;
+    // Interior node: index of right child (left child is the node right after this one), Leaf: -1
+    int rightChild;
+    // Leaf: objects objIndices[first] ... objIndices[first + count - 1]
+    int first, count;
+
+    BVHNode() : rightChild(-1), first(0), count(0) {}
+
+    bool isLeaf() const {
+        return rightChild < 0;
+    }
+};
+
+// Bounding volume hierarchy over all objects of a scene, referred to by global index (spheres first, then triangles)
+// Instances come last, one object each, their triangles are in the hierarchies of their meshes
+// Nodes are stored depth first, so every child comes after its parent
+class BVH {
+public:
+    vector<BVHNode> nodes;
+    vector<int> objIndices;
+    vector<Bounds> objBounds;
+
+    // this is to easily print a given object to std for debugging
+    friend std::ostream &operator<<(std::ostream &, const BVH &);
+
+    bool isEmpty() const {
+        return nodes.empty();
+    }
+
+    // Builds hierarchy from scratch
+    void build(const vector<Sphere> &spheres, const TriangleStore &triangles,
+               const vector<Instance> &instances) {
+        computeObjectBounds(spheres, triangles, instances);
+        buildFromBounds();
+    }
+
+    // Builds hierarchy over objects with given boxes (see boundsFor), object k has box bounds[k]
+    void build(vector<Bounds> bounds) {
+        objBounds = move(bounds);
+        buildFromBounds();
+    }
+
+    // Builds hierarchy over objects of several parts, whose hierarchies were built separately (e.g. at once)
+    // Objects of a part come after those of the parts before it, so part k's object m gets global index
+    // m + number of objects in parts 0 ... k - 1
+    // Only a small hierarchy over the parts is built on top, the parts' hierarchies are copied below it
+    void join(const vector<BVH> &parts) {
+        nodes.clear();
+        objIndices.clear();
+        objBounds.clear();
+        vector<int> nonEmptyParts;
+        vector<int> objOffsets;
+        for (int k = 0; k < (int) parts.size(); ++k) {
+            objOffsets.push_back(objBounds.size());
+            objBounds.insert(objBounds.end(), parts[k].objBounds.begin(), parts[k].objBounds.end());
+            if (!parts[k].isEmpty()) {
+                nonEmptyParts.push_back(k);
+            }
+        }
+        if (!nonEmptyParts.empty()) {
+            joinRecursive(parts, objOffsets, nonEmptyParts, 0, nonEmptyParts.size());
+        }
+    }
+
+    // Box of an object in the hierarchy
+    static Bounds boundsFor(const Sphere &sphere) {
+        // Padded, as a grazing hit computed by the quadratic formula can land just outside the exact box
+        return boundsOf(sphere).padded(sphere.radius * 1e-4 + 1e-5);
+    }
+
+    static Bounds boundsFor(const Triangle &triangle) {
+        return boundsOf(triangle);
+    }
+
+    static Bounds boundsFor(const Instance &instance) {
+        return instance.bounds;
+    }
+
+    // Updates boxes of the hierarchy after objects moved, keeping its topology
+    // Much cheaper than build, but the hierarchy gets looser the more objects move relative to each other
+    void refit(const vector<Sphere> &spheres, const TriangleStore &triangles,
+               const vector<Instance> &instances) {
+        computeObjectBounds(spheres, triangles, instances);
+        for (int k = nodes.size() - 1; k >= 0; --k) {
+            BVHNode &node = nodes[k];
+            Bounds bounds;
+            if (node.isLeaf()) {
+                for (int m = node.first; m < node.first + node.count; ++m) {
+                    bounds.expand(objBounds[objIndices[m]]);
+                }
+            } else {
+                bounds.expand(nodes[k + 1].bounds);
+                bounds.expand(nodes[node.rightChild].bounds);
+            }
+            node.bounds = bounds;
+        }
+    }
+
+    // Sum of node box areas, a measure of how costly the hierarchy is to traverse
+    float cost() const {
+        float sum = 0;
+        for (const auto &node : nodes) {
+            sum += node.bounds.area();
+        }
+        return sum;
+    }
+
+    // Calls visit(objIndex) for objects whose box the ray passes through between tMin and tMax, near ones first
+    // tMax is re-read after every visit, so that a closest hit search can shrink it as it goes
+    // Only the subtree of node root is traversed
+    template<typename Visit>
+    void traverse(const Ray &ray, float tMin, const float &tMax, Visit visit, int root = 0) const {
+        if (nodes.empty()) {
+            return;
+        }
+        int stack[64];
+        int top = 0;
+        stack[top++] = root;
+        while (top > 0) {
+            const BVHNode &node = nodes[stack[--top]];
+            float t0 = tMin, t1 = tMax;
+            if (!node.bounds.clip(ray, t0, t1)) {
+                continue;
+            }
+            if (node.isLeaf()) {
+                for (int m = node.first; m < node.first + node.count; ++m) {
+                    visit(objIndices[m]);
+                }
+                continue;
+            }
+            int left = &node - &nodes[0] + 1;
+            int right = node.rightChild;
+            // Push farther child first so that nearer child is visited first
+            float leftT0 = tMin, leftT1 = tMax, rightT0 = tMin, rightT1 = tMax;
+            bool leftHit = nodes[left].bounds.clip(ray, leftT0, leftT1);
+            bool rightHit = nodes[right].bounds.clip(ray, rightT0, rightT1);
+            if (leftHit && rightHit) {
+                if (leftT0 <= rightT0) {
+                    stack[top++] = right;
+                    stack[top++] = left;
+                } else {
+                    stack[top++] = left;
+                    stack[top++] = right;
+                }
+            } else if (leftHit) {
+                stack[top++] = left;
+            } else if (rightHit) {
+                stack[top++] = right;
+            }
+        }
+    }
+
+    // Calls visit(objIndex, mask) for objects whose box the rays of the lanes of mask pass through between 0 and
+    // tMax[lane], as traverse would for each ray (with tMin 0), so that a closest hit search finds the same hits
+    // tMax is re-read after every visit, nodes are visited near ones first as seen by the first ray of the packet
+    // Once only one ray of the packet passes through a node, its subtree is traversed with traverse for that ray
+    template<typename Visit>
+    void traversePacket(const RayPacket &packet, const float *tMax, Visit visit) const {
+        if (nodes.empty()) {
+            return;
+        }
+        pair<int, int> stack[64];
+        int top = 0;
+        stack[top++] = {0, packet.activeMask};
+        while (top > 0) {
+            int nodeIndex = stack[top - 1].first;
+            int mask = stack[top - 1].second & packet.clip(nodes[nodeIndex].bounds, tMax);
+            top--;
+            if (mask == 0) {
+                continue;
+            }
+            // Rays diverged, the packet would carry idle lanes from here on
+            if ((mask & (mask - 1)) == 0) {
+                int lane = 0;
+                while (!(mask >> lane & 1)) {
+                    lane++;
+                }
+                traverse(packet.rays[lane], 0, tMax[lane], [&visit, mask](int objIndex) { visit(objIndex, mask); },
+                         nodeIndex);
+                continue;
+            }
+            const BVHNode &node = nodes[nodeIndex];
+            if (node.isLeaf()) {
+                for (int m = node.first; m < node.first + node.count; ++m) {
+                    visit(objIndices[m], mask);
+                }
+                continue;
+            }
+            // Push farther child first so that nearer child is visited first
+            int left = nodeIndex + 1;
+            int right = node.rightChild;
+            const Ray &ray = packet.rays[0];
+            float leftDistance = (nodes[left].bounds.centroid() - ray.origin).dot(ray.direction);
+            float rightDistance = (nodes[right].bounds.centroid() - ray.origin).dot(ray.direction);
+            if (leftDistance <= rightDistance) {
+                stack[top++] = {right, mask};
+                stack[top++] = {left, mask};
+            } else {
+                stack[top++] = {left, mask};
+                stack[top++] = {right, mask};
+            }
+        }
+    }
+
+private:
+    void computeObjectBounds(const vector<Sphere> &spheres, const TriangleStore &triangles,
+                             const vector<Instance> &instances) {
+        objBounds.clear();
+        for (const auto &sphere : spheres) {
+            objBounds.push_back(boundsFor(sphere));
+        }
+        for (size_t k = 0; k < triangles.size(); ++k) {
+            objBounds.push_back(triangles.boundsAt(k));
+        }
+        for (const auto &instance : instances) {
+            objBounds.push_back(boundsFor(instance));
+        }
+    }
+
+    void buildFromBounds() {
+        nodes.clear();
+        objIndices.clear();
+        for (int k = 0; k < (int) objBounds.size(); ++k) {
+            objIndices.push_back(k);
+        }
+        if (!objIndices.empty()) {
+            buildRecursive(0, objIndices.size());
+        }
+    }
+
+    // Builds node over parts partIndices[first] ... partIndices[first + count - 1], returns its index
+    // A single part is copied, renumbering its nodes and objects
+    int joinRecursive(const vector<BVH> &parts, const vector<int> &objOffsets, vector<int> &partIndices, int first,
+                      int count) {
+        int nodeIndex = nodes.size();
+        if (count == 1) {
+            const BVH &part = parts[partIndices[first]];
+            int objOffset = objOffsets[partIndices[first]];
+            int firstObj = objIndices.size();
+            for (int objIndex : part.objIndices) {
+                objIndices.push_back(objIndex + objOffset);
+            }
+            for (BVHNode node : part.nodes) {
+                if (node.isLeaf()) {
+                    node.first += firstObj;
+                } else {
+                    node.rightChild += nodeIndex;
+                }
+                nodes.push_back(node);
+            }
+            return nodeIndex;
+        }
+        nodes.emplace_back();
+        Bounds bounds, centroidBounds;
+        for (int m = first; m < first + count; ++m) {
+            bounds.expand(parts[partIndices[m]].nodes[0].bounds);
+            centroidBounds.expand(parts[partIndices[m]].nodes[0].bounds.centroid());
+        }
+        nodes[nodeIndex].bounds = bounds;
+        Vector3D extent = centroidBounds.max - centroidBounds.min;
+        int axis = extent.x >= extent.y && extent.x >= extent.z ? 0 : (extent.y >= extent.z ? 1 : 2);
+        int mid = first + count / 2;
+        nth_element(partIndices.begin() + first, partIndices.begin() + mid, partIndices.begin() + first + count,
+                    [&parts, axis](int a, int b) {
+                        Vector3D ca = parts[a].nodes[0].bounds.centroid(), cb = parts[b].nodes[0].bounds.centroid();
+                        float va = axis == 0 ? ca.x : (axis == 1 ? ca.y : ca.z);
+                        float vb = axis == 0 ? cb.x : (axis == 1 ? cb.y : cb.z);
+                        return va < vb || (va == vb && a < b);
+                    });
+        joinRecursive(parts, objOffsets, partIndices, first, mid - first);
+        int right = joinRecursive(parts, objOffsets, partIndices, mid, first + count - mid);
+        nodes[nodeIndex].rightChild = right;
+        return nodeIndex;
+    }
+
+    // Builds node for objIndices[first] ... objIndices[first + count - 1], returns its index
+    // Splits at the median centroid along the axis in which centroids are spread the most
+    int buildRecursive(int first, int count) {
+        int nodeIndex = nodes.size();
+        nodes.emplace_back();
+        Bounds bounds, centroidBounds;
+        for (int m = first; m < first + count; ++m) {
+            bounds.expand(objBounds[objIndices[m]]);
+            centroidBounds.expand(objBounds[objIndices[m]].centroid());
+        }
+        nodes[nodeIndex].bounds = bounds;
+        Vector3D extent = centroidBounds.max - centroidBounds.min;
+        // Small or degenerate (all centroids at one point) sets of objects become leaves
+        if (count <= BVH_LEAF_SIZE || (extent.x <= 0 && extent.y <= 0 && extent.z <= 0)) {
+            nodes[nodeIndex].first = first;
+            nodes[nodeIndex].count = count;
+            return nodeIndex;
+        }
+        int axis = extent.x >= extent.y && extent.x >= extent.z ? 0 : (extent.y >= extent.z ? 1 : 2);
+        const vector<Bounds> &boxes = objBounds;
+        int mid = first + count / 2;
+        nth_element(objIndices.begin() + first, objIndices.begin() + mid, objIndices.begin() + first + count,
+                    [&boxes, axis](int a, int b) {
+                        Vector3D ca = boxes[a].centroid(), cb = boxes[b].centroid();
+                        float va = axis == 0 ? ca.x : (axis == 1 ? ca.y : ca.z);
+                        float vb = axis == 0 ? cb.x : (axis == 1 ? cb.y : cb.z);
+                        return va < vb || (va == vb && a < b);
+                    });
+        buildRecursive(first, mid - first);
+        int right = buildRecursive(mid, first + count - mid);
+        nodes[nodeIndex].rightChild = right;
+        return nodeIndex;
+    }
+
+};
+
+inline std::ostream &operator<<(std::ostream &out, const BVH &b) {
+    out << "BVH:" << "\t" << b.nodes.size() << " nodes\t" << b.objIndices.size() << " objects";
+    return out;
+}
+
+#endif
@@ -0,0 +1,100 @@
+#ifndef CAMERA_HPP
+#define CAMERA_HPP
+
+#include <cmath>
+#include "ray.hpp"
+#include "scene.hpp"
+#include "config.hpp"
+
+#ifndef M_PI
+#define M_PI 3.1415926535
+#endif
+
+// Viewing window of a scene and the camera rays through its pixels
+class Camera {
+public:
+    // Camera frame: u to the right, v up
+    Vector3D u, v;
+    // Distance of viewing window from the eye
+    float d;
+    // Upper left corner of viewing window and per pixel steps along width and height
+    Vector3D ul, delWidth, delHeight;
+    bool isParallelProjection;
+    Vector3D eye;
+    Vector3D viewDir;
+    // Image size in pixels
+    int width, height;
+    // Camera rays per pixel and how far their origins are jittered (depth of field effect)
+    int samplesPerPixel;
+    float rayJitter;
+
+    // this is to easily print a given object to std for debugging
+    friend std::ostream &operator<<(std::ostream &, const Camera &);
+
+    // Camera of the scene file
+    Camera(const Scene &scene)
+            : Camera(scene.eye, scene.viewDir, scene.upDir, scene.vFovDeg, scene.imWidth, scene.imHeight,
+                     scene.viewingDistance, scene.isParallelProjection) {}
+
+    // Camera with given placement and image size, viewingDistance > 0 turns depth of field effect on
+    // Control NUM_DISTRIBUTED_RAYS, DISTRIBUTED_RAYS_JITTER to change distributed ray tracing effects
+    Camera(const Vector3D &eye, const Vector3D &viewDir, const Vector3D &upDir, float vFovDeg, int imWidth,
+           int imHeight, float viewingDistance, bool isParallelProjection)
+            : isParallelProjection(isParallelProjection), eye(eye), viewDir(viewDir), width(imWidth), height(imHeight),
+              samplesPerPixel(viewingDistance > 0 ? NUM_DISTRIBUTED_RAYS : 1),
+              rayJitter(viewingDistance > 0 ? DISTRIBUTED_RAYS_JITTER : 0) {
+        // Preliminary calculations
+        u = viewDir.cross(upDir);
+        v = u.cross(viewDir);
+
+        d = imHeight / (2 * tan(vFovDeg * M_PI / 360));
+        float viewingWindowWidth = imWidth;
+        float viewingWindowHeight = imHeight;
+        if (viewingDistance > 0) {
+            viewingWindowWidth = (viewingDistance / d) * imWidth;
+            viewingWindowHeight = (viewingDistance / d) * imHeight;
+            d = viewingDistance;
+        }
+
+        Vector3D imageCenter = eye + viewDir.unit() * d;
+        ul = imageCenter - u * (viewingWindowWidth / 2) + v * (viewingWindowHeight / 2);
+        Vector3D ur = imageCenter + u * (viewingWindowWidth / 2) + v * (viewingWindowHeight / 2);
+        Vector3D ll = imageCenter - u * (viewingWindowWidth / 2) - v * (viewingWindowHeight / 2);
+
+        delWidth = (ur - ul) * (1 / ((float) imWidth - 1));
+        delHeight = (ll - ul) * (1 / ((float) imHeight - 1));
+    }
+
+    // (i, j) pixel coordinate on viewing window
+    Vector3D pixelCoordinate(int i, int j) const {
+        return ul + delWidth * i + delHeight * j;
+    }
+
+    // Returns camera ray through (i, j) pixel
+    // A positive jitter randomly displaces the ray origin (distributed ray tracing for depth of field effect)
+    Ray rayThrough(int i, int j, float jitter) const {
+        Vector3D pixel = pixelCoordinate(i, j);
+        if (isParallelProjection) {
+            // ray from pixel projection on eye plane in direction of normal to image plane
+            Vector3D origin = pixel - viewDir.unit() * d;
+            if (jitter > 0) {
+                origin = origin + Vector3D(getRand(), getRand(), getRand()).unit() * jitter;
+            }
+            return Ray(origin, viewDir);
+        }
+        // ray from eye to that pixel
+        Vector3D origin = eye;
+        if (jitter > 0) {
+            origin = origin + Vector3D(getRand(), getRand(), getRand()).unit() * jitter;
+        }
+        return Ray(origin, (pixel - origin).unit());
+    }
+
+};
+
+inline std::ostream &operator<<(std::ostream &out, const Camera &c) {
+    out << "Camera:" << "\t" << c.eye << "\t" << c.viewDir << "\t" << c.d << "\t" << c.ul;
+    return out;
+}
+
+#endif
@@ -0,0 +1,83 @@
+#ifndef CHECKPOINT_HPP
+#define CHECKPOINT_HPP
+
+#include <fstream>
+#include <cstdio>
+#include <cstdint>
+#include <string>
+
+using namespace std;
+
+// Progress of a streamed render: how many rows of the image are safely on disk
+// Tiles are seeded by their index, so rows after them render the same no matter when, and this is all the state that
+// resuming the render needs
+class Checkpoint {
+public:
+    // Hash of everything the image depends on (scene, image size, tiling, seed), a checkpoint of a different render
+    // is not resumed
+    uint64_t hash;
+    int width, height;
+    int rowsDone;
+
+    // this is to easily print a given object to std for debugging
+    friend std::ostream &operator<<(std::ostream &, const Checkpoint &);
+
+    Checkpoint(uint64_t hash, int width, int height) : hash(hash), width(width), height(height), rowsDone(0) {}
+
+    // Writes the checkpoint to a binary file
+    // It is written next to it first and then renamed over it, so a crash leaves either the old or the new one
+    bool save(const string &filename) const {
+        string temporaryFilename = filename + ".tmp";
+        {
+            ofstream out(temporaryFilename.c_str(), ios::binary);
+            out.write("YCKP", 4);
+            out.write((const char *) &hash, sizeof(hash));
+            out.write((const char *) &width, sizeof(int));
+            out.write((const char *) &height, sizeof(int));
+            out.write((const char *) &rowsDone, sizeof(int));
+            out.flush();
+            if (out.fail()) {
+                cerr << "Checkpoint file named \"" << temporaryFilename << "\" could not be written." << endl;
+                return false;
+            }
+        }
+        return rename(temporaryFilename.c_str(), filename.c_str()) == 0;
+    }
+
+    // Reads the checkpoint from a binary file
+    // Returns false (after printing an error message) if file is missing, malformed or was made by a different render
+    bool load(const string &filename) {
+        ifstream in(filename.c_str(), ios::binary);
+        if (in.fail()) {
+            cerr << "Checkpoint file named \"" << filename
+                 << "\" could not be opened. Maybe the render finished or was never started with --stream." << endl;
+            return false;
+        }
+        char magic[4];
+        uint64_t fileHash;
+        int fileWidth, fileHeight, fileRowsDone;
+        in.read(magic, 4);
+        in.read((char *) &fileHash, sizeof(fileHash));
+        in.read((char *) &fileWidth, sizeof(int));
+        in.read((char *) &fileHeight, sizeof(int));
+        in.read((char *) &fileRowsDone, sizeof(int));
+        if (in.fail() || string(magic, 4) != "YCKP" || fileRowsDone < 0 || fileRowsDone > fileHeight) {
+            cerr << "Checkpoint file named \"" << filename << "\" is invalid." << endl;
+            return false;
+        }
+        if (fileHash != hash || fileWidth != width || fileHeight != height) {
+            cerr << "Checkpoint file named \"" << filename << "\" is of a different scene or configuration." << endl;
+            return false;
+        }
+        rowsDone = fileRowsDone;
+        return true;
+    }
+
+};
+
+inline std::ostream &operator<<(std::ostream &out, const Checkpoint &c) {
+    out << "Checkpoint:" << "\t" << c.width << "x" << c.height << "\t" << c.rowsDone << " rows done";
+    return out;
+}
+
+#endif
@@ -1,6 +1,9 @@
 #ifndef COLOR_HPP
 #define COLOR_HPP
 
+#include <iostream>
+#include <string>
+
 class Color {
     float r, g, b;
 public:
@@ -12,6 +15,10 @@ public:
 
     Color(float r, float g, float b) : r(r), g(g), b(b) {}
 
+    bool operator==(const Color &B) const {
+        return this->r == B.r && this->g == B.g && this->b == B.b;
+    }
+
     Color operator*(float t) const {
         return Color(this->r * t, this->g * t, this->b * t);
     }
@@ -24,6 +31,23 @@ public:
         return Color(this->r * B.r, this->g * B.g, this->b * B.b);
     }
 
+    float getR() const {
+        return r;
+    }
+
+    float getG() const {
+        return g;
+    }
+
+    float getB() const {
+        return b;
+    }
+
+    // Brightest channel
+    float maxChannel() const {
+        return r > g ? (r > b ? r : b) : (g > b ? g : b);
+    }
+
     std::string to8BitScale() const {
         // Clamp color channels
         float R = r, G = g, B = b;
@@ -60,14 +84,19 @@ public:
             : diffusion(diffusion), specular(specular), ka(ka), kd(kd), ks(ks), n(n), opacity(opacity),
               refractiveIndex(refractiveIndex) {}
 
+    bool operator==(const MaterialColor &B) const {
+        return diffusion == B.diffusion && specular == B.specular && ka == B.ka && kd == B.kd && ks == B.ks
+               && n == B.n && opacity == B.opacity && refractiveIndex == B.refractiveIndex;
+    }
+
 };
 
-std::ostream &operator<<(std::ostream &out, const Color &c) {
+inline std::ostream &operator<<(std::ostream &out, const Color &c) {
     out << "(" << c.r << ", " << c.g << ", " << c.b << ")";
     return out;
 }
 
-std::ostream &operator<<(std::ostream &out, const MaterialColor &mtl) {
+inline std::ostream &operator<<(std::ostream &out, const MaterialColor &mtl) {
     out << "Material color:" << "\t";
     out << mtl.diffusion << "\t" << mtl.specular << "\t";
     out << "(" << mtl.ka << ", " << mtl.kd << ", " << mtl.ks << ")\t";
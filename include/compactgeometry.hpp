@@ -0,0 +1,476 @@
+#ifndef COMPACT_GEOMETRY_HPP
+#define COMPACT_GEOMETRY_HPP
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <unordered_map>
+#include <vector>
+#include "config.hpp"
+#include "vector3d.hpp"
+#include "ray.hpp"
+#include "triangle.hpp"
+#include "bounds.hpp"
+#include "intersections.hpp"
+#include "trianglestore.hpp"
+
+using namespace std;
+
+#ifndef M_PI
+#define M_PI 3.1415926535
+#endif
+
+// Triangle of CompactGeometry, about a quarter of the size of a Triangle
+class CompactTriangle {
+public:
+    // Corners, as 16 bit offsets per axis from the lattice point the triangle's cluster starts at
+    uint16_t corners[3][3];
+    // Shading normals of smooth triangles, octahedral encoded to 16 bits per component
+    int16_t normals[3][2];
+    // Texture coordinates of textured triangles, quantized to 16 bits within the range of the cluster's
+    uint16_t textureCoordinates[3][2];
+    // Index of the triangle's material in CompactGeometry::materials
+    uint16_t material;
+    // If not 0, the decoded triangle strays too far from the original, which is used instead: it is the index of the
+    // original in CompactGeometry::exactTriangles plus one
+    uint32_t exact;
+};
+
+// Render type, material and texture of triangles of CompactGeometry, stored once for all triangles that share them
+class CompactMaterial {
+public:
+    TriangleRenderType renderType;
+    MaterialColor materialColor;
+    // -1 for triangles that are not textured
+    int textureIndex;
+
+    CompactMaterial(const Triangle &triangle) : renderType(triangle.renderType),
+                                                materialColor(triangle.materialColor),
+                                                textureIndex(triangle.textureIndex) {}
+
+    bool operator==(const CompactMaterial &m) const {
+        return renderType == m.renderType && materialColor == m.materialColor && textureIndex == m.textureIndex;
+    }
+
+    // Hash of what tells materials apart, for finding the material of a triangle among those already stored
+    size_t hash() const {
+        std::hash<float> hashFloat;
+        size_t h = (size_t) renderType * 31 + (size_t) textureIndex;
+        for (float x : {materialColor.diffusion.getR(), materialColor.diffusion.getG(), materialColor.diffusion.getB(),
+                        materialColor.specular.getR(), materialColor.specular.getG(), materialColor.specular.getB(),
+                        materialColor.ka, materialColor.kd, materialColor.ks, (float) materialColor.n,
+                        materialColor.opacity, materialColor.refractiveIndex}) {
+            h = h * 31 + hashFloat(x);
+        }
+        return h;
+    }
+
+};
+
+// COMPACT_CLUSTER_SIZE triangles that follow each other, placed on the lattice of CompactGeometry from a common
+// lattice point on and quantized within their common texture range
+class CompactCluster {
+public:
+    int32_t base[3];
+    float uOrigin, vOrigin, uStep, vStep;
+    // Largest distance of a decoded corner of the cluster from the original one
+    float error;
+};
+
+// What encoding triangles compactly saved and what it cost in precision
+class CompactStats {
+public:
+    int triangles, clusters, exactTriangles;
+    // Bytes of triangle data per triangle, as stored in a Triangle and compactly (cluster data included)
+    float bytesPerTriangle, compactBytesPerTriangle;
+    // Largest distance of a decoded corner from the original, and the size (box diagonal) of all triangles
+    float maxPositionError, size;
+    float maxNormalErrorDeg, maxTextureCoordinateError;
+
+    // this is to easily print a given object to std for debugging
+    friend std::ostream &operator<<(std::ostream &, const CompactStats &);
+
+    CompactStats() : triangles(0), clusters(0), exactTriangles(0), bytesPerTriangle(0), compactBytesPerTriangle(0),
+                     maxPositionError(0), size(0), maxNormalErrorDeg(0), maxTextureCoordinateError(0) {}
+
+};
+
+// Triangles of a scene encoded compactly, so that several times more of them fit in cache during traversal, and the
+// originals need not be kept: intersection tests and shading decode them on the fly, with materials and textures
+// shared between triangles, and only the few triangles kept exact are stored whole
+// Rays are let through wherever quantization may have moved the triangles to (see smallestNonNegativeT), so no ray
+// that hits a triangle misses its decoded version, nor the crack between two decoded neighbors
+// Corners are snapped to one lattice for the whole scene, fine enough for the largest cluster to span 16 bits, so a
+// corner shared by triangles of different clusters decodes to the very same point: decoded meshes stay watertight,
+// without steps between neighbors for rays leaving a decoded triangle to hit
+// Clusters are tightest when triangles close in space follow each other, as after reorderScene
+class CompactGeometry {
+public:
+    // Lattice point (i, j, k) is origin + step * (i, j, k)
+    Vector3D origin, step;
+    vector<CompactCluster> clusters;
+    vector<CompactTriangle> triangles;
+    vector<CompactMaterial> materials;
+    // Originals of the triangles kept exact
+    vector<Triangle> exactTriangles;
+
+    bool empty() const {
+        return triangles.empty();
+    }
+
+    size_t size() const {
+        return triangles.size();
+    }
+
+    // Returns true if triangle k is decoded, false if it is not encoded or was kept exact
+    bool isEncoded(size_t k) const {
+        return k < triangles.size() && !triangles[k].exact;
+    }
+
+    // Original of triangle k, which must have been kept exact
+    const Triangle &exactTriangle(size_t k) const {
+        return exactTriangles[triangles[k].exact - 1];
+    }
+
+    // Triangle k, decoded unless it was kept exact
+    Triangle triangleAt(size_t k) const {
+        return triangles[k].exact ? exactTriangle(k) : decode(k);
+    }
+
+    const MaterialColor &materialColorOf(size_t k) const {
+        return triangles[k].exact ? exactTriangle(k).materialColor : materials[triangles[k].material].materialColor;
+    }
+
+    // Index of the texture of triangle k, -1 if it is not textured
+    int textureIndexOf(size_t k) const {
+        return triangles[k].exact ? exactTriangle(k).textureIndex : materials[triangles[k].material].textureIndex;
+    }
+
+    // Encodes originals, replacing whatever was encoded before, after which they are no longer needed
+    // Triangles are kept exact if they decode too far off (see isTooFarOff), or if more than 65536 materials are
+    // needed for the others
+    CompactStats encode(const TriangleStore &originals) {
+        clusters.clear();
+        triangles.clear();
+        materials.clear();
+        exactTriangles.clear();
+        triangles.reserve(originals.size());
+        unordered_multimap<size_t, int> materialsByHash;
+        CompactStats stats;
+        Bounds all;
+        Vector3D largest;
+        for (size_t first = 0; first < originals.size(); first += COMPACT_CLUSTER_SIZE) {
+            Bounds box = boxOf(originals, first, min(first + COMPACT_CLUSTER_SIZE, originals.size()));
+            all.expand(box);
+            largest = Vector3D(max(largest.x, box.max.x - box.min.x), max(largest.y, box.max.y - box.min.y),
+                               max(largest.z, box.max.z - box.min.z));
+        }
+        // One step short of 16 bits, as clusters start at the lattice point below their box
+        origin = all.isEmpty() ? Vector3D() : all.min;
+        step = largest * (1.0f / 65534);
+        for (size_t first = 0; first < originals.size(); first += COMPACT_CLUSTER_SIZE) {
+            size_t last = min(first + COMPACT_CLUSTER_SIZE, originals.size());
+            clusters.push_back(clusterOf(originals, first, last));
+            CompactCluster &cluster = clusters.back();
+            for (size_t k = first; k < last; ++k) {
+                const Triangle &original = originals[k];
+                triangles.push_back(encodeTriangle(original, cluster));
+                Vector3D v1, v2, v3;
+                corners(k, v1, v2, v3);
+                cluster.error = max(cluster.error, max((v1 - original.v1).abs(),
+                                                       max((v2 - original.v2).abs(), (v3 - original.v3).abs())));
+            }
+            for (size_t k = first; k < last; ++k) {
+                int material = isTooFarOff(k, originals[k]) ? -1 : materialOf(originals[k], materialsByHash);
+                if (material < 0) {
+                    exactTriangles.push_back(originals[k]);
+                    triangles[k].exact = exactTriangles.size();
+                    stats.exactTriangles++;
+                } else {
+                    triangles[k].material = material;
+                    addErrors(k, originals[k], stats);
+                }
+            }
+        }
+        stats.triangles = triangles.size();
+        stats.clusters = clusters.size();
+        stats.bytesPerTriangle = sizeof(Triangle);
+        // Everything the encoding holds, shared materials and triangles kept exact included
+        float compactBytes = (float) sizeof(CompactTriangle) * triangles.size()
+                             + (float) sizeof(CompactCluster) * clusters.size()
+                             + (float) sizeof(CompactMaterial) * materials.size()
+                             + (float) sizeof(Triangle) * exactTriangles.size();
+        stats.compactBytesPerTriangle = triangles.empty() ? 0 : compactBytes / triangles.size();
+        stats.size = all.isEmpty() ? 0 : (all.max - all.min).abs();
+        return stats;
+    }
+
+    void corners(size_t k, Vector3D &v1, Vector3D &v2, Vector3D &v3) const {
+        const CompactTriangle &triangle = triangles[k];
+        const CompactCluster &cluster = clusters[k / COMPACT_CLUSTER_SIZE];
+        v1 = cornerOf(triangle.corners[0], cluster);
+        v2 = cornerOf(triangle.corners[1], cluster);
+        v3 = cornerOf(triangle.corners[2], cluster);
+    }
+
+    // Decoded triangle k, which must not have been kept exact
+    Triangle decode(size_t k) const {
+        Vector3D v1, v2, v3;
+        corners(k, v1, v2, v3);
+        const CompactTriangle &triangle = triangles[k];
+        const CompactCluster &cluster = clusters[k / COMPACT_CLUSTER_SIZE];
+        const CompactMaterial &material = materials[triangle.material];
+        switch (material.renderType) {
+            case FLAT_TEXTURE_LESS:
+                return Triangle(v1, v2, v3, material.materialColor);
+            case FLAT_TEXTURED:
+                return Triangle(v1, v2, v3, material.materialColor,
+                                textureCoordinatesOf(triangle.textureCoordinates[0], cluster),
+                                textureCoordinatesOf(triangle.textureCoordinates[1], cluster),
+                                textureCoordinatesOf(triangle.textureCoordinates[2], cluster), material.textureIndex);
+            case SMOOTH_TEXTURE_LESS:
+                return Triangle(v1, v2, v3, material.materialColor, normalOf(triangle.normals[0]),
+                                normalOf(triangle.normals[1]), normalOf(triangle.normals[2]));
+            default:
+                return Triangle(v1, v2, v3, material.materialColor, normalOf(triangle.normals[0]),
+                                normalOf(triangle.normals[1]), normalOf(triangle.normals[2]),
+                                textureCoordinatesOf(triangle.textureCoordinates[0], cluster),
+                                textureCoordinatesOf(triangle.textureCoordinates[1], cluster),
+                                textureCoordinatesOf(triangle.textureCoordinates[2], cluster), material.textureIndex);
+        }
+    }
+
+    // How much the summed areas of a point of the decoded triangle k's plane with its edges may exceed its area, as
+    // tolerance + grazingTolerance / |cos| of the angle between the ray and the plane's normal
+    // Corners moved by at most the cluster's error e, so a ray hitting the original triangle hits the decoded plane
+    // within e / |cos| of where it hit, which is within e of the decoded triangle: up to e (1 + 1 / |cos|) outside
+    // its edges. A point that far outside adds at most that times half the perimeter, which is doubled to make up for
+    // rounding, on top of the 1e-3 exact triangles are allowed
+    void tolerancesOf(size_t k, const Vector3D &v1, const Vector3D &v2, const Vector3D &v3, float &tolerance,
+                      float &grazingTolerance) const {
+        float perimeter = (v2 - v1).abs() + (v3 - v2).abs() + (v1 - v3).abs();
+        grazingTolerance = clusters[k / COMPACT_CLUSTER_SIZE].error * perimeter;
+        tolerance = 1e-3f + grazingTolerance;
+    }
+
+    // Returns T parameter of ray hitting the decoded triangle k (within its tolerances), -1 if it does not hit
+    float smallestNonNegativeT(const Ray &ray, size_t k, float grace) const {
+        Vector3D v1, v2, v3;
+        corners(k, v1, v2, v3);
+        float tolerance, grazingTolerance;
+        tolerancesOf(k, v1, v2, v3, tolerance, grazingTolerance);
+        return ::smallestNonNegativeT(ray, v1, v2, v3, grace, tolerance, grazingTolerance);
+    }
+
+    // Box of triangle k in the hierarchy
+    // Rays hitting an original triangle pass within the cluster's error of its decoded version, so that box is grown
+    // by twice the error, and by a few units in the last place of its coordinates, so that corners that decode
+    // exactly (no error) are not lost to rounding in box tests either
+    // Hits are also let through up to the largest tolerance / edge length outside the decoded triangle's edges, so it
+    // is grown by twice that too (as boundsOf does for the 1e-3 of exact triangles): hits a box test would cull could
+    // otherwise be found or not depending on the order the hierarchy is traversed in
+    Bounds boundsAt(size_t k) const {
+        if (triangles[k].exact) {
+            return boundsOf(exactTriangle(k));
+        }
+        Vector3D v1, v2, v3;
+        corners(k, v1, v2, v3);
+        Bounds bounds;
+        bounds.expand(v1);
+        bounds.expand(v2);
+        bounds.expand(v3);
+        float magnitude = max(max(abs(bounds.min.x), abs(bounds.max.x)),
+                              max(max(abs(bounds.min.y), abs(bounds.max.y)),
+                                  max(abs(bounds.min.z), abs(bounds.max.z))));
+        float tolerance, grazingTolerance;
+        tolerancesOf(k, v1, v2, v3, tolerance, grazingTolerance);
+        float shortestEdge = min((v2 - v1).abs(), min((v3 - v2).abs(), (v1 - v3).abs()));
+        float outside = (tolerance + grazingTolerance * COMPACT_GRAZING_LIMIT) / max(shortestEdge, 1e-6f);
+        return bounds.padded(2 * clusters[k / COMPACT_CLUSTER_SIZE].error + 2 * outside + 4 * FLT_EPSILON * magnitude);
+    }
+
+private:
+    static Bounds boxOf(const TriangleStore &originals, size_t first, size_t last) {
+        Bounds box;
+        for (size_t k = first; k < last; ++k) {
+            box.expand(boundsOf(originals[k]));
+        }
+        return box;
+    }
+
+    CompactCluster clusterOf(const TriangleStore &originals, size_t first, size_t last) const {
+        float uMin = FLT_MAX, vMin = FLT_MAX, uMax = -FLT_MAX, vMax = -FLT_MAX;
+        for (size_t k = first; k < last; ++k) {
+            const Triangle &triangle = originals[k];
+            if (triangle.renderType == FLAT_TEXTURED || triangle.renderType == SMOOTH_TEXTURED) {
+                for (const TextureCoordinates *tc : {&triangle.t1, &triangle.t2, &triangle.t3}) {
+                    uMin = min(uMin, tc->u);
+                    vMin = min(vMin, tc->v);
+                    uMax = max(uMax, tc->u);
+                    vMax = max(vMax, tc->v);
+                }
+            }
+        }
+        bool textured = uMin <= uMax;
+        Bounds box = boxOf(originals, first, last);
+        CompactCluster cluster;
+        cluster.base[0] = latticeBelow(box.min.x, origin.x, step.x);
+        cluster.base[1] = latticeBelow(box.min.y, origin.y, step.y);
+        cluster.base[2] = latticeBelow(box.min.z, origin.z, step.z);
+        cluster.uOrigin = textured ? uMin : 0;
+        cluster.vOrigin = textured ? vMin : 0;
+        cluster.uStep = textured ? (uMax - uMin) / 65535 : 0;
+        cluster.vStep = textured ? (vMax - vMin) / 65535 : 0;
+        cluster.error = 0;
+        return cluster;
+    }
+
+    CompactTriangle encodeTriangle(const Triangle &original, const CompactCluster &cluster) const {
+        CompactTriangle triangle = CompactTriangle();
+        const Vector3D *corners[3] = {&original.v1, &original.v2, &original.v3};
+        const Vector3D *normals[3] = {&original.n1, &original.n2, &original.n3};
+        const TextureCoordinates *textureCoordinates[3] = {&original.t1, &original.t2, &original.t3};
+        bool smooth = original.renderType == SMOOTH_TEXTURE_LESS || original.renderType == SMOOTH_TEXTURED;
+        bool textured = original.renderType == FLAT_TEXTURED || original.renderType == SMOOTH_TEXTURED;
+        for (int corner = 0; corner < 3; ++corner) {
+            triangle.corners[corner][0] = offsetOf(corners[corner]->x, origin.x, step.x, cluster.base[0]);
+            triangle.corners[corner][1] = offsetOf(corners[corner]->y, origin.y, step.y, cluster.base[1]);
+            triangle.corners[corner][2] = offsetOf(corners[corner]->z, origin.z, step.z, cluster.base[2]);
+            if (smooth) {
+                encodeNormal(*normals[corner], triangle.normals[corner]);
+            }
+            if (textured) {
+                triangle.textureCoordinates[corner][0] = quantize(textureCoordinates[corner]->u, cluster.uOrigin,
+                                                                  cluster.uStep);
+                triangle.textureCoordinates[corner][1] = quantize(textureCoordinates[corner]->v, cluster.vOrigin,
+                                                                  cluster.vStep);
+            }
+        }
+        return triangle;
+    }
+
+    // Decoded triangles whose area changes by more than 1% or whose plane turns by more than about a degree are kept
+    // exact, as rays would hit them noticeably elsewhere
+    bool isTooFarOff(size_t k, const Triangle &original) const {
+        Vector3D v1, v2, v3;
+        corners(k, v1, v2, v3);
+        Vector3D N = (v2 - v1).cross(v3 - v1);
+        float area = N.abs() / 2;
+        return area == 0 || abs(area - original.area) > 0.01f * original.area
+               || N.unit().dot(original.surfaceNormal.unit()) < 0.9998f;
+    }
+
+    // Index of the material of original in materials, which it is added to if it is not there yet, -1 if it is not and
+    // there are too many already
+    int materialOf(const Triangle &original, unordered_multimap<size_t, int> &materialsByHash) {
+        CompactMaterial material(original);
+        size_t hash = material.hash();
+        auto range = materialsByHash.equal_range(hash);
+        for (auto found = range.first; found != range.second; ++found) {
+            if (materials[found->second] == material) {
+                return found->second;
+            }
+        }
+        if (materials.size() > UINT16_MAX) {
+            return -1;
+        }
+        materials.push_back(material);
+        materialsByHash.emplace(hash, materials.size() - 1);
+        return materials.size() - 1;
+    }
+
+    void addErrors(size_t k, const Triangle &original, CompactStats &stats) const {
+        Triangle decoded = decode(k);
+        stats.maxPositionError = max(stats.maxPositionError, clusters[k / COMPACT_CLUSTER_SIZE].error);
+        if (original.renderType == SMOOTH_TEXTURE_LESS || original.renderType == SMOOTH_TEXTURED) {
+            for (const auto &normals : {make_pair(&original.n1, &decoded.n1), make_pair(&original.n2, &decoded.n2),
+                                        make_pair(&original.n3, &decoded.n3)}) {
+                float cosine = min(1.0f, max(-1.0f, normals.first->unit().dot(*normals.second)));
+                stats.maxNormalErrorDeg = max(stats.maxNormalErrorDeg, (float) (acos(cosine) * 180 / M_PI));
+            }
+        }
+        if (original.renderType == FLAT_TEXTURED || original.renderType == SMOOTH_TEXTURED) {
+            for (const auto &tcs : {make_pair(&original.t1, &decoded.t1), make_pair(&original.t2, &decoded.t2),
+                                    make_pair(&original.t3, &decoded.t3)}) {
+                stats.maxTextureCoordinateError = max(stats.maxTextureCoordinateError,
+                                                      max(abs(tcs.first->u - tcs.second->u),
+                                                          abs(tcs.first->v - tcs.second->v)));
+            }
+        }
+    }
+
+    static uint16_t quantize(float x, float origin, float step) {
+        if (step <= 0) {
+            return 0;
+        }
+        return (uint16_t) min(65535.0f, max(0.0f, round((x - origin) / step)));
+    }
+
+    // Offset from base of the lattice point nearest to x, which is the same for every cluster x is in
+    static uint16_t offsetOf(float x, float origin, float step, int32_t base) {
+        if (step <= 0) {
+            return 0;
+        }
+        return (uint16_t) min(65535, max(0, (int32_t) round((x - origin) / step) - base));
+    }
+
+    static int32_t latticeBelow(float x, float origin, float step) {
+        return step <= 0 ? 0 : max(0, (int32_t) floor((x - origin) / step));
+    }
+
+    // Lattice coordinates are summed as integers, so a corner decodes the same whichever cluster it is in
+    Vector3D cornerOf(const uint16_t *q, const CompactCluster &cluster) const {
+        return Vector3D(origin.x + (float) (cluster.base[0] + q[0]) * step.x,
+                        origin.y + (float) (cluster.base[1] + q[1]) * step.y,
+                        origin.z + (float) (cluster.base[2] + q[2]) * step.z);
+    }
+
+    static TextureCoordinates textureCoordinatesOf(const uint16_t *q, const CompactCluster &cluster) {
+        return TextureCoordinates(cluster.uOrigin + q[0] * cluster.uStep, cluster.vOrigin + q[1] * cluster.vStep);
+    }
+
+    // Octahedral encoding: the direction is projected onto the octahedron |x| + |y| + |z| = 1, whose lower half is
+    // folded out over the corners of the square its upper half projects to
+    static void encodeNormal(const Vector3D &normal, int16_t *encoded) {
+        float sum = abs(normal.x) + abs(normal.y) + abs(normal.z);
+        float x = sum > 0 ? normal.x / sum : 0, y = sum > 0 ? normal.y / sum : 0;
+        if (normal.z < 0) {
+            float foldedX = (1 - abs(y)) * (x >= 0 ? 1 : -1);
+            y = (1 - abs(x)) * (y >= 0 ? 1 : -1);
+            x = foldedX;
+        }
+        encoded[0] = (int16_t) round(min(1.0f, max(-1.0f, x)) * 32767);
+        encoded[1] = (int16_t) round(min(1.0f, max(-1.0f, y)) * 32767);
+    }
+
+    static Vector3D normalOf(const int16_t *encoded) {
+        float x = encoded[0] / 32767.0f, y = encoded[1] / 32767.0f;
+        float z = 1 - abs(x) - abs(y);
+        if (z < 0) {
+            float unfoldedX = (1 - abs(y)) * (x >= 0 ? 1 : -1);
+            y = (1 - abs(x)) * (y >= 0 ? 1 : -1);
+            x = unfoldedX;
+        }
+        return Vector3D(x, y, z).unit();
+    }
+
+};
+
+inline std::ostream &operator<<(std::ostream &out, const CompactStats &s) {
+    out << "CompactStats:" << "\t" << s.triangles << " triangles in " << s.clusters << " clusters, "
+        << s.bytesPerTriangle << " -> " << s.compactBytesPerTriangle << " bytes per triangle";
+    if (s.compactBytesPerTriangle > 0) {
+        out << " (" << s.bytesPerTriangle / s.compactBytesPerTriangle << "x)";
+    }
+    out << "\tmax position error " << s.maxPositionError;
+    if (s.size > 0) {
+        out << " (" << s.maxPositionError / s.size << " of scene size)";
+    }
+    out << ", max normal error " << s.maxNormalErrorDeg << " deg, max texture coordinate error "
+        << s.maxTextureCoordinateError << "\t" << s.exactTriangles << " triangles kept exact";
+    return out;
+}
+
+#endif
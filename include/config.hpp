@@ -0,0 +1,49 @@
+#ifndef CONFIG_HPP
+#define CONFIG_HPP
+
+#define SHADOW_GRACE 1e-4
+#define RECURSIVE_RAY_GRACE 1e-3
+#define CAMERA_MEDIUM_REFRACTIVE_INDEX 1
+#define CAMERA_MEDIUM_OPACITY 0
+#define RECURSIVE_DEPTH 6
+#define SOFT_SHADOW_JITTER 0
+#define NUM_SHADOW_RAYS_PER_POI 1
+#define AREA_LIGHT_SAMPLES 16
+#define SHADOW_PROBE_RAYS 4
+#define NUM_DISTRIBUTED_RAYS 10
+#define DISTRIBUTED_RAYS_JITTER 5e-2
+#define TILE_SIZE 16
+#define WATCH_POLL_INTERVAL_MS 200
+#define WATCH_BOUNDS_MARGIN 0.1
+#define BVH_REFIT_MAX_COST_GROWTH 2
+#define LIGHT_CULL_THRESHOLD 0
+#define LIGHT_SAMPLES 0
+#define SERVER_WORKERS 2
+#define SERVER_QUEUE_SIZE 16
+#define SERVER_SCENE_CACHE_SIZE 8
+#define SERVER_MAX_SCENE_BYTES (64 << 20)
+#define SERVER_READ_TIMEOUT_S 10
+#define CHECKPOINT_INTERVAL_S 60
+#define WORKER_TILES_IN_FLIGHT 2
+#define WORKER_TIMEOUT_S 300
+#define PROJECTED_BOUNDS_MARGIN 1e-2f
+#define PRIMARY_CANDIDATES_MAX 16
+#define SHADING_BATCH_SIZE 256
+#define WAVEFRONT_CAMERA_RAYS 16384
+#define CAMERA_RAY_PACKETS 1
+#define SHADOW_OCCLUDER_CACHE 1
+#define DOF_SHADING_TOLERANCE 1e-3f
+#define GEOMETRY_PREFETCH 0
+#define COMPACT_CLUSTER_SIZE 64
+#define COMPACT_GRAZING_LIMIT 8
+// Can also be set when building, e.g. make OPTFLAGS=-DFAST_MATH=1 (as tests/fastmath.sh does)
+#ifndef FAST_MATH
+#define FAST_MATH 0
+#endif
+#define DENOISE_ITERATIONS 3
+#define DENOISE_COLOR_SIGMA 0.5f
+#define DENOISE_NORMAL_SIGMA 0.1f
+#define DENOISE_DEPTH_SIGMA 0.05f
+#define LIGHTMAP_RESOLUTION 256
+
+#endif
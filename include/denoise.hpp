@@ -0,0 +1,63 @@
+#ifndef DENOISE_HPP
+#define DENOISE_HPP
+
+#include <iostream>
+#include <vector>
+#include "config.hpp"
+#include "vector3d.hpp"
+#include "color.hpp"
+#include "ray.hpp"
+#include "surfacehit.hpp"
+
+using namespace std;
+
+// What the camera rays of every pixel first hit, averaged over the pixel's rays: shading normal, distance from the ray
+// origin and diffusion color (albedo)
+// Misses add a zero normal, distance and albedo, so they are told apart from every hit and their colors are filtered
+// as they are
+class DenoiseGuides {
+public:
+    int width, height;
+    // Planes of width * height values, row by row
+    vector<float> normalX, normalY, normalZ, depth, albedoR, albedoG, albedoB;
+
+    // this is to easily print a given object to std for debugging
+    friend std::ostream &operator<<(std::ostream &, const DenoiseGuides &);
+
+    DenoiseGuides(int width, int height)
+            : width(width), height(height), normalX((size_t) width * height), normalY(normalX.size()),
+              normalZ(normalX.size()), depth(normalX.size()), albedoR(normalX.size()), albedoG(normalX.size()),
+              albedoB(normalX.size()) {}
+
+    // Adds hit of a camera ray of pixel (j * width + i), with given albedo, weighted by weight (1 / rays per pixel)
+    void add(int pixel, const Ray &ray, const SurfaceHit &hit, const Color &albedo, float weight) {
+        if (hit.isMiss()) {
+            return;
+        }
+        normalX[pixel] += hit.normal.x * weight;
+        normalY[pixel] += hit.normal.y * weight;
+        normalZ[pixel] += hit.normal.z * weight;
+        depth[pixel] += (hit.poi - ray.origin).abs() * weight;
+        albedoR[pixel] += albedo.getR() * weight;
+        albedoG[pixel] += albedo.getG() * weight;
+        albedoB[pixel] += albedo.getB() * weight;
+    }
+
+};
+
+inline std::ostream &operator<<(std::ostream &out, const DenoiseGuides &g) {
+    out << "DenoiseGuides:" << "\t" << g.width << "x" << g.height;
+    return out;
+}
+
+// Guides of the image being rendered by the calling thread, null when none are being recorded
+extern thread_local DenoiseGuides *activeDenoiseGuides;
+
+// Denoises colors (rendered with guides recorded) with DENOISE_ITERATIONS passes of the edge avoiding a-trous wavelet
+// filter: pass k blurs with a 5x5 B3 spline kernel whose taps are 2^k pixels apart, weighting each tap down by how
+// far its normal, distance and color are from the center pixel's, so that edges of geometry and of lighting stay sharp
+// Colors are divided by albedo before filtering and multiplied by it after, so that textures are not blurred
+// Rows are split between threads (one per core if threads is 0), 4 pixels of a row are filtered at once with SSE
+void denoiseImage(const DenoiseGuides &guides, vector<vector<Color> > &colors, int threads = 0);
+
+#endif
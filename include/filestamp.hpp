@@ -0,0 +1,54 @@
+#ifndef FILESTAMP_HPP
+#define FILESTAMP_HPP
+
+#include <iostream>
+#include <string>
+#include <sys/stat.h>
+
+using namespace std;
+
+// What a file on disk looked like: modification time to the nanosecond, size and inode, all 0 if it can not be read
+// Whole seconds alone miss a second save within the same second (editors that write twice, scripted edits), size and
+// inode catch writes within the filesystem's timestamp granularity that change the length or replace the file
+class FileStamp {
+public:
+    long long seconds, nanoseconds, size, inode;
+
+    // this is to easily print a given object to std for debugging
+    friend std::ostream &operator<<(std::ostream &, const FileStamp &);
+
+    FileStamp() : seconds(0), nanoseconds(0), size(0), inode(0) {}
+
+    explicit FileStamp(const string &filename) : FileStamp() {
+        struct stat fileStat;
+        if (stat(filename.c_str(), &fileStat) != 0) {
+            return;
+        }
+#ifdef __APPLE__
+        seconds = fileStat.st_mtimespec.tv_sec;
+        nanoseconds = fileStat.st_mtimespec.tv_nsec;
+#else
+        seconds = fileStat.st_mtim.tv_sec;
+        nanoseconds = fileStat.st_mtim.tv_nsec;
+#endif
+        size = fileStat.st_size;
+        inode = fileStat.st_ino;
+    }
+
+    bool operator==(const FileStamp &s) const {
+        return seconds == s.seconds && nanoseconds == s.nanoseconds && size == s.size && inode == s.inode;
+    }
+
+    bool operator!=(const FileStamp &s) const {
+        return !(*this == s);
+    }
+
+};
+
+inline std::ostream &operator<<(std::ostream &out, const FileStamp &s) {
+    out << "FileStamp:" << "\t" << s.seconds << "." << s.nanoseconds << " s\t" << s.size << " bytes\tinode "
+        << s.inode;
+    return out;
+}
+
+#endif
@@ -0,0 +1,59 @@
+#ifndef FOOTPRINT_HPP
+#define FOOTPRINT_HPP
+
+#include <cfloat>
+#include <unordered_set>
+#include "bounds.hpp"
+
+using namespace std;
+
+// Everything the rays traced for one tile of the image interacted with
+// Objects that were hit (by camera, reflected, transmitted or shadow rays)
+// And a box enclosing every ray segment, clipped to the box of the scene the tile was rendered with
+class TileFootprint {
+public:
+    unordered_set<int> touchedObjects;
+    Bounds rayBounds;
+    Bounds sceneBounds;
+
+    // this is to easily print a given object to std for debugging
+    friend std::ostream &operator<<(std::ostream &, const TileFootprint &);
+
+    TileFootprint() {}
+
+    TileFootprint(const Bounds &sceneBounds) : sceneBounds(sceneBounds) {}
+
+    void touch(int objIndex) {
+        touchedObjects.insert(objIndex);
+    }
+
+    // Renumbers objects at or after global index from by delta (when objects before them are added or removed)
+    void shiftObjects(int from, int delta) {
+        unordered_set<int> shifted;
+        for (int objIndex : touchedObjects) {
+            shifted.insert(objIndex >= from ? objIndex + delta : objIndex);
+        }
+        touchedObjects.swap(shifted);
+    }
+
+    // Records the part of ray between tMin and tMax (tMax = FLT_MAX for rays that never stop)
+    // A ray can only meet objects inside the scene box, so only the part inside it is recorded
+    void addSegment(const Ray &ray, float tMin, float tMax) {
+        if (!sceneBounds.clip(ray, tMin, tMax)) {
+            return;
+        }
+        rayBounds.expand(ray.pointAt(tMin));
+        rayBounds.expand(ray.pointAt(tMax));
+    }
+
+};
+
+inline std::ostream &operator<<(std::ostream &out, const TileFootprint &f) {
+    out << "TileFootprint:" << "\t" << f.touchedObjects.size() << "\t" << f.rayBounds;
+    return out;
+}
+
+// Footprint of the tile being rendered by the calling thread, null when footprints are not being recorded
+extern thread_local TileFootprint *activeFootprint;
+
+#endif
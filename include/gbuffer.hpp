@@ -0,0 +1,217 @@
+#ifndef GBUFFER_HPP
+#define GBUFFER_HPP
+
+#include <fstream>
+#include <vector>
+#include <cstdint>
+#include "ray.hpp"
+#include "surfacehit.hpp"
+
+using namespace std;
+
+// FNV-1a hash of raw bytes, chained through the hash argument
+inline uint64_t fnv1a(const void *data, size_t size, uint64_t hash = 14695981039346656037ULL) {
+    const unsigned char *bytes = (const unsigned char *) data;
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+inline uint64_t fnv1a(const Vector3D &v, uint64_t hash) {
+    hash = fnv1a(&v.x, sizeof(float), hash);
+    hash = fnv1a(&v.y, sizeof(float), hash);
+    return fnv1a(&v.z, sizeof(float), hash);
+}
+
+inline uint64_t fnv1a(const TextureCoordinates &tc, uint64_t hash) {
+    hash = fnv1a(&tc.u, sizeof(float), hash);
+    return fnv1a(&tc.v, sizeof(float), hash);
+}
+
+inline uint64_t fnv1a(const Triangle &triangle, uint64_t hash) {
+    int renderType = triangle.renderType;
+    hash = fnv1a(&renderType, sizeof(int), hash);
+    hash = fnv1a(triangle.v1, hash);
+    hash = fnv1a(triangle.v2, hash);
+    hash = fnv1a(triangle.v3, hash);
+    hash = fnv1a(triangle.n1, hash);
+    hash = fnv1a(triangle.n2, hash);
+    hash = fnv1a(triangle.n3, hash);
+    hash = fnv1a(triangle.t1, hash);
+    hash = fnv1a(triangle.t2, hash);
+    return fnv1a(triangle.t3, hash);
+}
+
+// Textured spheres' hits carry texture coordinates, so whether a sphere is textured (not which texture) is hashed too
+inline uint64_t fnv1a(const Sphere &sphere, uint64_t hash) {
+    int renderType = sphere.renderType;
+    bool textured = sphere.textureIndex >= 0;
+    hash = fnv1a(&renderType, sizeof(int), hash);
+    hash = fnv1a(&textured, sizeof(bool), hash);
+    hash = fnv1a(sphere.center, hash);
+    return fnv1a(&sphere.radius, sizeof(float), hash);
+}
+
+// Returns a hash of everything that decides where primary rays go and what they hit
+// Lights, material colors, textures and background are deliberately left out
+// So that editing them keeps a cached geometry buffer valid
+inline uint64_t primaryVisibilityHash(const Scene &scene) {
+    uint64_t hash = fnv1a(scene.eye, 14695981039346656037ULL);
+    hash = fnv1a(scene.viewDir, hash);
+    hash = fnv1a(scene.upDir, hash);
+    hash = fnv1a(&scene.vFovDeg, sizeof(float), hash);
+    hash = fnv1a(&scene.imWidth, sizeof(int), hash);
+    hash = fnv1a(&scene.imHeight, sizeof(int), hash);
+    hash = fnv1a(&scene.isParallelProjection, sizeof(bool), hash);
+    hash = fnv1a(&scene.viewingDistance, sizeof(float), hash);
+    for (const auto &sphere : scene.spheres) {
+        hash = fnv1a(sphere, hash);
+    }
+    if (!scene.compact.empty()) {
+        // Compactly encoded triangles are hit where their decoded versions are
+        for (size_t k = 0; k < scene.compact.size(); ++k) {
+            hash = fnv1a(scene.compact.triangleAt(k), hash);
+        }
+    } else if (scene.triangles.isMapped()) {
+        // Hashing mapped triangles would read the whole file, their hash was stored in it instead
+        uint64_t geometryHash = scene.triangles.geometryHash();
+        hash = fnv1a(&geometryHash, sizeof(uint64_t), hash);
+    } else {
+        for (const auto &triangle : scene.triangles) {
+            hash = fnv1a(triangle, hash);
+        }
+    }
+    // Meshes and their instances only add to the hash if there are any, so other scenes keep their hashes
+    for (const auto &mesh : scene.meshes) {
+        for (const auto &triangle : mesh.triangles) {
+            hash = fnv1a(triangle, hash);
+        }
+    }
+    for (const auto &instance : scene.instances) {
+        hash = fnv1a(&instance.mesh, sizeof(int), hash);
+        hash = fnv1a(instance.transform.row1, hash);
+        hash = fnv1a(instance.transform.row2, hash);
+        hash = fnv1a(instance.transform.row3, hash);
+        hash = fnv1a(&instance.transform.scale, sizeof(float), hash);
+        hash = fnv1a(instance.transform.translation, hash);
+    }
+    return hash;
+}
+
+// Geometry buffer: primary ray and its first hit for every sample of every pixel
+// Samples are stored in render order i.e. row by row, pixel by pixel, sample by sample
+class GBuffer {
+    uint64_t hash;
+    int width;
+    int height;
+    int samplesPerPixel;
+    vector<Ray> rays;
+    vector<SurfaceHit> hits;
+
+    // this is to easily print a given object to std for debugging
+    friend std::ostream &operator<<(std::ostream &, const GBuffer &);
+
+public:
+    GBuffer(uint64_t hash, int width, int height, int samplesPerPixel)
+            : hash(hash), width(width), height(height), samplesPerPixel(samplesPerPixel) {}
+
+    // A buffer is complete once every sample of every pixel has been added
+    bool isComplete() const {
+        return hits.size() == (size_t) width * height * samplesPerPixel;
+    }
+
+    void add(const Ray &ray, const SurfaceHit &hit) {
+        rays.push_back(ray);
+        hits.push_back(hit);
+    }
+
+    const Ray &rayAt(int i, int j, int sample) const {
+        return rays[((size_t) j * width + i) * samplesPerPixel + sample];
+    }
+
+    const SurfaceHit &hitAt(int i, int j, int sample) const {
+        return hits[((size_t) j * width + i) * samplesPerPixel + sample];
+    }
+
+    // Writes the buffer to a binary file, returns false if it could not be written
+    bool save(const string &filename) const {
+        ofstream out(filename.c_str(), ios::binary);
+        if (out.fail()) {
+            cerr << "Geometry buffer file named \"" << filename << "\" could not be opened for writing." << endl;
+            return false;
+        }
+        out.write("YGBF", 4);
+        out.write((const char *) &hash, sizeof(hash));
+        out.write((const char *) &width, sizeof(int));
+        out.write((const char *) &height, sizeof(int));
+        out.write((const char *) &samplesPerPixel, sizeof(int));
+        for (size_t k = 0; k < hits.size(); ++k) {
+            const Ray &ray = rays[k];
+            const SurfaceHit &hit = hits[k];
+            float record[16] = {ray.origin.x, ray.origin.y, ray.origin.z,
+                                ray.direction.x, ray.direction.y, ray.direction.z,
+                                hit.t,
+                                hit.poi.x, hit.poi.y, hit.poi.z,
+                                hit.normal.x, hit.normal.y, hit.normal.z,
+                                hit.textureCoordinates.u, hit.textureCoordinates.v, 0};
+            out.write((const char *) &hit.objIndex, sizeof(int));
+            out.write((const char *) record, sizeof(record));
+        }
+        return !out.fail();
+    }
+
+    // Reads the buffer from a binary file
+    // Returns false if file is missing, malformed or was built for different geometry or dimensions
+    bool load(const string &filename) {
+        ifstream in(filename.c_str(), ios::binary);
+        if (in.fail()) {
+            return false;
+        }
+        char magic[4];
+        uint64_t fileHash;
+        int fileWidth, fileHeight, fileSamplesPerPixel;
+        in.read(magic, 4);
+        in.read((char *) &fileHash, sizeof(fileHash));
+        in.read((char *) &fileWidth, sizeof(int));
+        in.read((char *) &fileHeight, sizeof(int));
+        in.read((char *) &fileSamplesPerPixel, sizeof(int));
+        if (in.fail() || string(magic, 4) != "YGBF") {
+            cerr << "Geometry buffer file named \"" << filename << "\" is invalid. Ignoring it." << endl;
+            return false;
+        }
+        if (fileHash != hash || fileWidth != width || fileHeight != height
+            || fileSamplesPerPixel != samplesPerPixel) {
+            cout << "Geometry buffer file named \"" << filename << "\" is stale. Ignoring it." << endl;
+            return false;
+        }
+        rays.clear();
+        hits.clear();
+        size_t count = (size_t) width * height * samplesPerPixel;
+        for (size_t k = 0; k < count; ++k) {
+            int objIndex;
+            float r[16];
+            in.read((char *) &objIndex, sizeof(int));
+            in.read((char *) r, sizeof(r));
+            if (in.fail()) {
+                cerr << "Geometry buffer file named \"" << filename << "\" is truncated. Ignoring it." << endl;
+                rays.clear();
+                hits.clear();
+                return false;
+            }
+            rays.emplace_back(Vector3D(r[0], r[1], r[2]), Vector3D(r[3], r[4], r[5]));
+            hits.emplace_back(objIndex, r[6], Vector3D(r[7], r[8], r[9]), Vector3D(r[10], r[11], r[12]),
+                              TextureCoordinates(r[13], r[14]));
+        }
+        return true;
+    }
+
+};
+
+inline std::ostream &operator<<(std::ostream &out, const GBuffer &g) {
+    out << "GBuffer:" << "\t" << g.width << "\t" << g.height << "\t" << g.samplesPerPixel << "\t" << g.hits.size();
+    return out;
+}
+
+#endif
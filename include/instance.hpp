@@ -0,0 +1,150 @@
+#ifndef INSTANCE_HPP
+#define INSTANCE_HPP
+
+#include <cmath>
+#include "vector3d.hpp"
+#include "color.hpp"
+#include "ray.hpp"
+#include "triangle.hpp"
+#include "bounds.hpp"
+
+using namespace std;
+
+#ifndef M_PI
+#define M_PI 3.1415926535
+#endif
+
+// Rotation (about x, then y, then z axis), uniform scale and translation, in that order, from object to world space
+class Transform {
+public:
+    // Rows of the rotation matrix, its columns are the rows of its inverse (the transpose)
+    Vector3D row1, row2, row3;
+    float scale;
+    Vector3D translation;
+
+    // this is to easily print a given object to std for debugging
+    friend std::ostream &operator<<(std::ostream &, const Transform &);
+
+    Transform() : row1(1, 0, 0), row2(0, 1, 0), row3(0, 0, 1), scale(1), translation(Vector3D()) {}
+
+    // Angles are in degrees
+    Transform(const Vector3D &rotationDeg, float scale, const Vector3D &translation)
+            : scale(scale), translation(translation) {
+        float cx = cos(rotationDeg.x * M_PI / 180), sx = sin(rotationDeg.x * M_PI / 180);
+        float cy = cos(rotationDeg.y * M_PI / 180), sy = sin(rotationDeg.y * M_PI / 180);
+        float cz = cos(rotationDeg.z * M_PI / 180), sz = sin(rotationDeg.z * M_PI / 180);
+        // Rz * Ry * Rx
+        row1 = Vector3D(cz * cy, cz * sy * sx - sz * cx, cz * sy * cx + sz * sx);
+        row2 = Vector3D(sz * cy, sz * sy * sx + cz * cx, sz * sy * cx - cz * sx);
+        row3 = Vector3D(-sy, cy * sx, cy * cx);
+    }
+
+    bool operator==(const Transform &t) const {
+        return row1 == t.row1 && row2 == t.row2 && row3 == t.row3 && scale == t.scale && translation == t.translation;
+    }
+
+    // Rotates direction (or normal, as the scale is uniform) into world space
+    Vector3D rotate(const Vector3D &d) const {
+        return Vector3D(row1.dot(d), row2.dot(d), row3.dot(d));
+    }
+
+    Vector3D toWorld(const Vector3D &p) const {
+        return rotate(p) * scale + translation;
+    }
+
+    // Box enclosing the corners of box moved into world space
+    Bounds toWorld(const Bounds &box) const {
+        Bounds world;
+        if (box.isEmpty()) {
+            return world;
+        }
+        for (int corner = 0; corner < 8; ++corner) {
+            world.expand(toWorld(Vector3D(corner & 1 ? box.max.x : box.min.x, corner & 2 ? box.max.y : box.min.y,
+                                          corner & 4 ? box.max.z : box.min.z)));
+        }
+        return world;
+    }
+
+    // Ray in object space that passes through the same points at the same T parameters
+    // The direction is scaled down along with the origin, so it is not unit unless the scale is 1
+    Ray toObject(const Ray &ray) const {
+        return Ray(rotateBack(ray.origin - translation) * (1 / scale), rotateBack(ray.direction) * (1 / scale));
+    }
+
+private:
+    Vector3D rotateBack(const Vector3D &d) const {
+        return row1 * d.x + row2 * d.y + row3 * d.z;
+    }
+
+};
+
+// Placement of a mesh definition of the scene (see Mesh) in world space
+// Instances refer to the mesh's triangles and its hierarchy instead of copying them, rays are moved into object space
+// Triangles of instances get global indices after the spheres and triangles of the scene, instance by instance
+class Instance {
+public:
+    // Index of the mesh in the scene's meshes
+    int mesh;
+    Transform transform;
+    // Box of the mesh's hierarchy in world space
+    Bounds bounds;
+    // Triangle k of the mesh has global index (number of spheres and triangles) + firstObject + k
+    int firstObject;
+    // If set, materialColor replaces the materials of the mesh's triangles
+    bool overridesMaterial;
+    MaterialColor materialColor;
+
+    // this is to easily print a given object to std for debugging
+    friend std::ostream &operator<<(std::ostream &, const Instance &);
+
+    Instance(int mesh, const Transform &transform, const Bounds &meshBounds, int firstObject)
+            : mesh(mesh), transform(transform), bounds(transform.toWorld(meshBounds)), firstObject(firstObject),
+              overridesMaterial(false) {}
+
+    Instance(int mesh, const Transform &transform, const Bounds &meshBounds, int firstObject,
+             const MaterialColor &materialColor)
+            : mesh(mesh), transform(transform), bounds(transform.toWorld(meshBounds)), firstObject(firstObject),
+              overridesMaterial(true), materialColor(materialColor) {}
+
+    bool operator==(const Instance &i) const {
+        return mesh == i.mesh && transform == i.transform && firstObject == i.firstObject
+               && overridesMaterial == i.overridesMaterial && (!overridesMaterial || materialColor == i.materialColor);
+    }
+
+    const MaterialColor &materialColorOf(const Triangle &triangle) const {
+        return overridesMaterial ? materialColor : triangle.materialColor;
+    }
+
+    // Returns copy of a triangle of the mesh in world space, with the instance's material
+    Triangle toWorld(const Triangle &t) const {
+        Vector3D v1 = transform.toWorld(t.v1), v2 = transform.toWorld(t.v2), v3 = transform.toWorld(t.v3);
+        const MaterialColor &color = materialColorOf(t);
+        switch (t.renderType) {
+            case FLAT_TEXTURE_LESS:
+                return Triangle(v1, v2, v3, color);
+            case FLAT_TEXTURED:
+                return Triangle(v1, v2, v3, color, t.t1, t.t2, t.t3, t.textureIndex);
+            case SMOOTH_TEXTURE_LESS:
+                return Triangle(v1, v2, v3, color, transform.rotate(t.n1), transform.rotate(t.n2),
+                                transform.rotate(t.n3));
+            default:
+                return Triangle(v1, v2, v3, color, transform.rotate(t.n1), transform.rotate(t.n2),
+                                transform.rotate(t.n3), t.t1, t.t2, t.t3, t.textureIndex);
+        }
+    }
+
+};
+
+inline std::ostream &operator<<(std::ostream &out, const Transform &t) {
+    out << "Transform:" << "\t" << t.row1 << "\t" << t.row2 << "\t" << t.row3 << "\tscale " << t.scale << "\t"
+        << t.translation;
+    return out;
+}
+
+inline std::ostream &operator<<(std::ostream &out, const Instance &i) {
+    out << "Instance:" << "\tmesh " << i.mesh << "\t" << i.transform << "\tfirst object " << i.firstObject
+        << (i.overridesMaterial ? "\tmaterial overridden" : "");
+    return out;
+}
+
+#endif
@@ -1,6 +1,9 @@
+#ifndef INTERSECTIONS_HPP
+#define INTERSECTIONS_HPP
+
 // Returns index of smallest non-negative number from vector
 // If all are negative then returns -1
-int indexOfSmallestNonNegativeElement(const vector<float> &vector) {
+inline int indexOfSmallestNonNegativeElement(const vector<float> &vector) {
     float minT = -1;
     int ans = -1;
     for (int i = 0; i < vector.size(); ++i) {
@@ -25,7 +28,7 @@ int indexOfSmallestNonNegativeElement(const vector<float> &vector) {
 }
 
 // Returns smallest positive t (ray parameter) if intersection does occurs in-front of the origin else returns -1
-float smallestNonNegativeT(const Ray &ray, const Sphere &sphere, float grace) {
+inline float smallestNonNegativeT(const Ray &ray, const Sphere &sphere, float grace) {
     // A = xd^2 + yd^2 + zd^2 = 1
     float A = ray.direction.absSquare();
     // B = xdxe + ... - xdxc - ...
@@ -66,7 +69,7 @@ float smallestNonNegativeT(const Ray &ray, const Sphere &sphere, float grace) {
 
 // Returns smallest positive t (ray parameter) if intersection does occurs in-front of the origin else returns -1
 // Independent of renderType of triangle
-float smallestNonNegativeT(const Ray &ray, const Triangle &triangle, float grace) {
+inline float smallestNonNegativeT(const Ray &ray, const Triangle &triangle, float grace) {
     float denominator = triangle.surfaceNormal.dot(ray.direction);
     float numerator = -(triangle.surfaceNormal.dot(ray.origin) + triangle.D);
     // Parallel / Coincident ray; doesn't intersect
@@ -83,3 +86,34 @@ float smallestNonNegativeT(const Ray &ray, const Triangle &triangle, float grace
     // Intersects inside triangle
     return t;
 }
+
+// Same test against the triangle with given corners, whose summed areas with a point inside may exceed its own area by
+// up to tolerance + grazingTolerance / |cos| of the angle between ray and the triangle's normal, with 1 / |cos| capped
+// at COMPACT_GRAZING_LIMIT (instead of 1e-3)
+inline float smallestNonNegativeT(const Ray &ray, const Vector3D &v1, const Vector3D &v2, const Vector3D &v3,
+                                  float grace, float tolerance, float grazingTolerance) {
+    Vector3D N = (v2 - v1).cross(v3 - v1);
+    float D = -v1.dot(N);
+    float area = N.abs() / 2;
+    float denominator = N.dot(ray.direction);
+    float numerator = -(N.dot(ray.origin) + D);
+    // Parallel / Coincident ray; doesn't intersect
+    if (abs(denominator) < 1e-6) { return -1; }
+    // Behind origin or self intersection intersection
+    float t = numerator / denominator;
+    if (t < grace) { return -1; }
+    Vector3D poi = ray.pointAt(t);
+    float a = (v2 - poi).cross(v3 - poi).abs() / 2;
+    float b = (v1 - poi).cross(v3 - poi).abs() / 2;
+    float c = (v1 - poi).cross(v2 - poi).abs() / 2;
+    if (grazingTolerance > 0) {
+        tolerance += grazingTolerance * min(N.abs() * ray.direction.abs() / abs(denominator),
+                                            (float) COMPACT_GRAZING_LIMIT);
+    }
+    // Out of triangle intersection
+    if (a + b + c - area > tolerance) { return -1; }
+    // Intersects inside triangle
+    return t;
+}
+
+#endif
@@ -0,0 +1,65 @@
+#ifndef JOB_QUEUE_HPP
+#define JOB_QUEUE_HPP
+
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+
+using namespace std;
+
+// First in first out queue of at most capacity jobs, shared by producer and consumer threads
+// Producers are never blocked: a job that does not fit is refused, so that they can push back on their clients
+template<typename Job>
+class JobQueue {
+    deque<Job> jobs;
+    size_t capacity;
+    bool closed;
+    mutable mutex lock;
+    condition_variable available;
+
+public:
+    explicit JobQueue(size_t capacity) : capacity(capacity), closed(false) {}
+
+    // Adds job to the back of the queue, returns false (leaving job as it is) if the queue is full or closed
+    bool tryPush(Job &job) {
+        {
+            lock_guard<mutex> guard(lock);
+            if (closed || jobs.size() >= capacity) {
+                return false;
+            }
+            jobs.push_back(move(job));
+        }
+        available.notify_one();
+        return true;
+    }
+
+    // Waits for a job and takes it from the front of the queue
+    // Returns false once the queue is closed and empty
+    bool pop(Job &job) {
+        unique_lock<mutex> guard(lock);
+        available.wait(guard, [this] { return closed || !jobs.empty(); });
+        if (jobs.empty()) {
+            return false;
+        }
+        job = move(jobs.front());
+        jobs.pop_front();
+        return true;
+    }
+
+    // Refuses further jobs, consumers still get the ones already queued
+    void close() {
+        {
+            lock_guard<mutex> guard(lock);
+            closed = true;
+        }
+        available.notify_all();
+    }
+
+    size_t size() const {
+        lock_guard<mutex> guard(lock);
+        return jobs.size();
+    }
+
+};
+
+#endif
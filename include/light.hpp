@@ -1,21 +1,71 @@
+#ifndef LIGHT_HPP
+#define LIGHT_HPP
+
 #include <cstdio>
 #include <cstdlib>
 #include <ctime>
+#include <cmath>
+#include <algorithm>
+#include "random.hpp"
+
+#ifndef M_PI
+#define M_PI 3.1415926535
+#endif
 
-float getRand() {
-    return ((float) (rand() % 100) / 100);
+inline float getRand() {
+    return ((float) (threadRandom().next() % 100) / 100);
 }
 
+// Uniform in [0, 1), finer grained than getRand, for picking among many choices
+inline float getRandUniform() {
+    return (float) threadRandom().next() / ((float) Random::MAX + 1);
+}
+
+#define LIGHT_DIRECTIONAL 0
+#define LIGHT_POINT 1
+#define LIGHT_SPHERE 2
+#define LIGHT_QUAD 3
+
 class Light {
 public:
+    // Directional: direction, Point: position, Area: center
     const Vector3D vector;
     const int type;
     const Color color;
+    // Sphere area light: radius
+    const float radius;
+    // Quad area light: edges, the quad spans vector +- edgeU / 2 +- edgeV / 2
+    const Vector3D edgeU, edgeV;
 
     // this is to easily print a given object to std for debugging
     friend std::ostream &operator<<(std::ostream &, const Light &);
 
-    Light(Vector3D vector, int w, Color color) : vector(vector), type(w), color(color) {}
+    Light(Vector3D vector, int w, Color color) : vector(vector), type(w), color(color), radius(0) {}
+
+    // Sphere area light
+    Light(Vector3D center, float radius, Color color)
+            : vector(center), type(LIGHT_SPHERE), color(color), radius(radius) {}
+
+    // Quad area light
+    Light(Vector3D center, Vector3D edgeU, Vector3D edgeV, Color color)
+            : vector(center), type(LIGHT_QUAD), color(color), radius(0), edgeU(edgeU), edgeV(edgeV) {}
+
+    bool operator==(const Light &l) const {
+        return vector == l.vector && type == l.type && color == l.color && radius == l.radius && edgeU == l.edgeU &&
+               edgeV == l.edgeV;
+    }
+
+    bool isArea() const {
+        return type == LIGHT_SPHERE || type == LIGHT_QUAD;
+    }
+
+    // Radius of a sphere around vector enclosing the whole light (0 for point and directional lights)
+    float boundingRadius() const {
+        if (type == LIGHT_QUAD) {
+            return std::max((edgeU + edgeV).abs(), (edgeU - edgeV).abs()) / 2;
+        }
+        return radius;
+    }
 
     Vector3D poiToLightUnitVector(const Vector3D &poi, float jitter = 0) const {
         if (type == 0) {
@@ -25,13 +75,40 @@ public:
         }
     }
 
+    // Point on area light for (u, v) in [0, 1) x [0, 1), as seen from poi
+    // Stratified (u, v) give stratified points
+    // A sphere is seen as a disk facing poi, so points are spread over that disk
+    Vector3D pointOnLight(const Vector3D &poi, float u, float v) const {
+        if (type == LIGHT_QUAD) {
+            return vector + edgeU * (u - 0.5f) + edgeV * (v - 0.5f);
+        }
+        Vector3D w = (poi - vector).unit();
+        // Any unit vector not parallel to w gives basis of the disk
+        Vector3D a = fabs(w.x) > 0.9 ? Vector3D(0, 1, 0) : Vector3D(1, 0, 0);
+        Vector3D s = a.cross(w).unit();
+        Vector3D t = w.cross(s);
+        float r = radius * sqrt(u);
+        float phi = 2 * M_PI * v;
+        return vector + s * (r * cos(phi)) + t * (r * sin(phi));
+    }
+
 };
 
-std::ostream &operator<<(std::ostream &out, const Light &l) {
+inline std::ostream &operator<<(std::ostream &out, const Light &l) {
     out << "Light:" << "\t";
     out << l.vector << "\t";
     out << "renderType: ";
-    l.type == 0 ? out << "Directional" << "\t" : out << "Point" << "\t";
+    if (l.type == LIGHT_DIRECTIONAL) {
+        out << "Directional" << "\t";
+    } else if (l.type == LIGHT_POINT) {
+        out << "Point" << "\t";
+    } else if (l.type == LIGHT_SPHERE) {
+        out << "Sphere" << "\t" << l.radius << "\t";
+    } else {
+        out << "Quad" << "\t" << l.edgeU << "\t" << l.edgeV << "\t";
+    }
     out << l.color << "\t";
     return out;
 }
+
+#endif
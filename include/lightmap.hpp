@@ -0,0 +1,147 @@
+#ifndef LIGHTMAP_HPP
+#define LIGHTMAP_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include "config.hpp"
+#include "vector3d.hpp"
+#include "color.hpp"
+#include "triangle.hpp"
+
+using namespace std;
+
+// What baking lightmaps cost
+class LightmapStats {
+public:
+    int triangles, lights, maxResolution;
+    // Triangles of instances are not baked, their hits still cast shadow rays
+    long unbakedTriangles;
+    long texels, shadowTests;
+    float megabytes, seconds;
+
+    // this is to easily print a given object to std for debugging
+    friend std::ostream &operator<<(std::ostream &, const LightmapStats &);
+
+    LightmapStats() : triangles(0), lights(0), maxResolution(0), unbakedTriangles(0), texels(0), shadowTests(0),
+                      megabytes(0), seconds(0) {}
+
+};
+
+inline std::ostream &operator<<(std::ostream &out, const LightmapStats &s) {
+    out << "LightmapStats:" << "\t" << s.triangles << " triangles, " << s.texels << " texels (up to "
+        << s.maxResolution << " per edge), " << s.lights << " lights, " << s.shadowTests << " shadow tests, "
+        << s.megabytes << " MB, baked in " << s.seconds << " s";
+    if (s.unbakedTriangles > 0) {
+        out << ", " << s.unbakedTriangles << " triangles of instances not baked (shaded with shadow rays)";
+    }
+    return out;
+}
+
+// Shadow factors of every light, baked for the triangles of a scene (not of instances) at the points of a triangular
+// lattice over each of them: with resolution r, texel (a, b) for a + b <= r is at barycentric coordinates
+// (1 - (a + b) / r, a / r, b / r), so corners and edges have texels of their own
+// Triangles get resolutions of their own, for texels of about the same size everywhere
+// Shadow factors at a hit are interpolated linearly between the 3 texels of the lattice cell it is in
+class Lightmaps {
+public:
+    int noLights;
+    // Number of triangles baked, the first ones of the scene
+    int noTriangles;
+    vector<int> resolutions;
+    // Index of the first texel of every triangle, texels of a triangle follow each other
+    vector<size_t> firstTexels;
+    // noLights shadow factors per texel
+    vector<float> texels;
+
+    Lightmaps() : noLights(0), noTriangles(0) {}
+
+    bool empty() const {
+        return noTriangles == 0;
+    }
+
+    static int texelsOf(int resolution) {
+        return (resolution + 1) * (resolution + 2) / 2;
+    }
+
+    // Sets up zeroed texels of triangles of given resolutions
+    void resize(const vector<int> &resolutions, int noLights) {
+        this->resolutions = resolutions;
+        this->noLights = noLights;
+        noTriangles = resolutions.size();
+        firstTexels.resize(noTriangles);
+        size_t noTexels = 0;
+        for (int k = 0; k < noTriangles; ++k) {
+            firstTexels[k] = noTexels;
+            noTexels += texelsOf(resolutions[k]);
+        }
+        texels.assign(noTexels * noLights, 0);
+    }
+
+    // Shadow factors of texel (a, b) of triangle, rows of b after one another
+    float *texelOf(int triangle, int a, int b) {
+        return &texels[offsetOf(triangle, a, b)];
+    }
+
+    const float *texelOf(int triangle, int a, int b) const {
+        return &texels[offsetOf(triangle, a, b)];
+    }
+
+    // Barycentric coordinates of poi (in the plane of triangle) with respect to v2 and v3
+    static void barycentricOf(const Triangle &triangle, const Vector3D &poi, float &beta, float &gamma) {
+        Vector3D e1 = triangle.v2 - triangle.v1, e2 = triangle.v3 - triangle.v1, p = poi - triangle.v1;
+        float normSquare = triangle.surfaceNormal.absSquare();
+        beta = triangle.surfaceNormal.dot(p.cross(e2)) / normSquare;
+        gamma = triangle.surfaceNormal.dot(e1.cross(p)) / normSquare;
+    }
+
+    // Interpolates the shadow factors (noLights of them) of the triangle with given index at poi, triangle being its
+    // world space version
+    void shadowFactorsAt(int index, const Triangle &triangle, const Vector3D &poi, float *shadowFactors) const {
+        int resolution = resolutions[index];
+        float beta, gamma;
+        barycentricOf(triangle, poi, beta, gamma);
+        // Lattice coordinates, clamped into the triangle
+        float x = max(0.0f, beta) * resolution, y = max(0.0f, gamma) * resolution;
+        if (x + y > resolution) {
+            float scale = resolution / (x + y);
+            x *= scale;
+            y *= scale;
+        }
+        int a = min((int) x, resolution - 1), b = min((int) y, resolution - 1);
+        float fx = x - a, fy = y - b;
+        // A point on the far edge has no cell of its own past it, it is taken as the far side of the previous one
+        if (a + b >= resolution) {
+            if (a > 0) {
+                a--;
+                fx += 1;
+            } else {
+                b--;
+                fy += 1;
+            }
+        }
+        const float *corners[3];
+        float weights[3];
+        // Cells along the far edge only have their lower half
+        if (fx + fy <= 1 || a + b == resolution - 1) {
+            corners[0] = texelOf(index, a, b), weights[0] = 1 - fx - fy;
+            corners[1] = texelOf(index, a + 1, b), weights[1] = fx;
+            corners[2] = texelOf(index, a, b + 1), weights[2] = fy;
+        } else {
+            corners[0] = texelOf(index, a + 1, b + 1), weights[0] = fx + fy - 1;
+            corners[1] = texelOf(index, a, b + 1), weights[1] = 1 - fx;
+            corners[2] = texelOf(index, a + 1, b), weights[2] = 1 - fy;
+        }
+        for (int l = 0; l < noLights; ++l) {
+            shadowFactors[l] = corners[0][l] * weights[0] + corners[1][l] * weights[1] + corners[2][l] * weights[2];
+        }
+    }
+
+private:
+    size_t offsetOf(int triangle, int a, int b) const {
+        return (firstTexels[triangle] + b * (resolutions[triangle] + 1) - b * (b - 1) / 2 + a) * noLights;
+    }
+
+};
+
+#endif
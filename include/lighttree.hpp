@@ -0,0 +1,189 @@
+#ifndef LIGHT_TREE_HPP
+#define LIGHT_TREE_HPP
+
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include "bounds.hpp"
+
+using namespace std;
+
+#ifndef M_PI
+#define M_PI 3.1415926535
+#endif
+
+// Brightest channel of a light, bounds how much it can add to any channel of a blinn-phong color
+inline float intensityOf(const Light &light) {
+    return light.color.maxChannel();
+}
+
+// Upper bound of blinn-phong diffuse and specular terms (without shadows) of lights of given total intensity
+// Whose unit directions from poi make angles of at least minAngleNL with N and minAngleNH (half vectors) with N
+// Diffusion and specular colors are at most 1, so they are left out
+inline float contributionBound(float intensity, float minAngleNL, float minAngleNH, float kd, float ks, int n) {
+    float maxNL = minAngleNL >= M_PI / 2 ? 0 : cos(minAngleNL);
+    float maxNH = minAngleNH >= M_PI / 2 ? 0 : cos(minAngleNH);
+    // pow(0, 0) = 1, so with n = 0 the specular term is there no matter where the light is
+    float specular = n == 0 ? 1 : pow(maxNH, n);
+    return intensity * (kd * maxNL + ks * specular);
+}
+
+// Angle between two unit vectors
+inline float angleBetween(const Vector3D &a, const Vector3D &b) {
+    return acos(max(-1.0f, min(1.0f, a.dot(b))));
+}
+
+class LightTreeNode {
+public:
+    // Box around lights in the subtree
+    Bounds bounds;
+    // Sum of intensities of lights in the subtree
+    float intensity;
+    // Interior node: index of right child (left child is the node right after this one), Leaf: -1
+    int rightChild;
+    // Leaf: lights lightIndices[first] ... lightIndices[first + count - 1]
+    int first, count;
+
+    LightTreeNode() : intensity(0), rightChild(-1), first(0), count(0) {}
+
+    bool isLeaf() const {
+        return rightChild < 0;
+    }
+};
+
+// Hierarchy over positions of point lights, to skip clusters of lights that cannot noticeably light a point
+// Lights have no distance falloff, so clusters are bounded only by how much they face the point (and viewer)
+// Directional lights are not clustered, each is bounded on its own
+class LightTree {
+public:
+    vector<LightTreeNode> nodes;
+    vector<int> lightIndices;
+    vector<int> directionalLights;
+
+    // this is to easily print a given object to std for debugging
+    friend std::ostream &operator<<(std::ostream &, const LightTree &);
+
+    void build(const vector<Light> &lights) {
+        nodes.clear();
+        lightIndices.clear();
+        directionalLights.clear();
+        for (size_t k = 0; k < lights.size(); ++k) {
+            if (lights[k].type == 0) {
+                directionalLights.push_back(k);
+            } else {
+                lightIndices.push_back(k);
+            }
+        }
+        if (!lightIndices.empty()) {
+            buildRecursive(lights, 0, lightIndices.size());
+        }
+    }
+
+    // Appends (in increasing order) indices of lights that are needed to light poi
+    // Leaves out lights whose blinn-phong terms at poi add up to at most threshold (in every color channel)
+    // N is normal and V is unit direction to the viewer at poi
+    void collect(const vector<Light> &lights, const Vector3D &poi, const Vector3D &N, const Vector3D &V,
+                 float kd, float ks, int n, float threshold, vector<int> &out) const {
+        size_t start = out.size();
+        // Bound of terms of lights left out so far
+        float culled = 0;
+        for (int k : directionalLights) {
+            Vector3D L = (lights[k].vector * -1).unit();
+            float bound = boundFor(intensityOf(lights[k]), L, 0, N, V, kd, ks, n);
+            if (culled + bound <= threshold) {
+                culled += bound;
+            } else {
+                out.push_back(k);
+            }
+        }
+        if (!nodes.empty()) {
+            int stack[64];
+            int top = 0;
+            stack[top++] = 0;
+            while (top > 0) {
+                int nodeIndex = stack[--top];
+                const LightTreeNode &node = nodes[nodeIndex];
+                // Lights in the box are seen from poi within a cone around direction to the center of the box
+                Vector3D center = node.bounds.centroid();
+                float radius = (node.bounds.max - node.bounds.min).abs() / 2;
+                Vector3D toCenter = center - poi;
+                float distance = toCenter.abs();
+                float halfAngle = distance <= radius ? M_PI : asin(radius / distance);
+                float bound = boundFor(node.intensity, toCenter.unit(), halfAngle, N, V, kd, ks, n);
+                if (culled + bound <= threshold) {
+                    culled += bound;
+                    continue;
+                }
+                if (node.isLeaf()) {
+                    for (int m = node.first; m < node.first + node.count; ++m) {
+                        out.push_back(lightIndices[m]);
+                    }
+                } else {
+                    stack[top++] = node.rightChild;
+                    stack[top++] = nodeIndex + 1;
+                }
+            }
+        }
+        sort(out.begin() + start, out.end());
+    }
+
+private:
+    // Bound of terms of lights of given total intensity, seen from poi within halfAngle of unit direction L
+    static float boundFor(float intensity, const Vector3D &L, float halfAngle, const Vector3D &N, const Vector3D &V,
+                          float kd, float ks, int n) {
+        if (halfAngle >= M_PI) {
+            return contributionBound(intensity, 0, 0, kd, ks, n);
+        }
+        float minAngleNL = max(0.0f, angleBetween(N, L) - halfAngle);
+        // Half vector bisects light and view directions, so it is at most half their angle away from the light
+        float maxAngleLH = (angleBetween(L, V) + halfAngle) / 2;
+        float minAngleNH = max(0.0f, minAngleNL - maxAngleLH);
+        return contributionBound(intensity, minAngleNL, minAngleNH, kd, ks, n);
+    }
+
+    // Builds node for lightIndices[first] ... lightIndices[first + count - 1], returns its index
+    int buildRecursive(const vector<Light> &lights, int first, int count) {
+        int nodeIndex = nodes.size();
+        nodes.emplace_back();
+        Bounds bounds;
+        float intensity = 0;
+        for (int m = first; m < first + count; ++m) {
+            // Area lights are enclosed whole, as any point of them can light the poi
+            const Light &light = lights[lightIndices[m]];
+            float r = light.boundingRadius();
+            bounds.expand(light.vector - Vector3D(r, r, r));
+            bounds.expand(light.vector + Vector3D(r, r, r));
+            intensity += intensityOf(lights[lightIndices[m]]);
+        }
+        nodes[nodeIndex].bounds = bounds;
+        nodes[nodeIndex].intensity = intensity;
+        Vector3D extent = bounds.max - bounds.min;
+        if (count == 1 || (extent.x <= 0 && extent.y <= 0 && extent.z <= 0)) {
+            nodes[nodeIndex].first = first;
+            nodes[nodeIndex].count = count;
+            return nodeIndex;
+        }
+        int axis = extent.x >= extent.y && extent.x >= extent.z ? 0 : (extent.y >= extent.z ? 1 : 2);
+        int mid = first + count / 2;
+        nth_element(lightIndices.begin() + first, lightIndices.begin() + mid, lightIndices.begin() + first + count,
+                    [&lights, axis](int a, int b) {
+                        const Vector3D &pa = lights[a].vector, &pb = lights[b].vector;
+                        float va = axis == 0 ? pa.x : (axis == 1 ? pa.y : pa.z);
+                        float vb = axis == 0 ? pb.x : (axis == 1 ? pb.y : pb.z);
+                        return va < vb || (va == vb && a < b);
+                    });
+        buildRecursive(lights, first, mid - first);
+        int right = buildRecursive(lights, mid, first + count - mid);
+        nodes[nodeIndex].rightChild = right;
+        return nodeIndex;
+    }
+
+};
+
+inline std::ostream &operator<<(std::ostream &out, const LightTree &t) {
+    out << "LightTree:" << "\t" << t.nodes.size() << " nodes\t" << t.lightIndices.size() << " point lights\t"
+        << t.directionalLights.size() << " directional lights";
+    return out;
+}
+
+#endif
@@ -0,0 +1,40 @@
+#ifndef MESH_HPP
+#define MESH_HPP
+
+#include <string>
+#include <vector>
+#include "triangle.hpp"
+#include "bvh.hpp"
+
+using namespace std;
+
+// Named mesh definition of a scene: triangles in object space and the hierarchy over them
+// It is not rendered itself, only its instances (see Instance) are, all of them sharing this one copy
+class Mesh {
+public:
+    string name;
+    vector<Triangle> triangles;
+    // Over triangles, triangle k is object k
+    BVH bvh;
+
+    // this is to easily print a given object to std for debugging
+    friend std::ostream &operator<<(std::ostream &, const Mesh &);
+
+    Mesh(const string &name) : name(name) {}
+
+    bool operator==(const Mesh &m) const {
+        return name == m.name && triangles == m.triangles;
+    }
+
+    Bounds bounds() const {
+        return bvh.isEmpty() ? Bounds() : bvh.nodes[0].bounds;
+    }
+
+};
+
+inline std::ostream &operator<<(std::ostream &out, const Mesh &m) {
+    out << "Mesh:" << "\t" << m.name << "\t" << m.triangles.size() << " triangles";
+    return out;
+}
+
+#endif
@@ -0,0 +1,87 @@
+#ifndef OCCLUDER_HPP
+#define OCCLUDER_HPP
+
+#include <iostream>
+#include <algorithm>
+#include <vector>
+#include "config.hpp"
+
+using namespace std;
+
+// What last occluder caches saved: shadow rays tested against the occluder their light last had, how many of them it
+// blocked (settled without traversing the hierarchy), and how many were blocked by an opaque object in all
+class OccluderStats {
+public:
+    long lookups, hits, blocked;
+
+    // this is to easily print a given object to std for debugging
+    friend std::ostream &operator<<(std::ostream &, const OccluderStats &);
+
+    OccluderStats() : lookups(0), hits(0), blocked(0) {}
+
+    OccluderStats &operator+=(const OccluderStats &s) {
+        lookups += s.lookups;
+        hits += s.hits;
+        blocked += s.blocked;
+        return *this;
+    }
+
+};
+
+inline std::ostream &operator<<(std::ostream &out, const OccluderStats &s) {
+    out << "OccluderStats:" << "\t" << s.lookups << " shadow rays tested against the last occluder of their light, "
+        << s.hits << " blocked by it (" << (s.lookups > 0 ? 100.0 * s.hits / s.lookups : 0) << "%), that is "
+        << (s.blocked > 0 ? 100.0 * s.hits / s.blocked : 0) << "% of " << s.blocked << " blocked shadow rays";
+    return out;
+}
+
+// Global index of the opaque object that last blocked a shadow ray toward every light (by index in the scene), -1 for
+// none yet, for every recursion depth of the hits shadow rays are cast from
+// Neighbouring shadow rays toward a light mostly end on the same object, so it is tested first and settles the ray if
+// it blocks it again. Hits of reflected and transmitted rays are shaded in between those of neighbouring camera rays,
+// so every depth keeps occluders of its own
+// Only valid for the scene it was filled for, so it is kept for the length of one render
+class OccluderCache {
+    // Occluders of light l are at l * (RECURSIVE_DEPTH + 1) + depth
+    vector<int> occluders;
+
+    // this is to easily print a given object to std for debugging
+    friend std::ostream &operator<<(std::ostream &, const OccluderCache &);
+
+public:
+    // Recursion depth left of the hit being shaded, see traceRayRecursive
+    int depth;
+    OccluderStats stats;
+
+    OccluderCache() : depth(0) {}
+
+    int lastOccluder(int light) const {
+        size_t slot = slotOf(light);
+        return slot < occluders.size() ? occluders[slot] : -1;
+    }
+
+    void remember(int light, int objIndex) {
+        size_t slot = slotOf(light);
+        if (slot >= occluders.size()) {
+            occluders.resize((light + 1) * (RECURSIVE_DEPTH + 1), -1);
+        }
+        occluders[slot] = objIndex;
+    }
+
+private:
+    size_t slotOf(int light) const {
+        return (size_t) light * (RECURSIVE_DEPTH + 1) + min(max(depth, 0), RECURSIVE_DEPTH);
+    }
+
+};
+
+inline std::ostream &operator<<(std::ostream &out, const OccluderCache &c) {
+    out << "OccluderCache:" << "\t" << c.occluders.size() / (RECURSIVE_DEPTH + 1) << " lights\tdepth " << c.depth
+        << "\t" << c.stats;
+    return out;
+}
+
+// Last occluder cache of the calling thread, null when shadow rays always traverse the hierarchy
+extern thread_local OccluderCache *activeOccluders;
+
+#endif
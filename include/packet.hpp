@@ -0,0 +1,251 @@
+#ifndef PACKET_HPP
+#define PACKET_HPP
+
+#include <cmath>
+#include <cfloat>
+#include <utility>
+#include <unordered_map>
+#include "ray.hpp"
+#include "bounds.hpp"
+#include "intersections.hpp"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+using namespace std;
+
+#define PACKET_SIZE 4
+
+// Smallest float that is at least x, and largest float that is at most x
+// Comparing a float against them is the same as comparing it against x in double, as the scalar tests do
+inline float floatAtLeast(double x) {
+    float f = (float) x;
+    return f < x ? nextafterf(f, INFINITY) : f;
+}
+
+inline float floatAtMost(double x) {
+    float f = (float) x;
+    return f > x ? nextafterf(f, -INFINITY) : f;
+}
+
+// Up to PACKET_SIZE rays tested together against boxes and triangles, one ray per SSE lane
+// Lanes are numbered as the rays they were made of, bit k of a lane mask stands for lane k
+// Tests give exactly the results of their scalar versions (Bounds::clip, smallestNonNegativeT) for every lane, as
+// they do the same float operations in the same order
+class RayPacket {
+public:
+    Ray rays[PACKET_SIZE];
+    // Mask of the lanes holding rays, unused lanes repeat the first ray
+    int activeMask;
+    float ox[PACKET_SIZE], oy[PACKET_SIZE], oz[PACKET_SIZE];
+    float dx[PACKET_SIZE], dy[PACKET_SIZE], dz[PACKET_SIZE];
+
+    // this is to easily print a given object to std for debugging
+    friend std::ostream &operator<<(std::ostream &, const RayPacket &);
+
+    RayPacket(const Ray *packetRays, int count) : activeMask((1 << count) - 1) {
+        for (int lane = 0; lane < PACKET_SIZE; ++lane) {
+            const Ray &ray = packetRays[lane < count ? lane : 0];
+            rays[lane] = ray;
+            ox[lane] = ray.origin.x;
+            oy[lane] = ray.origin.y;
+            oz[lane] = ray.origin.z;
+            dx[lane] = ray.direction.x;
+            dy[lane] = ray.direction.y;
+            dz[lane] = ray.direction.z;
+        }
+    }
+
+    // Returns true if the rays point into the same octant, so that they tend to take the same way through a hierarchy
+    bool isCoherent() const {
+        int octant = octantOf(0);
+        for (int lane = 1; lane < PACKET_SIZE; ++lane) {
+            if ((activeMask >> lane & 1) && octantOf(lane) != octant) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Returns mask of the lanes whose rays pass through box between 0 and tMax[lane]
+    int clip(const Bounds &box, const float *tMax) const {
+        if (box.isEmpty()) {
+            return 0;
+        }
+#ifdef __SSE2__
+        __m128 tNear = _mm_setzero_ps(), tFar = _mm_loadu_ps(tMax);
+        __m128 missed = _mm_setzero_ps();
+        clipAxis(_mm_loadu_ps(ox), _mm_loadu_ps(dx), box.min.x, box.max.x, tNear, tFar, missed);
+        clipAxis(_mm_loadu_ps(oy), _mm_loadu_ps(dy), box.min.y, box.max.y, tNear, tFar, missed);
+        clipAxis(_mm_loadu_ps(oz), _mm_loadu_ps(dz), box.min.z, box.max.z, tNear, tFar, missed);
+        __m128 hit = _mm_andnot_ps(missed, _mm_cmple_ps(tNear, tFar));
+        return _mm_movemask_ps(hit) & activeMask;
+#else
+        int mask = 0;
+        for (int lane = 0; lane < PACKET_SIZE; ++lane) {
+            float t0 = 0, t1 = tMax[lane];
+            if (box.clip(rays[lane], t0, t1)) {
+                mask |= 1 << lane;
+            }
+        }
+        return mask & activeMask;
+#endif
+    }
+
+    // Sets t[lane] to what smallestNonNegativeT(rays[lane], triangle, grace) returns, for every lane
+    void intersect(const Triangle &triangle, float grace, float *t) const {
+#ifdef __SSE2__
+        static const float outsideBound = floatAtMost(1e-3);
+        intersect(triangle.v1, triangle.v2, triangle.v3, triangle.surfaceNormal, triangle.D, triangle.area, grace,
+                  outsideBound, 0, t);
+#else
+        for (int lane = 0; lane < PACKET_SIZE; ++lane) {
+            t[lane] = smallestNonNegativeT(rays[lane], triangle, grace);
+        }
+#endif
+    }
+
+    // Sets t[lane] to what smallestNonNegativeT(rays[lane], v1, v2, v3, grace, tolerance, grazingTolerance) returns,
+    // for every lane
+    void intersect(const Vector3D &v1, const Vector3D &v2, const Vector3D &v3, float grace, float tolerance,
+                   float grazingTolerance, float *t) const {
+#ifdef __SSE2__
+        Vector3D N = (v2 - v1).cross(v3 - v1);
+        intersect(v1, v2, v3, N, -v1.dot(N), N.abs() / 2, grace, tolerance, grazingTolerance, t);
+#else
+        for (int lane = 0; lane < PACKET_SIZE; ++lane) {
+            t[lane] = smallestNonNegativeT(rays[lane], v1, v2, v3, grace, tolerance, grazingTolerance);
+        }
+#endif
+    }
+
+private:
+#ifdef __SSE2__
+    // Triangle test of both versions of smallestNonNegativeT, given the triangle's surface normal N, D and area, and
+    // the largest float its summed areas with a point inside may exceed its area by: outsideBound, plus
+    // grazingBound / |cos| of the angle between ray and N (at most COMPACT_GRAZING_LIMIT) if grazingBound is positive
+    void intersect(const Vector3D &v1, const Vector3D &v2, const Vector3D &v3, const Vector3D &N, float D, float area,
+                   float grace, float outsideBound, float grazingBound, float *t) const {
+        static const float parallelBound = floatAtLeast(1e-6);
+        __m128 ox4 = _mm_loadu_ps(ox), oy4 = _mm_loadu_ps(oy), oz4 = _mm_loadu_ps(oz);
+        __m128 dx4 = _mm_loadu_ps(dx), dy4 = _mm_loadu_ps(dy), dz4 = _mm_loadu_ps(dz);
+        __m128 denominator = dot(N, dx4, dy4, dz4);
+        __m128 sign = _mm_set1_ps(-0.0f);
+        __m128 numerator = _mm_xor_ps(_mm_add_ps(dot(N, ox4, oy4, oz4), _mm_set1_ps(D)), sign);
+        __m128 absDenominator = _mm_andnot_ps(sign, denominator);
+        __m128 missed = _mm_cmplt_ps(absDenominator, _mm_set1_ps(parallelBound));
+        __m128 t4 = _mm_div_ps(numerator, denominator);
+        missed = _mm_or_ps(missed, _mm_cmplt_ps(t4, _mm_set1_ps(grace)));
+        __m128 px = _mm_add_ps(ox4, _mm_mul_ps(dx4, t4));
+        __m128 py = _mm_add_ps(oy4, _mm_mul_ps(dy4, t4));
+        __m128 pz = _mm_add_ps(oz4, _mm_mul_ps(dz4, t4));
+        // Areas of the triangles the point of intersection makes with each edge, as smallestNonNegativeT builds them
+        __m128 a = halfArea(v2, v3, px, py, pz);
+        __m128 b = halfArea(v1, v3, px, py, pz);
+        __m128 c = halfArea(v1, v2, px, py, pz);
+        __m128 excess = _mm_sub_ps(_mm_add_ps(_mm_add_ps(a, b), c), _mm_set1_ps(area));
+        __m128 bound = _mm_set1_ps(outsideBound);
+        if (grazingBound > 0) {
+            // |cos| is |N . d| / (|N| |d|), evaluated in the order smallestNonNegativeT does
+            __m128 directionAbs = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx4, dx4), _mm_mul_ps(dy4, dy4)),
+                                                         _mm_mul_ps(dz4, dz4)));
+            __m128 secant = _mm_div_ps(_mm_mul_ps(_mm_set1_ps(N.abs()), directionAbs), absDenominator);
+            secant = _mm_min_ps(secant, _mm_set1_ps(COMPACT_GRAZING_LIMIT));
+            bound = _mm_add_ps(bound, _mm_mul_ps(_mm_set1_ps(grazingBound), secant));
+        }
+        missed = _mm_or_ps(missed, _mm_cmpgt_ps(excess, bound));
+        _mm_storeu_ps(t, _mm_or_ps(_mm_and_ps(missed, _mm_set1_ps(-1)), _mm_andnot_ps(missed, t4)));
+    }
+#endif
+
+    int octantOf(int lane) const {
+        return (dx[lane] < 0 ? 1 : 0) | (dy[lane] < 0 ? 2 : 0) | (dz[lane] < 0 ? 4 : 0);
+    }
+
+#ifdef __SSE2__
+    // One slab of Bounds::clip, for every lane
+    // A lane whose ray is parallel to the slab misses if its origin is outside, and is not clipped otherwise
+    static void clipAxis(__m128 origin, __m128 direction, float lo, float hi, __m128 &tNear, __m128 &tFar,
+                         __m128 &missed) {
+        __m128 lo4 = _mm_set1_ps(lo), hi4 = _mm_set1_ps(hi);
+        __m128 parallel = _mm_cmpeq_ps(direction, _mm_setzero_ps());
+        __m128 inv = _mm_div_ps(_mm_set1_ps(1), direction);
+        __m128 t0 = _mm_mul_ps(_mm_sub_ps(lo4, origin), inv);
+        __m128 t1 = _mm_mul_ps(_mm_sub_ps(hi4, origin), inv);
+        __m128 near = _mm_andnot_ps(parallel, _mm_min_ps(t0, t1));
+        __m128 far = _mm_andnot_ps(parallel, _mm_max_ps(t0, t1));
+        near = _mm_or_ps(near, _mm_and_ps(parallel, _mm_set1_ps(-INFINITY)));
+        far = _mm_or_ps(far, _mm_and_ps(parallel, _mm_set1_ps(INFINITY)));
+        __m128 outside = _mm_or_ps(_mm_cmplt_ps(origin, lo4), _mm_cmpgt_ps(origin, hi4));
+        missed = _mm_or_ps(missed, _mm_and_ps(parallel, outside));
+        tNear = _mm_max_ps(tNear, near);
+        tFar = _mm_min_ps(tFar, far);
+    }
+
+    static __m128 dot(const Vector3D &v, __m128 x, __m128 y, __m128 z) {
+        return _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(v.x), x), _mm_mul_ps(_mm_set1_ps(v.y), y)),
+                          _mm_mul_ps(_mm_set1_ps(v.z), z));
+    }
+
+    // Area of triangle (p, u, v), i.e. |(u - p) x (v - p)| / 2
+    static __m128 halfArea(const Vector3D &u, const Vector3D &v, __m128 px, __m128 py, __m128 pz) {
+        __m128 ax = _mm_sub_ps(_mm_set1_ps(u.x), px), ay = _mm_sub_ps(_mm_set1_ps(u.y), py);
+        __m128 az = _mm_sub_ps(_mm_set1_ps(u.z), pz);
+        __m128 bx = _mm_sub_ps(_mm_set1_ps(v.x), px), by = _mm_sub_ps(_mm_set1_ps(v.y), py);
+        __m128 bz = _mm_sub_ps(_mm_set1_ps(v.z), pz);
+        __m128 cx = _mm_sub_ps(_mm_mul_ps(ay, bz), _mm_mul_ps(az, by));
+        __m128 cy = _mm_sub_ps(_mm_mul_ps(az, bx), _mm_mul_ps(ax, bz));
+        __m128 cz = _mm_sub_ps(_mm_mul_ps(ax, by), _mm_mul_ps(ay, bx));
+        __m128 square = _mm_add_ps(_mm_add_ps(_mm_mul_ps(cx, cx), _mm_mul_ps(cy, cy)), _mm_mul_ps(cz, cz));
+        return _mm_div_ps(_mm_sqrt_ps(square), _mm_set1_ps(2));
+    }
+#endif
+
+};
+
+// Hits (global object index and T parameter, as traceRay returns them) of camera rays that were traced ahead of their
+// pixels as part of a packet, kept until their pixels are rendered
+class PacketHitCache {
+    unordered_map<int, pair<int, float>> hits;
+
+    // this is to easily print a given object to std for debugging
+    friend std::ostream &operator<<(std::ostream &, const PacketHitCache &);
+
+public:
+    void put(int pixel, const pair<int, float> &hit) {
+        hits[pixel] = hit;
+    }
+
+    // Moves the hit of pixel into hit, returns false if it was not traced ahead
+    bool take(int pixel, pair<int, float> &hit) {
+        auto found = hits.find(pixel);
+        if (found == hits.end()) {
+            return false;
+        }
+        hit = found->second;
+        hits.erase(found);
+        return true;
+    }
+
+};
+
+// Packet hit cache of the calling thread, null when camera rays are traced one by one
+extern thread_local PacketHitCache *activePacketHits;
+
+inline std::ostream &operator<<(std::ostream &out, const RayPacket &p) {
+    out << "RayPacket:";
+    for (int lane = 0; lane < PACKET_SIZE; ++lane) {
+        if (p.activeMask >> lane & 1) {
+            out << "\t" << p.rays[lane];
+        }
+    }
+    return out;
+}
+
+inline std::ostream &operator<<(std::ostream &out, const PacketHitCache &c) {
+    out << "PacketHitCache:" << "\t" << c.hits.size() << " hits";
+    return out;
+}
+
+#endif
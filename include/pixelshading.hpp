@@ -0,0 +1,113 @@
+#ifndef PIXELSHADING_HPP
+#define PIXELSHADING_HPP
+
+#include <iostream>
+#include <vector>
+#include "config.hpp"
+#include "vector3d.hpp"
+
+using namespace std;
+
+// What pixel shading caches saved: primary hits of depth of field samples, how many of them were close enough to the
+// hit of an earlier sample of their pixel to share its shadows, and shadow factors reused from or added to the cache
+class PixelShadingStats {
+public:
+    long primaryHits, reusedHits, reusedShadowFactors, shadowFactors;
+
+    // this is to easily print a given object to std for debugging
+    friend std::ostream &operator<<(std::ostream &, const PixelShadingStats &);
+
+    PixelShadingStats() : primaryHits(0), reusedHits(0), reusedShadowFactors(0), shadowFactors(0) {}
+
+    PixelShadingStats &operator+=(const PixelShadingStats &s) {
+        primaryHits += s.primaryHits;
+        reusedHits += s.reusedHits;
+        reusedShadowFactors += s.reusedShadowFactors;
+        shadowFactors += s.shadowFactors;
+        return *this;
+    }
+
+};
+
+inline std::ostream &operator<<(std::ostream &out, const PixelShadingStats &s) {
+    long lookups = s.reusedShadowFactors + s.shadowFactors;
+    out << "PixelShadingStats:" << "\t" << s.primaryHits << " primary hits of depth of field samples, " << s.reusedHits
+        << " near an earlier one (" << (s.primaryHits > 0 ? 100.0 * s.reusedHits / s.primaryHits : 0) << "%), "
+        << s.reusedShadowFactors << " of " << lookups << " shadow factors reused ("
+        << (lookups > 0 ? 100.0 * s.reusedShadowFactors / lookups : 0) << "%)";
+    return out;
+}
+
+// Shadow factors of lights at the primary hits of the depth of field samples of one pixel
+// Rays of the samples pass through the same point of the focal plane, so where it is in focus they hit nearly the
+// same point of the same object. A later sample whose hit is on the same object, closer to a cached hit than tolerance
+// times its distance from the eye, reuses the shadow factors found there instead of casting shadow rays again
+// Only settled shadow factors (0 or 1) are reused: penumbrae are sampled anew by every sample, so that their noise
+// still averages out over the samples
+// Light terms are still evaluated at every sample's own hit, so only shadow edges can move, by at most that distance
+class PixelShadingCache {
+public:
+    class Entry {
+    public:
+        int objIndex;
+        Vector3D poi;
+        // Shadow factor of every light of the scene, negative for lights not shadow tested at this hit yet
+        vector<float> shadowFactors;
+    };
+
+    float tolerance;
+    // Hits of the pixel are the first count entries, the rest are kept to reuse their memory
+    vector<Entry> entries;
+    int count;
+    // Entry of the primary hit being shaded, -1 while shading any other hit
+    int current;
+    PixelShadingStats stats;
+
+    // this is to easily print a given object to std for debugging
+    friend std::ostream &operator<<(std::ostream &, const PixelShadingCache &);
+
+    explicit PixelShadingCache(float tolerance) : tolerance(tolerance), count(0), current(-1) {}
+
+    // Forgets the hits of the previous pixel
+    void clear() {
+        count = 0;
+        current = -1;
+    }
+
+    // Makes the entry of a primary hit of object objIndex at poi (seen from eye) current: the first cached hit near
+    // enough to it, or a new one for noLights lights
+    void begin(int objIndex, const Vector3D &poi, const Vector3D &eye, int noLights) {
+        stats.primaryHits++;
+        float maxDistance = tolerance * (poi - eye).abs();
+        for (int k = 0; k < count; ++k) {
+            if (entries[k].objIndex == objIndex && (entries[k].poi - poi).absSquare() <= maxDistance * maxDistance) {
+                stats.reusedHits++;
+                current = k;
+                return;
+            }
+        }
+        if (count == (int) entries.size()) {
+            entries.emplace_back();
+        }
+        Entry &entry = entries[count];
+        entry.objIndex = objIndex;
+        entry.poi = poi;
+        entry.shadowFactors.assign(noLights, -1);
+        current = count++;
+    }
+
+    void end() {
+        current = -1;
+    }
+
+};
+
+inline std::ostream &operator<<(std::ostream &out, const PixelShadingCache &c) {
+    out << "PixelShadingCache:" << "\t" << c.count << " hits, tolerance " << c.tolerance << "\t" << c.stats;
+    return out;
+}
+
+// Pixel shading cache of the calling thread, null when samples are shaded independently
+extern thread_local PixelShadingCache *activePixelShading;
+
+#endif
@@ -0,0 +1,63 @@
+#ifndef RANDOM_HPP
+#define RANDOM_HPP
+
+#include <cstdint>
+
+// Additive feedback generator, gives the same numbers as glibc's rand() for the same seed
+// Unlike rand() its state is not shared, so each thread can have its own (see threadRandom)
+class Random {
+public:
+    static const int32_t MAX = 2147483647;
+
+    Random(uint32_t seed = 1) {
+        this->seed(seed);
+    }
+
+    void seed(uint32_t seed) {
+        int32_t word = seed == 0 ? 1 : (int32_t) seed;
+        state[0] = word;
+        for (int i = 1; i < DEGREE; ++i) {
+            // 16807 * word % (2^31 - 1) without overflow (Schrage's method)
+            int32_t hi = word / 127773;
+            int32_t lo = word % 127773;
+            word = 16807 * lo - 2836 * hi;
+            if (word < 0) {
+                word += MAX;
+            }
+            state[i] = word;
+        }
+        front = SEPARATION;
+        rear = 0;
+        for (int i = 0; i < 10 * DEGREE; ++i) {
+            next();
+        }
+    }
+
+    // Uniform in [0, MAX]
+    int32_t next() {
+        uint32_t value = (uint32_t) state[front] + (uint32_t) state[rear];
+        state[front] = (int32_t) value;
+        front = (front + 1) % DEGREE;
+        rear = (rear + 1) % DEGREE;
+        return (int32_t) (value >> 1);
+    }
+
+private:
+    static const int DEGREE = 31;
+    static const int SEPARATION = 3;
+    int32_t state[DEGREE];
+    int front, rear;
+};
+
+// Generator of the calling thread, seeded with 1 (like rand()) until seedRand is called
+inline Random &threadRandom() {
+    static thread_local Random random;
+    return random;
+}
+
+// Seeds generator of the calling thread, so that it repeats the same numbers
+inline void seedRand(uint32_t seed) {
+    threadRandom().seed(seed);
+}
+
+#endif
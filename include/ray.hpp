@@ -19,7 +19,7 @@ public:
 
 };
 
-std::ostream &operator<<(std::ostream &out, const Ray &r) {
+inline std::ostream &operator<<(std::ostream &out, const Ray &r) {
     out << "Ray:" << "\t" << r.origin << "\t" << r.direction;
     return out;
 }
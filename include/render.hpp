@@ -0,0 +1,136 @@
+#ifndef RENDER_HPP
+#define RENDER_HPP
+
+#include <iostream>
+#include <stack>
+#include <utility>
+#include <vector>
+#include "config.hpp"
+#include "vector3d.hpp"
+#include "color.hpp"
+#include "ray.hpp"
+#include "sphere.hpp"
+#include "triangle.hpp"
+#include "scene.hpp"
+#include "surfacehit.hpp"
+#include "gbuffer.hpp"
+#include "denoise.hpp"
+#include "camera.hpp"
+#include "tile.hpp"
+#include "footprint.hpp"
+#include "occluder.hpp"
+#include "pixelshading.hpp"
+
+using namespace std;
+
+// Returns global index of object the ray first hits (in front of the origin) and corresponding T parameter of the hit
+// If ray does not hit any object both index and T parameter are returned -1
+// If several objects are hit at the same T parameter, the one with smallest global index is returned
+// Triangles of instances are hit in object space of their meshes, and returned by global index like any other object
+// If candidates are given, only they (the only objects the ray can hit) are tested instead of traversing the hierarchy
+// Unless there are more than PRIMARY_CANDIDATES_MAX of them
+pair<int, float> traceRay(const Ray &ray, const Scene &scene, float grace = 0, const vector<int> *candidates = nullptr);
+
+// Sets results[k] to what traceRay(rays[k], scene, grace, candidates) returns, for count <= PACKET_SIZE rays
+// Rays are traced together as a packet (see RayPacket) if they point into the same octant, one by one if not
+void traceRayPacket(const Ray *rays, int count, const Scene &scene, float grace, const vector<int> *candidates,
+                    pair<int, float> *results);
+
+// Returns what traceRay returns for the camera ray of (i, j) pixel of the camera's image, tracing it in a packet with
+// the rest of its 2x2 block of pixels while a packet hit cache is active (see PacketHitCache)
+pair<int, float> traceCameraRay(const Ray &ray, const Scene &scene, const Camera &camera, int i, int j,
+                                const vector<int> *candidates);
+
+// Given ray, scene, hit object and index and T parameter of the hit
+// returns geometric information (point, shading normal, texture coordinates) of the hit
+SurfaceHit surfaceHitFor(const Ray &ray, const Scene &scene, int objIndex, float paramT);
+
+// Diffusion color at hit, from the texture of the hit object if it has one
+Color diffusionAt(const Scene &scene, const SurfaceHit &hit);
+
+// Returns hit of ray in the scene, candidates are as for traceRay
+SurfaceHit traceSurfaceHit(const Ray &ray, const Scene &scene, const float grace,
+                           const vector<int> *candidates = nullptr);
+
+// Fraction of light reaching poi from light, averaged over several shadow rays
+// Shadow rays of a light with an index (not -1) in the scene's lights use the last occluder cache
+float shadowFactorFor(const Vector3D &poi, const Light &light, int lightIndex, const Scene &scene);
+
+// Bakes shadow factors of every light over the triangles of the scene (not those of instances) into its lightmaps,
+// with texels resolution times smaller than the diagonal of the scene (but no more than resolution along an edge), see
+// Lightmaps, and triangles split between threads (one per core if threads is 0)
+// Shading then takes shadow factors of those triangles from them instead of casting shadow rays, light terms (diffuse
+// and specular) are still evaluated at the hit
+// Geometry and lights must not change afterwards, as the lightmaps are not updated
+LightmapStats bakeLightmaps(Scene &scene, int resolution = LIGHTMAP_RESOLUTION, int threads = 0);
+
+// Sets weights of the lights at lightIndices to those of a sample of LIGHT_SAMPLES of them, picked in proportion to
+// their unshadowed blinn-phong terms at poi (0 for lights not picked)
+void sampleLights(const Scene &scene, const vector<int> &lightIndices, const Vector3D &poi, const Vector3D &N,
+                  const Vector3D &V, const MaterialColor &color, vector<float> &weights);
+
+// Given ray and its (already found) hit, returns the color seen along the ray
+// i.e. local blinn-phong color (as seen from eye) plus recursively traced reflected and transmitted colors
+Color shadeHitRecursive(const Ray &ray, const Scene &scene, const Vector3D &eye, const SurfaceHit &hit,
+                        const float grace, const int depth, stack<float> refractiveIndices,
+                        stack<float> opacities);
+
+// Returns the color seen along the ray, traceSurfaceHit followed by shadeHitRecursive
+Color traceRayRecursive(const Ray &ray, const Scene &scene, const Vector3D &eye, const float grace,
+                        const int depth, stack<float> refractiveIndices, stack<float> opacities);
+
+// Returns color of (i, j) pixel, averaged over the camera's rays per pixel
+// If a geometry buffer is given, camera rays and their hits are taken from it if it is complete or added to it if not
+// If candidates are given, camera rays are only tested against them, see primaryCandidatesOf
+// Camera rays are traced as packets (see traceRayPacket), of the samples of the pixel with depth of field, else of
+// 2x2 blocks of pixels if the calling thread has a packet hit cache (see activePacketHits)
+Color renderPixel(const Scene &scene, const Camera &camera, int i, int j, GBuffer *gBuffer = nullptr,
+                  const vector<int> *candidates = nullptr);
+
+// Fills an empty geometry buffer with the camera ray and primary hit of every pixel, by rasterizing objects instead
+// of tracing camera rays: an object is only tested against rays of the pixels its projected box covers
+// Hits are those traceSurfaceHit finds (same intersection tests, same tie-break), so rendering from the buffer gives
+// the same image
+// Camera rays with depth of field depend on random numbers, so for such cameras returns false and fills nothing
+bool rasterizePrimaryHits(const Scene &scene, const Camera &camera, GBuffer &gBuffer);
+
+// Returns for every tile of tiles (a rectangle of the tiles of tilesOf(width, height, tileSize), row by row) the
+// objects of the hierarchy (see BVH), in increasing index, that camera rays of its pixels can hit: those whose
+// projected boxes (grown by the reach of depth of field jitter) cover any of its pixels
+// Lists are cut off after PRIMARY_CANDIDATES_MAX + 1 objects, as traceRay traverses the hierarchy for longer ones
+// Testing camera rays only against them finds the same hits as tracing them, as no other object can be hit
+vector<vector<int> > primaryCandidatesOf(const Scene &scene, const Camera &camera, int width, int height,
+                                        const vector<Tile> &tiles, int tileSize);
+
+// What the caches of renderImage saved
+class RenderStats {
+public:
+    OccluderStats occluders;
+    PixelShadingStats pixelShading;
+
+    // this is to easily print a given object to std for debugging
+    friend std::ostream &operator<<(std::ostream &, const RenderStats &);
+
+};
+
+inline std::ostream &operator<<(std::ostream &out, const RenderStats &s) {
+    out << s.occluders << "\n" << s.pixelShading;
+    return out;
+}
+
+// Renders all pixels into colors, row by row, and returns what its caches saved
+// If guides are given, what camera rays hit is recorded in them for denoiseImage
+RenderStats renderImage(const Scene &scene, const Camera &camera, vector<vector<Color> > &colors,
+                        GBuffer *gBuffer = nullptr, DenoiseGuides *guides = nullptr);
+
+// Renders pixels of a tile into colors
+// Random numbers are reseeded per tile, so a tile renders the same no matter which other tiles are rendered
+// If a footprint is given, everything the rays of the tile interact with is recorded in it
+// If candidates are given, camera rays are only tested against them, see primaryCandidatesOf
+void renderTile(const Scene &scene, const Camera &camera, const Tile &tile, vector<vector<Color> > &colors,
+                TileFootprint *footprint = nullptr, const vector<int> *candidates = nullptr);
+
+// Returns pixel array for output image, all black
+vector<vector<Color> > blankImage(int width, int height);
+
+#endif
@@ -0,0 +1,224 @@
+#ifndef RENDER_JOB_HPP
+#define RENDER_JOB_HPP
+
+#include <chrono>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <unistd.h>
+#include <sys/socket.h>
+#include "yart.hpp"
+
+using namespace std;
+
+#define MAX_REQUEST_LINE 4096
+
+// Buffered line and byte reading, and writing, on a connected socket, which is closed with the connection
+class Connection {
+    int fd;
+    string buffer;
+
+public:
+    explicit Connection(int fd) : fd(fd) {}
+
+    Connection(const Connection &) = delete;
+
+    Connection &operator=(const Connection &) = delete;
+
+    ~Connection() {
+        close(fd);
+    }
+
+    // Reads up to (and without) the next newline, returns false on end of stream, error or too long line
+    bool readLine(string &line) {
+        size_t end;
+        while ((end = buffer.find('\n')) == string::npos) {
+            if (buffer.size() > MAX_REQUEST_LINE || !fill()) {
+                return false;
+            }
+        }
+        line = buffer.substr(0, end);
+        buffer.erase(0, end + 1);
+        return true;
+    }
+
+    // Reads exactly count bytes, returns false on end of stream or error
+    bool readBytes(size_t count, string &bytes) {
+        while (buffer.size() < count) {
+            if (!fill()) {
+                return false;
+            }
+        }
+        bytes = buffer.substr(0, count);
+        buffer.erase(0, count);
+        return true;
+    }
+
+    // Whether bytes were received that were not read yet, polling the socket does not tell about them
+    bool hasBuffered() const {
+        return !buffer.empty();
+    }
+
+    bool writeAll(const string &data) {
+        size_t written = 0;
+        while (written < data.size()) {
+            ssize_t n = send(fd, data.data() + written, data.size() - written, MSG_NOSIGNAL);
+            if (n <= 0) {
+                return false;
+            }
+            written += n;
+        }
+        return true;
+    }
+
+private:
+    bool fill() {
+        char chunk[65536];
+        ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+        if (n <= 0) {
+            return false;
+        }
+        buffer.append(chunk, n);
+        return true;
+    }
+
+};
+
+// Request sent to the render server: a scene (file or inline text), options overriding it and where the image goes
+class RenderJob {
+public:
+    unique_ptr<Connection> connection;
+    // Name of the scene file, or "inline" for scene text sent with the request
+    string sceneName;
+    string sceneText;
+    RenderOptions options;
+    // Image is written to this file if set, else it is sent back
+    string outputFilename;
+    // Request for server statistics instead of an image
+    bool isStats;
+    chrono::steady_clock::time_point received;
+
+    // this is to easily print a given object to std for debugging
+    friend std::ostream &operator<<(std::ostream &, const RenderJob &);
+
+    explicit RenderJob(int fd) : connection(new Connection(fd)), isStats(false),
+                                 received(chrono::steady_clock::now()) {}
+
+    // Reads request lines up to "end" (see README for the format)
+    // Returns false and sets error if the request is malformed or its scene file can not be read
+    bool read(size_t maxSceneBytes, string &error) {
+        string line;
+        while (connection->readLine(line)) {
+            string keyword;
+            istringstream iss(line);
+            if (!(iss >> keyword) || keyword == "#") {
+                continue;
+            }
+            if (keyword == "end") {
+                if (!isStats && sceneText.empty()) {
+                    error = "no scene given";
+                    return false;
+                }
+                return true;
+            } else if (keyword == "stats") {
+                isStats = true;
+            } else if (keyword == "scene") {
+                if (!(iss >> sceneName) || !readFile(sceneName, maxSceneBytes, sceneText)) {
+                    error = "scene file could not be read";
+                    return false;
+                }
+            } else if (keyword == "inline") {
+                size_t bytes;
+                if (!(iss >> bytes) || bytes > maxSceneBytes || !connection->readBytes(bytes, sceneText)) {
+                    error = "inline scene incomplete or too large";
+                    return false;
+                }
+                sceneName = "inline";
+            } else if (keyword == "output") {
+                if (!(iss >> outputFilename)) {
+                    error = "output filename not given";
+                    return false;
+                }
+            } else if (!readOption(keyword, iss)) {
+                error = "invalid or incomplete " + keyword;
+                return false;
+            }
+        }
+        error = "request incomplete";
+        return false;
+    }
+
+private:
+    bool readOption(const string &keyword, istringstream &iss) {
+        RenderOptions &o = options;
+        if (keyword == "size") {
+            return (iss >> o.width >> o.height) && o.width > 1 && o.height > 1;
+        } else if (keyword == "camera") {
+            float ex, ey, ez, vx, vy, vz, ux, uy, uz;
+            if (!(iss >> ex >> ey >> ez >> vx >> vy >> vz >> ux >> uy >> uz >> o.vFovDeg)) {
+                return false;
+            }
+            if (Vector3D(vx, vy, vz).abs() < 1e-6 || Vector3D(ux, uy, uz).abs() < 1e-6) {
+                return false;
+            }
+            o.overrideCamera = true;
+            o.eye = Vector3D(ex, ey, ez);
+            o.viewDir = Vector3D(vx, vy, vz).unit();
+            o.upDir = Vector3D(ux, uy, uz).unit();
+            return true;
+        } else if (keyword == "samples") {
+            return (iss >> o.samplesPerPixel) && o.samplesPerPixel > 0;
+        } else if (keyword == "region") {
+            return (bool) (iss >> o.x0 >> o.y0 >> o.x1 >> o.y1);
+        } else if (keyword == "threads") {
+            return (iss >> o.threads) && o.threads > 0;
+        } else if (keyword == "seed") {
+            return (bool) (iss >> o.seed);
+        }
+        return false;
+    }
+
+    static bool readFile(const string &filename, size_t maxBytes, string &contents) {
+        ifstream input(filename.c_str(), ios::binary);
+        if (input.fail()) {
+            return false;
+        }
+        ostringstream oss;
+        oss << input.rdbuf();
+        contents = oss.str();
+        return contents.size() <= maxBytes;
+    }
+
+};
+
+inline std::ostream &operator<<(std::ostream &out, const RenderJob &j) {
+    out << "RenderJob:" << "\t" << (j.isStats ? "stats" : j.sceneName) << "\t" << j.options;
+    if (!j.outputFilename.empty()) {
+        out << "\t-> " << j.outputFilename;
+    }
+    return out;
+}
+
+// Returns header of binary (P6) PPM image of width x height pixels
+inline string binaryPPMHeaderOf(int width, int height) {
+    return "P6\n" + to_string(width) + " " + to_string(height) + "\n255\n";
+}
+
+// Returns bytes of pixels of framebuffer (3 floats per pixel) as they are laid out in a binary PPM image
+// Channels are clamped and scaled to 8 bits like Color::to8BitScale does
+inline string binaryPixelsOf(const vector<float> &framebuffer) {
+    string pixels(framebuffer.size(), '\0');
+    for (size_t k = 0; k < framebuffer.size(); ++k) {
+        float value = framebuffer[k] < 0 ? 0 : (framebuffer[k] > 1 ? 1 : framebuffer[k]);
+        pixels[k] = (char) (int) (value * 255);
+    }
+    return pixels;
+}
+
+// Returns binary (P6) PPM image of width x height framebuffer (3 floats per pixel, row by row)
+inline string binaryPPMOf(int width, int height, const vector<float> &framebuffer) {
+    return binaryPPMHeaderOf(width, height) + binaryPixelsOf(framebuffer);
+}
+
+#endif
@@ -0,0 +1,158 @@
+#ifndef REORDER_HPP
+#define REORDER_HPP
+
+#include <vector>
+#include <array>
+#include <algorithm>
+#include <cstdint>
+#include <cfloat>
+#include "scene.hpp"
+#include "bounds.hpp"
+#include "scenediff.hpp"
+
+using namespace std;
+
+// What reorderScene did to a scene
+class ReorderStats {
+public:
+    int reorderedSpheres, reorderedTriangles;
+    // Triangles dropped because they have no area, and because an earlier triangle has the same corners
+    int degenerateTriangles, duplicateTriangles;
+
+    // this is to easily print a given object to std for debugging
+    friend std::ostream &operator<<(std::ostream &, const ReorderStats &);
+
+    ReorderStats() : reorderedSpheres(0), reorderedTriangles(0), degenerateTriangles(0), duplicateTriangles(0) {}
+
+};
+
+// Spreads the lowest 10 bits of x out to every third bit
+inline uint32_t spreadBits(uint32_t x) {
+    x &= 0x3ff;
+    x = (x | (x << 16)) & 0x030000ff;
+    x = (x | (x << 8)) & 0x0300f00f;
+    x = (x | (x << 4)) & 0x030c30c3;
+    x = (x | (x << 2)) & 0x09249249;
+    return x;
+}
+
+// Position of point along a Morton (Z-order) curve through bounds, with 1024 cells along each axis
+inline uint32_t mortonCode(const Vector3D &point, const Bounds &bounds) {
+    const float p[3] = {point.x, point.y, point.z};
+    const float lo[3] = {bounds.min.x, bounds.min.y, bounds.min.z};
+    const float hi[3] = {bounds.max.x, bounds.max.y, bounds.max.z};
+    uint32_t code = 0;
+    for (int axis = 0; axis < 3; ++axis) {
+        float extent = hi[axis] - lo[axis];
+        float t = extent > 0 ? (p[axis] - lo[axis]) / extent : 0;
+        code |= spreadBits((uint32_t) min(max(t * 1024, 0.0f), 1023.0f)) << axis;
+    }
+    return code;
+}
+
+// Order of objects along a Morton curve of their box centroids, objects in the same cell keep their file order
+template<class Objects>
+inline vector<int> mortonOrderOf(const Objects &objects, const Bounds &sceneBounds) {
+    vector<uint32_t> codes;
+    codes.reserve(objects.size());
+    for (const auto &object : objects) {
+        codes.push_back(mortonCode(boundsOf(object).centroid(), sceneBounds));
+    }
+    vector<int> order(objects.size());
+    for (size_t k = 0; k < order.size(); ++k) {
+        order[k] = k;
+    }
+    stable_sort(order.begin(), order.end(), [&codes](int a, int b) { return codes[a] < codes[b]; });
+    return order;
+}
+
+// Returns true if triangle has no area (collinear corners), up to rounding relative to its longest edge
+inline bool isDegenerate(const Triangle &triangle) {
+    float longestSquare = max((triangle.v2 - triangle.v1).absSquare(),
+                              max((triangle.v3 - triangle.v2).absSquare(), (triangle.v1 - triangle.v3).absSquare()));
+    return !(triangle.area > FLT_EPSILON * longestSquare);
+}
+
+// Corners of triangle, sorted so that the same face gives the same key whatever corner it starts at
+inline array<float, 9> cornersKeyOf(const Triangle &triangle) {
+    array<array<float, 3>, 3> corners = {{{{triangle.v1.x, triangle.v1.y, triangle.v1.z}},
+                                          {{triangle.v2.x, triangle.v2.y, triangle.v2.z}},
+                                          {{triangle.v3.x, triangle.v3.y, triangle.v3.z}}}};
+    sort(corners.begin(), corners.end());
+    array<float, 9> key;
+    for (int k = 0; k < 9; ++k) {
+        key[k] = corners[k / 3][k % 3];
+    }
+    return key;
+}
+
+// Post-parse pass over the geometry of scene, for memory locality of big meshes:
+// - drops triangles with no area (the parser already rejects coincident corners, collinear ones get here), and
+//   triangles with the same corners as an earlier one (which add nothing to the image)
+// - sorts spheres and triangles along a Morton curve of their centroids, so that objects close in space (that the
+//   same rays and the same hierarchy leaves visit) are also close in memory
+// Materials and texture indices live in the objects themselves, so only the hierarchy needs rebuilding afterwards
+// Global object indices change, so anything that refers to objects by index must come after it
+// Scenes with mapped triangles are left as they are, their triangle files are written in this order already (and
+// reordering would read all of their pages)
+inline ReorderStats reorderScene(Scene &scene) {
+    ReorderStats stats;
+    if (scene.triangles.isMapped()) {
+        return stats;
+    }
+    vector<bool> dropped(scene.triangles.size(), false);
+    vector<pair<array<float, 9>, int>> keys;
+    keys.reserve(scene.triangles.size());
+    for (size_t k = 0; k < scene.triangles.size(); ++k) {
+        if (isDegenerate(scene.triangles[k])) {
+            dropped[k] = true;
+            stats.degenerateTriangles++;
+        } else {
+            keys.emplace_back(cornersKeyOf(scene.triangles[k]), k);
+        }
+    }
+    // Same corners end up next to each other, the first in file order is kept
+    sort(keys.begin(), keys.end());
+    for (size_t k = 1; k < keys.size(); ++k) {
+        if (keys[k].first == keys[k - 1].first) {
+            dropped[keys[k].second] = true;
+            stats.duplicateTriangles++;
+        }
+    }
+
+    vector<Triangle> kept;
+    kept.reserve(scene.triangles.size() - stats.degenerateTriangles - stats.duplicateTriangles);
+    for (size_t k = 0; k < scene.triangles.size(); ++k) {
+        if (!dropped[k]) {
+            kept.push_back(scene.triangles[k]);
+        }
+    }
+    scene.triangles.swap(kept);
+
+    Bounds bounds = sceneBoundsOf(scene);
+    vector<Sphere> spheres;
+    spheres.reserve(scene.spheres.size());
+    for (int k : mortonOrderOf(scene.spheres, bounds)) {
+        spheres.push_back(scene.spheres[k]);
+    }
+    scene.spheres.swap(spheres);
+    vector<Triangle> triangles;
+    triangles.reserve(scene.triangles.size());
+    for (int k : mortonOrderOf(scene.triangles, bounds)) {
+        triangles.push_back(scene.triangles[k]);
+    }
+    scene.triangles.swap(triangles);
+    stats.reorderedSpheres = scene.spheres.size();
+    stats.reorderedTriangles = scene.triangles.size();
+
+    scene.bvh.build(scene.spheres, scene.triangles, scene.instances);
+    return stats;
+}
+
+inline std::ostream &operator<<(std::ostream &out, const ReorderStats &s) {
+    out << "ReorderStats:" << "\t" << s.reorderedSpheres << " spheres, " << s.reorderedTriangles << " triangles"
+        << "\tdropped " << s.degenerateTriangles << " degenerate, " << s.duplicateTriangles << " duplicate triangles";
+    return out;
+}
+
+#endif
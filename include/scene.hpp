@@ -4,9 +4,19 @@
 #include <vector>
 #include <unordered_map>
 #include <sstream>
+#include <future>
+#include <chrono>
+#include <thread>
 #include "light.hpp"
 #include "texture.hpp"
 #include "texturecoordinates.hpp"
+#include "trianglestore.hpp"
+#include "compactgeometry.hpp"
+#include "lightmap.hpp"
+#include "bvh.hpp"
+#include "mesh.hpp"
+#include "instance.hpp"
+#include "lighttree.hpp"
 
 using namespace std;
 
@@ -30,17 +40,134 @@ public:
 
     // Scene optional
     vector<Sphere> spheres;
-    vector<Triangle> triangles;
+    // Held in memory, or mapped from a triangle file (see TriangleStore)
+    // Empty once compactTriangles was called, as the compact encoding holds them from then on
+    TriangleStore triangles;
+    // Compact encoding of triangles for intersection tests and shading, empty unless compactTriangles was called
+    CompactGeometry compact;
+    // Baked shadow factors of triangles, empty unless bakeLightmaps was called
+    Lightmaps lightmaps;
     vector<Texture> textures;
+    // Mesh definitions and their placements, see Instance
+    vector<Mesh> meshes;
+    vector<Instance> instances;
 
     vector<Light> lights;
 
+    // Acceleration structure over spheres, triangles and instances, built once parsing succeeds
+    BVH bvh;
+    // Hierarchy over lights for culling the ones that cannot light a point, built with bvh
+    LightTree lightTree;
+
+    // If set, textures are taken from (and decoded into) this cache instead of always being decoded
+    TextureCache *textureCache;
+
+    // Seconds parse spent at its end waiting for texture decodes and hierarchy chunks running in the background
+    // i.e. the part of that work that did not overlap with reading the scene description
+    float backgroundWaitSeconds;
+
     Scene(const string &filename) : filename(filename),
                                     eye(Vector3D()), viewDir(Vector3D()), upDir(Vector3D()),
                                     vFovDeg(0), imWidth(0), imHeight(0),
                                     bgColor(Color()),
                                     isParallelProjection(false),
-                                    viewingDistance(0) {}
+                                    viewingDistance(0),
+                                    textureCache(nullptr),
+                                    backgroundWaitSeconds(0) {}
+
+    // Number of spheres and triangles, the objects that are in the hierarchy themselves
+    // Global indices from there on are of triangles of instances
+    int noObjects() const {
+        return spheres.size() + (compact.empty() ? triangles.size() : compact.size());
+    }
+
+    // Number of triangles of all instances together
+    long noInstancedTriangles() const {
+        return instances.empty() ? 0 : instances.back().firstObject + meshes[instances.back().mesh].triangles.size();
+    }
+
+    // Index of the instance the triangle with given global index (at least noObjects()) belongs to
+    int instanceOf(int objIndex) const {
+        int firstObject = objIndex - noObjects();
+        return upper_bound(instances.begin(), instances.end(), firstObject, [](int k, const Instance &instance) {
+            return k < instance.firstObject;
+        }) - instances.begin() - 1;
+    }
+
+    // Triangle with given global index (at least number of spheres) as stored, i.e. in object space of its mesh for
+    // triangles of instances
+    // Not for triangles that are compactly encoded (see CompactGeometry::isEncoded), which are not stored whole
+    const Triangle &storedTriangleOf(int objIndex) const {
+        int noSpheres = spheres.size();
+        if (objIndex < noObjects()) {
+            int k = objIndex - noSpheres;
+            return compact.empty() ? triangles[k] : compact.exactTriangle(k);
+        }
+        const Instance &instance = instances[instanceOf(objIndex)];
+        return meshes[instance.mesh].triangles[objIndex - noObjects() - instance.firstObject];
+    }
+
+    // Triangle with given global index in world space, with the material it is rendered with
+    // Decoded, if it was encoded compactly
+    Triangle triangleAt(int objIndex) const {
+        if (objIndex < noObjects()) {
+            int k = objIndex - (int) spheres.size();
+            return compact.empty() ? triangles[k] : compact.triangleAt(k);
+        }
+        return instances[instanceOf(objIndex)].toWorld(storedTriangleOf(objIndex));
+    }
+
+    const MaterialColor &materialColorOf(int objIndex) const {
+        int noSpheres = spheres.size();
+        if (objIndex < noSpheres) {
+            return spheres[objIndex].materialColor;
+        }
+        if (objIndex < noObjects()) {
+            int k = objIndex - noSpheres;
+            return compact.empty() ? triangles[k].materialColor : compact.materialColorOf(k);
+        }
+        return instances[instanceOf(objIndex)].materialColorOf(storedTriangleOf(objIndex));
+    }
+
+    // Index of the texture of triangle with given global index (at least number of spheres), -1 if it is not textured
+    int textureIndexOf(int objIndex) const {
+        if (objIndex < noObjects()) {
+            int k = objIndex - (int) spheres.size();
+            return compact.empty() ? triangles[k].textureIndex : compact.textureIndexOf(k);
+        }
+        return storedTriangleOf(objIndex).textureIndex;
+    }
+
+    // Box of object with given index in the hierarchy (global index for spheres and triangles, see BVH)
+    Bounds hierarchyBoundsOf(int index) const {
+        int noSpheres = spheres.size();
+        if (index < noSpheres) {
+            return BVH::boundsFor(spheres[index]);
+        }
+        if (index < noObjects()) {
+            int k = index - noSpheres;
+            return compact.empty() ? triangles.boundsAt(k) : compact.boundsAt(k);
+        }
+        return BVH::boundsFor(instances[index - noObjects()]);
+    }
+
+    // Encodes triangles compactly (see CompactGeometry), which intersection tests and shading decode from then on,
+    // and rebuilds the hierarchy over the boxes of the decoded triangles
+    // The triangles themselves are then released (or unmapped), so they cannot be changed afterwards
+    CompactStats compactTriangles() {
+        CompactStats stats = compact.encode(triangles);
+        if (!compact.empty()) {
+            triangles = TriangleStore();
+        }
+        vector<Bounds> bounds;
+        int noIndices = noObjects() + instances.size();
+        bounds.reserve(noIndices);
+        for (int index = 0; index < noIndices; ++index) {
+            bounds.push_back(hierarchyBoundsOf(index));
+        }
+        bvh.build(move(bounds));
+        return stats;
+    }
 
     // Reads the scene description and validates it
     // If everything is valid returns true else returns false and prints and error message
@@ -55,7 +182,11 @@ public:
                  << "\" could not be opened. Maybe it doesn't exist or has insufficient permissions." << endl;
             return false;
         }
+        return parse(input);
+    }
 
+    // Same as parse(), but reads the scene description from given stream (e.g. scene text held in memory)
+    bool parse(istream &input) {
         // Checks to ensure critical data is given
         unordered_map<string, int> criticalInputCheck;
         criticalInputCheck["eye"] = 0;
@@ -70,6 +201,16 @@ public:
         vector<Vector3D> normals;
         vector<TextureCoordinates> textureCoordinates;
         bool materialColorExists = false;
+        // Textures are decoded, and hierarchies over every BVH_CHUNK_SIZE triangles are built, in the background
+        // while parsing goes on
+        vector<pair<int, future<Texture> > > pendingTextures;
+        vector<future<BVH> > pendingChunks;
+        size_t chunkStart = 0;
+        // Mesh definition being read (-1 outside of one), with its own vertices, normals and texture coordinates
+        int openMesh = -1;
+        vector<Vector3D> meshVertices;
+        vector<Vector3D> meshNormals;
+        vector<TextureCoordinates> meshTextureCoordinates;
 
         cout << "Parsing file \"" << this->filename << "\"." << endl;
         string line;
@@ -87,37 +228,31 @@ public:
                 // Critical input
             else if (keyword == "eye") {
                 if (!this->parseEye(iss)) {
-                    input.close();
                     return false;
                 }
                 criticalInputCheck[keyword] = 1;
             } else if (keyword == "viewdir") {
                 if (!this->parseViewDir(iss)) {
-                    input.close();
                     return false;
                 }
                 criticalInputCheck[keyword] = 1;
             } else if (keyword == "updir") {
                 if (!this->parseUpDir(iss)) {
-                    input.close();
                     return false;
                 }
                 criticalInputCheck[keyword] = 1;
             } else if (keyword == "vfov") {
                 if (!this->parseVFov(iss)) {
-                    input.close();
                     return false;
                 }
                 criticalInputCheck[keyword] = 1;
             } else if (keyword == "imsize") {
                 if (!this->parseImageSize(iss)) {
-                    input.close();
                     return false;
                 }
                 criticalInputCheck[keyword] = 1;
             } else if (keyword == "bkgcolor") {
                 if (!this->parseBgColor(iss)) {
-                    input.close();
                     return false;
                 }
                 criticalInputCheck[keyword] = 1;
@@ -127,43 +262,40 @@ public:
                 isParallelProjection = true;
             } else if (keyword == "viewdist") {
                 if (!this->parseViewdist(iss)) {
-                    input.close();
                     return false;
                 }
                 criticalInputCheck[keyword] = 1;
             } else if (keyword == "mtlcolor") {
                 if (!this->parseMtlColor(iss, materialColor)) {
-                    input.close();
                     return false;
                 }
                 materialColorExists = true;
             } else if (keyword == "texture") {
-                if (!this->parseTexture(iss)) {
-                    input.close();
+                if (!this->parseTexture(iss, pendingTextures)) {
                     return false;
                 }
             } else if (keyword == "v") {
-                if (!this->parseVertex(iss, vertices)) {
-                    input.close();
+                if (!this->parseVertex(iss, openMesh < 0 ? vertices : meshVertices)) {
                     return false;
                 }
             } else if (keyword == "vn") {
-                if (!this->parseNormal(iss, normals)) {
-                    input.close();
+                if (!this->parseNormal(iss, openMesh < 0 ? normals : meshNormals)) {
                     return false;
                 }
             } else if (keyword == "vt") {
-                if (!this->parseTextureCoordinates(iss, textureCoordinates)) {
-                    input.close();
+                if (!this->parseTextureCoordinates(iss, openMesh < 0 ? textureCoordinates : meshTextureCoordinates)) {
                     return false;
                 }
+            } else if (openMesh >= 0 && keyword != "f" && keyword != "endmesh") {
+                cerr << "Only faces, their vertices, materials and textures can be part of a mesh, found: " << keyword
+                     << endl;
+                return false;
             } else if (keyword == "sphere") {
                 if (!materialColorExists) {
                     cerr << "Sphere information found without preceding mtl color" << endl;
                     return false;
                 }
                 if (!this->parseSphere(iss, materialColor, textures)) {
-                    input.close();
                     return false;
                 }
             } else if (keyword == "f") {
@@ -171,13 +303,57 @@ public:
                     cerr << "Face information found without preceding mtl color" << endl;
                     return false;
                 }
-                if (!this->parseFace(iss, vertices, materialColor, normals, textureCoordinates)) {
-                    input.close();
+                if (openMesh >= 0) {
+                    if (!this->parseFace(iss, meshVertices, materialColor, meshNormals, meshTextureCoordinates,
+                                         meshes[openMesh].triangles)) {
+                        return false;
+                    }
+                    continue;
+                }
+                if (triangles.isMapped()) {
+                    cerr << "Face information found along with a triangle file" << endl;
+                    return false;
+                }
+                if (!this->parseFace(iss, vertices, materialColor, normals, textureCoordinates, triangles)) {
+                    return false;
+                }
+                if (triangles.size() - chunkStart >= BVH_CHUNK_SIZE) {
+                    pendingChunks.push_back(buildInBackground(chunkStart, triangles.size()));
+                    chunkStart = triangles.size();
+                }
+            } else if (keyword == "trianglefile") {
+                if (!this->parseTriangleFile(iss)) {
+                    return false;
+                }
+                // Boxes of mapped triangles are read from the file, the hierarchy is built over all of them at once
+                chunkStart = 0;
+            } else if (keyword == "mesh") {
+                if (!this->parseMesh(iss)) {
+                    return false;
+                }
+                openMesh = meshes.size() - 1;
+                meshVertices.clear();
+                meshNormals.clear();
+                meshTextureCoordinates.clear();
+            } else if (keyword == "endmesh") {
+                if (openMesh < 0) {
+                    cerr << "endmesh found without preceding mesh" << endl;
+                    return false;
+                }
+                if (!this->closeMesh(meshes[openMesh])) {
+                    return false;
+                }
+                openMesh = -1;
+            } else if (keyword == "instance") {
+                if (!this->parseInstance(iss, materialColorExists ? &materialColor : nullptr)) {
                     return false;
                 }
             } else if (keyword == "light") {
                 if (!this->parseLight(iss)) {
-                    input.close();
+                    return false;
+                }
+            } else if (keyword == "arealight") {
+                if (!this->parseAreaLight(iss)) {
                     return false;
                 }
             } else {
@@ -185,10 +361,13 @@ public:
                 continue;
             }
         }
+        if (openMesh >= 0) {
+            cerr << "Mesh " << meshes[openMesh].name << " is not closed with endmesh" << endl;
+            return false;
+        }
         // Parallel view and up vector check
         if (this->upDir.dot(this->viewDir) == 1 || this->upDir.dot(this->viewDir) == -1) {
             cerr << "Parallel/Anti-parallel up and view directions! " << endl;
-            input.close();
             return false;
         }
         // All necessary keywords obtained check
@@ -198,7 +377,35 @@ public:
                 return false;
             }
         }
-        input.close();
+        chrono::steady_clock::time_point waitStart = chrono::steady_clock::now();
+        bool texturesValid = true;
+        for (auto &pending : pendingTextures) {
+            textures[pending.first] = pending.second.get();
+            texturesValid = texturesValid && textures[pending.first].isValid();
+        }
+        if (!texturesValid) {
+            return false;
+        }
+        // Spheres, chunks, the remaining triangles and instances, in order of global index
+        vector<BVH> parts(1);
+        vector<Bounds> sphereBounds;
+        for (const auto &sphere : spheres) {
+            sphereBounds.push_back(BVH::boundsFor(sphere));
+        }
+        parts[0].build(sphereBounds);
+        for (auto &pending : pendingChunks) {
+            parts.push_back(pending.get());
+        }
+        parts.push_back(buildInBackground(chunkStart, triangles.size()).get());
+        vector<Bounds> instanceBounds;
+        for (const auto &instance : instances) {
+            instanceBounds.push_back(BVH::boundsFor(instance));
+        }
+        parts.emplace_back();
+        parts.back().build(instanceBounds);
+        bvh.join(parts);
+        backgroundWaitSeconds = chrono::duration<float>(chrono::steady_clock::now() - waitStart).count();
+        lightTree.build(lights);
         return true;
     }
 
@@ -362,7 +569,25 @@ private:
         return true;
     }
 
-    bool parseTexture(istringstream &iss) {
+    // Returns hierarchy over triangles first ... last - 1 (numbered from 0), built on another thread
+    future<BVH> buildInBackground(size_t first, size_t last) const {
+        // Boxes are taken here, as triangles may be reallocated by parsing while the hierarchy is built
+        vector<Bounds> bounds;
+        for (size_t k = first; k < last; ++k) {
+            bounds.push_back(triangles.boundsAt(k));
+        }
+        return async(launch::async, [](vector<Bounds> bounds) {
+            BVH part;
+            part.build(move(bounds));
+            return part;
+        }, move(bounds));
+    }
+
+    // Without a texture cache, the texture is decoded in the background: an empty texture holds its place
+    // (so that objects after it can refer to it) until parse collects it from pendingTextures
+    // At most one decode per core runs at a time, so that scenes of many textures do not start a thread for each of
+    // them (crowding out the hierarchy builds they overlap with): the decode that many places back is waited for first
+    bool parseTexture(istringstream &iss, vector<pair<int, future<Texture> > > &pendingTextures) {
         // Validation
         string textureFilename;
         if (!(iss >> textureFilename)) {
@@ -370,8 +595,20 @@ private:
             return false;
         }
         Texture texture(textureFilename);
-        if (!texture.parse()) {
-            return false;
+        if (textureCache != nullptr) {
+            if (!textureCache->get(textureFilename, texture)) {
+                return false;
+            }
+        } else {
+            size_t maxDecodes = max(1u, thread::hardware_concurrency());
+            if (pendingTextures.size() >= maxDecodes) {
+                pendingTextures[pendingTextures.size() - maxDecodes].second.wait();
+            }
+            pendingTextures.emplace_back(textures.size(), async(launch::async, [textureFilename]() {
+                Texture decoded(textureFilename);
+                // An invalid texture tells parse that decoding failed
+                return decoded.parse() ? decoded : Texture(textureFilename);
+            }));
         }
         // Setting scene variable
         textures.emplace_back(texture);
@@ -480,11 +717,14 @@ private:
         }
     }
 
+    // Adds the face to faces (the scene's triangles, or a mesh's)
+    template<typename Faces>
     bool parseFace(istringstream &iss,
                    const vector<Vector3D> &vertices,
                    const MaterialColor &materialColor,
                    const vector<Vector3D> &normals,
-                   const vector<TextureCoordinates> &textureCoordinates) {
+                   const vector<TextureCoordinates> &textureCoordinates,
+                   Faces &faces) {
         // Validation
         string s1, s2, s3;
         if (!(iss >> s1) || !(iss >> s2) || !(iss >> s3)) {
@@ -520,7 +760,7 @@ private:
             switch (ty1_v1_t1_n1[0]) {
                 case FLAT_TEXTURE_LESS:
                     // Setting scene variable
-                    this->triangles.emplace_back(
+                    faces.emplace_back(
                             Triangle(vertices[v1], vertices[v2], vertices[v3],
                                      materialColor)
                     );
@@ -535,7 +775,7 @@ private:
                     if (min(t1, min(t2, t3)) < 0 || max(t1, max(t2, t3)) >= textureCoordinates.size()) {
                         throw "Texture coordinates indices out of bounds";
                     }
-                    this->triangles.emplace_back(
+                    faces.emplace_back(
                             Triangle(vertices[v1], vertices[v2], vertices[v3],
                                      materialColor,
                                      textureCoordinates[t1], textureCoordinates[t2], textureCoordinates[t3],
@@ -549,7 +789,7 @@ private:
                     if (min(n1, min(n2, n3)) < 0 || max(n1, max(n2, n3)) >= normals.size()) {
                         throw "Normal indices out of bounds";
                     }
-                    this->triangles.emplace_back(
+                    faces.emplace_back(
                             Triangle(vertices[v1], vertices[v2], vertices[v3],
                                      materialColor,
                                      normals[n1], normals[n2], normals[n3])
@@ -571,7 +811,7 @@ private:
                     if (min(t1, min(t2, t3)) < 0 || max(t1, max(t2, t3)) >= textureCoordinates.size()) {
                         throw "Texture coordinates indices out of bounds";
                     }
-                    this->triangles.emplace_back(
+                    faces.emplace_back(
                             Triangle(vertices[v1], vertices[v2], vertices[v3],
                                      materialColor,
                                      normals[n1], normals[n2], normals[n3],
@@ -592,6 +832,113 @@ private:
         return true;
     }
 
+    bool parseTriangleFile(istringstream &iss) {
+        // Validation
+        string triangleFilename;
+        if (!(iss >> triangleFilename)) {
+            cerr << "Triangle filename not given" << endl;
+            return false;
+        }
+        if (!triangles.empty()) {
+            cerr << "Triangle file found after face information" << endl;
+            return false;
+        }
+        // Setting scene variable
+        return triangles.map(triangleFilename);
+    }
+
+    bool parseMesh(istringstream &iss) {
+        // Validation
+        string name;
+        if (!(iss >> name)) {
+            cerr << "Mesh name not given" << endl;
+            return false;
+        }
+        if (meshIndexOf(name) >= 0) {
+            cerr << "Mesh " << name << " is defined twice" << endl;
+            return false;
+        }
+        // Setting scene variable
+        meshes.emplace_back(name);
+        return true;
+    }
+
+    bool closeMesh(Mesh &mesh) {
+        if (mesh.triangles.empty()) {
+            cerr << "Mesh " << mesh.name << " has no faces" << endl;
+            return false;
+        }
+        vector<Bounds> bounds;
+        for (const auto &triangle : mesh.triangles) {
+            bounds.push_back(BVH::boundsFor(triangle));
+        }
+        mesh.bvh.build(bounds);
+        return true;
+    }
+
+    // Returns index of the mesh with given name, -1 if there is none
+    int meshIndexOf(const string &name) const {
+        for (size_t k = 0; k < meshes.size(); ++k) {
+            if (meshes[k].name == name) {
+                return (int) k;
+            }
+        }
+        return -1;
+    }
+
+    // Material override uses the current material color, null if there is none
+    bool parseInstance(istringstream &iss, const MaterialColor *materialColor) {
+        string name;
+        float x, y, z, rx, ry, rz, scale;
+        if (!(iss >> name)) {
+            cerr << "Instance mesh name not given" << endl;
+            return false;
+        }
+        int mesh = meshIndexOf(name);
+        if (mesh < 0 || meshes[mesh].bvh.isEmpty()) {
+            cerr << "Instance of mesh " << name << " found before its definition" << endl;
+            return false;
+        }
+        if (!(iss >> x) || !(iss >> y) || !(iss >> z)) {
+            cerr << "Instance translation incomplete" << endl;
+            return false;
+        }
+        if (!(iss >> rx) || !(iss >> ry) || !(iss >> rz)) {
+            cerr << "Instance rotation incomplete" << endl;
+            return false;
+        }
+        if (!(iss >> scale)) {
+            cerr << "Instance scale incomplete" << endl;
+            return false;
+        }
+        if (scale <= 0) {
+            cerr << "Instance scale is non-positive" << endl;
+            return false;
+        }
+        string option;
+        bool overridesMaterial = false;
+        if (iss >> option) {
+            if (option != "override") {
+                cerr << "Invalid instance option: " << option << endl;
+                return false;
+            }
+            if (materialColor == nullptr) {
+                cerr << "Instance material override found without preceding mtl color" << endl;
+                return false;
+            }
+            overridesMaterial = true;
+        }
+        // Setting scene variable
+        Transform transform(Vector3D(rx, ry, rz), scale, Vector3D(x, y, z));
+        int firstObject = noInstancedTriangles();
+        if (overridesMaterial) {
+            instances.emplace_back(mesh, transform, meshes[mesh].bounds(), firstObject, *materialColor);
+        } else {
+            instances.emplace_back(mesh, transform, meshes[mesh].bounds(), firstObject);
+        }
+        return true;
+    }
+
     bool parseLight(istringstream &iss) {
         float r, g, b, w, x, y, z;
         // (x, y, z) validation
@@ -627,6 +974,57 @@ private:
         return true;
     }
 
+    bool parseAreaLight(istringstream &iss) {
+        string shape;
+        float r, g, b, x, y, z;
+        if (!(iss >> shape) || (shape != "sphere" && shape != "quad")) {
+            cerr << "Area light shape is missing or invalid" << endl;
+            return false;
+        }
+        // Center validation
+        if (!(iss >> x) || !(iss >> y) || !(iss >> z)) {
+            cerr << "Area light center (x, y, z) incomplete" << endl;
+            return false;
+        }
+        float radius = 0;
+        float ux, uy, uz, vx, vy, vz;
+        if (shape == "sphere") {
+            if (!(iss >> radius)) {
+                cerr << "Area light radius incomplete" << endl;
+                return false;
+            }
+            if (radius <= 0) {
+                cerr << "Area light radius is not positive" << endl;
+                return false;
+            }
+        } else {
+            if (!(iss >> ux) || !(iss >> uy) || !(iss >> uz) || !(iss >> vx) || !(iss >> vy) || !(iss >> vz)) {
+                cerr << "Area light edges incomplete" << endl;
+                return false;
+            }
+            if (Vector3D(ux, uy, uz).cross(Vector3D(vx, vy, vz)).abs() < 1e-6) {
+                cerr << "Area light edges are zero or parallel" << endl;
+                return false;
+            }
+        }
+        // (r, g, b) validation
+        if (!(iss >> r) || !(iss >> g) || !(iss >> b)) {
+            cerr << "Area light (r, g, b) incomplete" << endl;
+            return false;
+        }
+        if (r < 0 || r > 1 || g < 0 || g > 1 || b < 0 || b > 1) {
+            cerr << "Area light color is not between 0 and 1" << endl;
+            return false;
+        }
+        // Setting scene variable
+        if (shape == "sphere") {
+            this->lights.emplace_back(Vector3D(x, y, z), radius, Color(r, g, b));
+        } else {
+            this->lights.emplace_back(Vector3D(x, y, z), Vector3D(ux, uy, uz), Vector3D(vx, vy, vz), Color(r, g, b));
+        }
+        return true;
+    }
+
     bool parseViewdist(istringstream &iss) {
         // Validation
         float _viewdist;
@@ -646,7 +1044,7 @@ private:
 };
 
 // this is to easily print a given object in a well-formatted manner to std for debugging
-std::ostream &operator<<(std::ostream &out, const Scene &s) {
+inline std::ostream &operator<<(std::ostream &out, const Scene &s) {
     out << "==== Scene ====" << endl;
     out << "Projtn:\t" << (s.isParallelProjection ? "Parallel" : "Perspective") << endl;
     out << "Eye:\t" << s.eye << endl;
@@ -658,8 +1056,19 @@ std::ostream &operator<<(std::ostream &out, const Scene &s) {
     for (const Sphere &sphere: s.spheres) {
         out << sphere << endl;
     }
-    for (const Triangle &triangle: s.triangles) {
-        out << triangle << endl;
+    if (s.triangles.isMapped()) {
+        // Printing mapped triangles would read the whole file
+        out << s.triangles << endl;
+    } else {
+        for (const Triangle &triangle: s.triangles) {
+            out << triangle << endl;
+        }
+    }
+    for (const Mesh &mesh: s.meshes) {
+        out << mesh << endl;
+    }
+    if (!s.instances.empty()) {
+        out << "Instances:\t" << s.instances.size() << " (" << s.noInstancedTriangles() << " triangles)" << endl;
     }
     for (const Light &light: s.lights) {
         out << light << endl;
@@ -0,0 +1,129 @@
+#ifndef SCENE_CACHE_HPP
+#define SCENE_CACHE_HPP
+
+#include <list>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <unordered_map>
+#include "filestamp.hpp"
+#include "scene.hpp"
+#include "gbuffer.hpp"
+#include "render.hpp"
+
+using namespace std;
+
+// Parsed scenes (with their textures and acceleration structures) by hash of their scene text
+// Holds at most capacity scenes, dropping the least recently used one when full
+// Scenes are shared and immutable, so a dropped scene stays valid for whoever still renders it
+// If bakeResolution is positive, lightmaps of a scene are baked (see bakeLightmaps) at that resolution when it is
+// parsed, so that jobs rendering it from any camera share them
+class SceneCache {
+    class Entry {
+    public:
+        shared_ptr<const Scene> scene;
+        // Texture files the scene was parsed with and their stamps back then
+        vector<pair<string, FileStamp> > textureStamps;
+    };
+
+    size_t capacity;
+    int bakeResolution;
+    // Most recently used first
+    list<pair<uint64_t, Entry> > entries;
+    unordered_map<uint64_t, list<pair<uint64_t, Entry> >::iterator> byHash;
+    mutex lock;
+    // Parses one scene at a time, as texture cache is not thread-safe
+    mutex parseLock;
+    TextureCache textureCache;
+
+public:
+    int hits, misses;
+
+    // this is to easily print a given object to std for debugging
+    friend std::ostream &operator<<(std::ostream &, const SceneCache &);
+
+    explicit SceneCache(size_t capacity, int bakeResolution = 0) : capacity(capacity), bakeResolution(bakeResolution),
+                                                                   hits(0), misses(0) {}
+
+    // Returns the scene described by text (named name in messages), parsing it only if it is not cached yet
+    // or a texture it uses changed on disk since. Sets hit accordingly
+    // Returns null (after printing an error message) if the scene is invalid
+    shared_ptr<const Scene> get(const string &name, const string &text, bool &hit) {
+        uint64_t hash = fnv1a(text.data(), text.size());
+        shared_ptr<const Scene> scene = lookUp(hash);
+        hit = scene != nullptr;
+        if (hit) {
+            return scene;
+        }
+        lock_guard<mutex> parseGuard(parseLock);
+        // Another thread may have parsed it while this one waited
+        scene = lookUp(hash);
+        hit = scene != nullptr;
+        if (hit) {
+            return scene;
+        }
+        shared_ptr<Scene> parsed(new Scene(name));
+        parsed->textureCache = &textureCache;
+        istringstream input(text);
+        if (!parsed->parse(input)) {
+            return nullptr;
+        }
+        parsed->textureCache = nullptr;
+        if (bakeResolution > 0) {
+            ostringstream message;
+            message << name << " " << bakeLightmaps(*parsed, bakeResolution) << "\n";
+            // Whole line at once, so that it does not interleave with lines of jobs
+            cout << message.str() << flush;
+        }
+        Entry entry;
+        entry.scene = parsed;
+        for (const auto &texture : parsed->textures) {
+            entry.textureStamps.emplace_back(texture.getFilename(), FileStamp(texture.getFilename()));
+        }
+        lock_guard<mutex> guard(lock);
+        misses++;
+        auto cached = byHash.find(hash);
+        if (cached != byHash.end()) {
+            entries.erase(cached->second);
+        }
+        entries.emplace_front(hash, entry);
+        byHash[hash] = entries.begin();
+        while (entries.size() > capacity) {
+            byHash.erase(entries.back().first);
+            entries.pop_back();
+        }
+        return parsed;
+    }
+
+    size_t size() {
+        lock_guard<mutex> guard(lock);
+        return entries.size();
+    }
+
+private:
+    // Returns cached scene (marking it most recently used) if it is there and its textures are unchanged
+    shared_ptr<const Scene> lookUp(uint64_t hash) {
+        lock_guard<mutex> guard(lock);
+        auto cached = byHash.find(hash);
+        if (cached == byHash.end()) {
+            return nullptr;
+        }
+        for (const auto &textureStamp : cached->second->second.textureStamps) {
+            if (FileStamp(textureStamp.first) != textureStamp.second) {
+                return nullptr;
+            }
+        }
+        entries.splice(entries.begin(), entries, cached->second);
+        hits++;
+        return cached->second->second.scene;
+    }
+
+};
+
+inline std::ostream &operator<<(std::ostream &out, const SceneCache &c) {
+    out << "SceneCache:" << "\t" << c.entries.size() << " of " << c.capacity << " scenes\t" << c.hits << " hits\t"
+        << c.misses << " misses";
+    return out;
+}
+
+#endif
@@ -0,0 +1,144 @@
+#ifndef SCENE_DIFF_HPP
+#define SCENE_DIFF_HPP
+
+#include <vector>
+#include "scene.hpp"
+#include "bounds.hpp"
+#include "footprint.hpp"
+
+using namespace std;
+
+// Difference between two parses of a scene file, as far as re-rendering is concerned
+class SceneDiff {
+public:
+    // Something every pixel depends on changed (camera, image, background, lights, textures)
+    bool needsFullRender;
+    // Global indices (in the old scene) of objects that changed or disappeared
+    vector<int> changedObjects;
+    // Boxes (in the new scene) of objects that moved, were reshaped or appeared
+    vector<Bounds> movedBounds;
+
+    // this is to easily print a given object to std for debugging
+    friend std::ostream &operator<<(std::ostream &, const SceneDiff &);
+
+    SceneDiff() : needsFullRender(false) {}
+
+    bool isEmpty() const {
+        return !needsFullRender && changedObjects.empty() && movedBounds.empty();
+    }
+
+    // Returns true if the tile that left given footprint in the old scene looks different in the new scene
+    // i.e. its rays touched a changed object, or a moved object now lies in the way of one of its rays
+    bool affects(const TileFootprint &footprint) const {
+        if (needsFullRender) {
+            return true;
+        }
+        for (int objIndex : changedObjects) {
+            if (footprint.touchedObjects.count(objIndex) > 0) {
+                return true;
+            }
+        }
+        for (const Bounds &bounds : movedBounds) {
+            // Rays were only recorded inside the old scene box, anything beyond it may have been missed
+            if (!footprint.sceneBounds.contains(bounds) || footprint.rayBounds.overlaps(bounds.padded(1e-3))) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+};
+
+// Box enclosing all objects in the scene
+inline Bounds sceneBoundsOf(const Scene &scene) {
+    Bounds bounds;
+    for (const auto &sphere : scene.spheres) {
+        bounds.expand(boundsOf(sphere));
+    }
+    for (size_t k = 0; k < scene.triangles.size(); ++k) {
+        bounds.expand(scene.triangles.boundsAt(k));
+    }
+    for (const auto &instance : scene.instances) {
+        bounds.expand(instance.bounds);
+    }
+    return bounds;
+}
+
+// Returns true if both scenes have the same meshes and instances of them, at the same global indices
+// Changes to instances are not tracked object by object, any of them needs a full render
+inline bool sameInstancing(const Scene &before, const Scene &after) {
+    if (before.instances.empty() && after.instances.empty()) {
+        return true;
+    }
+    return before.noObjects() == after.noObjects() && before.meshes == after.meshes
+           && before.instances == after.instances;
+}
+
+// Objects are matched by their position among spheres and among triangles in the scene file
+inline SceneDiff diffScenes(const Scene &before, const Scene &after, bool texturesReloaded) {
+    SceneDiff diff;
+    diff.needsFullRender = texturesReloaded
+                           || !(before.eye == after.eye) || !(before.viewDir == after.viewDir)
+                           || !(before.upDir == after.upDir) || before.vFovDeg != after.vFovDeg
+                           || before.imWidth != after.imWidth || before.imHeight != after.imHeight
+                           || !(before.bgColor == after.bgColor)
+                           || before.isParallelProjection != after.isParallelProjection
+                           || before.viewingDistance != after.viewingDistance
+                           || before.lights.size() != after.lights.size()
+                           || before.textures.size() != after.textures.size()
+                           || !sameInstancing(before, after);
+    if (diff.needsFullRender) {
+        return diff;
+    }
+    for (size_t k = 0; k < before.lights.size(); ++k) {
+        if (!(before.lights[k] == after.lights[k])) {
+            diff.needsFullRender = true;
+            return diff;
+        }
+    }
+    for (size_t k = 0; k < before.textures.size(); ++k) {
+        if (before.textures[k].getFilename() != after.textures[k].getFilename()) {
+            diff.needsFullRender = true;
+            return diff;
+        }
+    }
+
+    int noSpheresBefore = before.spheres.size();
+    size_t noSpheres = max(before.spheres.size(), after.spheres.size());
+    for (size_t k = 0; k < noSpheres; ++k) {
+        bool existedBefore = k < before.spheres.size();
+        bool existsAfter = k < after.spheres.size();
+        if (existedBefore && existsAfter && before.spheres[k] == after.spheres[k]) {
+            continue;
+        }
+        if (existedBefore) {
+            diff.changedObjects.push_back(k);
+        }
+        if (existsAfter && !(existedBefore && before.spheres[k].hasSameGeometry(after.spheres[k]))) {
+            diff.movedBounds.push_back(boundsOf(after.spheres[k]));
+        }
+    }
+    size_t noTriangles = max(before.triangles.size(), after.triangles.size());
+    for (size_t k = 0; k < noTriangles; ++k) {
+        bool existedBefore = k < before.triangles.size();
+        bool existsAfter = k < after.triangles.size();
+        if (existedBefore && existsAfter && before.triangles[k] == after.triangles[k]) {
+            continue;
+        }
+        if (existedBefore) {
+            diff.changedObjects.push_back(noSpheresBefore + k);
+        }
+        if (existsAfter && !(existedBefore && before.triangles[k].hasSameGeometry(after.triangles[k]))) {
+            diff.movedBounds.push_back(boundsOf(after.triangles[k]));
+        }
+    }
+    return diff;
+}
+
+inline std::ostream &operator<<(std::ostream &out, const SceneDiff &d) {
+    out << "SceneDiff:" << "\t" << (d.needsFullRender ? "full" : "partial") << "\t" << d.changedObjects.size()
+        << "\t" << d.movedBounds.size();
+    return out;
+}
+
+#endif
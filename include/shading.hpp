@@ -0,0 +1,202 @@
+#ifndef SHADING_HPP
+#define SHADING_HPP
+
+#include <vector>
+#include <cmath>
+#include <cfloat>
+#include <algorithm>
+#include <functional>
+#include "vector3d.hpp"
+#include "color.hpp"
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+using namespace std;
+
+// Diffuse and specular blinn-phong terms of (hit, light) pairs whose shadow factors are already known, gathered in
+// structure of arrays form and evaluated together (8 at a time with AVX2) instead of one by one as they are found
+// Every term is a contribution to the pixel it was gathered for, scaled by the throughput (product of the reflection
+// and transmission factors along the path) it was gathered at
+// The batch holds up to capacity terms, and shades them (handing them to addToPixel) whenever it is full
+class ShadingBatch {
+    // Columns of the batch: shading normal, unit direction to light, unit direction to eye, material, and light color
+    // times shadow factor, light sample weight and throughput
+    enum Column {
+        NX, NY, NZ, LX, LY, LZ, VX, VY, VZ, KD, KS, EXPONENT, DIFFUSE_R, DIFFUSE_G, DIFFUSE_B, SPECULAR_R, SPECULAR_G,
+        SPECULAR_B, LIGHT_R, LIGHT_G, LIGHT_B, COLUMNS
+    };
+
+    size_t capacity;
+    size_t count;
+    vector<float> columns;
+    vector<int> pixels;
+    function<void(int, const Color &)> addToPixel;
+
+    // this is to easily print a given object to std for debugging
+    friend std::ostream &operator<<(std::ostream &, const ShadingBatch &);
+
+public:
+    // Pixel that terms gathered from now on contribute to, set by the caller before rendering it
+    int pixel;
+    // Factor that terms gathered from now on are scaled by
+    float throughput;
+
+    ShadingBatch(int capacity, function<void(int, const Color &)> addToPixel)
+            : capacity(max(capacity, 1)), count(0), columns(COLUMNS * this->capacity), pixels(this->capacity),
+              addToPixel(addToPixel), pixel(0), throughput(1) {}
+
+    // Gathers the terms of a light of color lightColor (already scaled by its shadow factor and weight) at a hit
+    void add(const Vector3D &N, const Vector3D &Li, const Vector3D &V, const Color &diffusion, const Color &specular,
+             float kd, float ks, int n, const Color &lightColor) {
+        if (count == capacity) {
+            shade();
+        }
+        float *term = &columns[count];
+        const float values[COLUMNS] = {N.x, N.y, N.z, Li.x, Li.y, Li.z, V.x, V.y, V.z, kd, ks, (float) n,
+                                       diffusion.getR(), diffusion.getG(), diffusion.getB(),
+                                       specular.getR(), specular.getG(), specular.getB(),
+                                       lightColor.getR() * throughput, lightColor.getG() * throughput,
+                                       lightColor.getB() * throughput};
+        for (int column = 0; column < COLUMNS; ++column) {
+            term[column * capacity] = values[column];
+        }
+        pixels[count++] = pixel;
+    }
+
+    // Evaluates every gathered term, hands each to addToPixel and empties the batch
+    // Terms of a pixel are added in the order they were gathered
+    void shade() {
+        size_t k = 0;
+#ifdef __AVX2__
+        float r[8], g[8], b[8];
+        for (; k + 8 <= count; k += 8) {
+            shadeLanes(k, r, g, b);
+            for (int lane = 0; lane < 8; ++lane) {
+                addToPixel(pixels[k + lane], Color(r[lane], g[lane], b[lane]));
+            }
+        }
+#endif
+        for (; k < count; ++k) {
+            const float *term = &columns[k];
+            auto at = [term, this](Column column) { return term[column * capacity]; };
+            float hx = at(LX) + at(VX), hy = at(LY) + at(VY), hz = at(LZ) + at(VZ);
+            float NL = at(NX) * at(LX) + at(NY) * at(LY) + at(NZ) * at(LZ);
+            float NH = (at(NX) * hx + at(NY) * hy + at(NZ) * hz) / sqrt(hx * hx + hy * hy + hz * hz);
+            float diffuse = at(KD) * max(0.0f, NL);
+            float specular = at(KS) * powInteger(max(0.0f, NH), at(EXPONENT));
+            addToPixel(pixels[k], Color((at(DIFFUSE_R) * diffuse + at(SPECULAR_R) * specular) * at(LIGHT_R),
+                                        (at(DIFFUSE_G) * diffuse + at(SPECULAR_G) * specular) * at(LIGHT_G),
+                                        (at(DIFFUSE_B) * diffuse + at(SPECULAR_B) * specular) * at(LIGHT_B)));
+        }
+        count = 0;
+    }
+
+private:
+#ifdef __AVX2__
+    // log2 of positive normal floats: exponent plus 2 / ln 2 * atanh((m - 1) / (m + 1)) of mantissa m in [√½, √2)
+    static __m256 log2Lanes(__m256 x) {
+        __m256i bits = _mm256_castps_si256(x);
+        __m256i exponentBits = _mm256_sub_epi32(_mm256_srli_epi32(bits, 23), _mm256_set1_epi32(127));
+        __m256 m = _mm256_castsi256_ps(_mm256_or_si256(_mm256_and_si256(bits, _mm256_set1_epi32(0x007fffff)),
+                                                       _mm256_set1_epi32(0x3f800000)));
+        __m256 e = _mm256_cvtepi32_ps(exponentBits);
+        __m256 big = _mm256_cmp_ps(m, _mm256_set1_ps((float) M_SQRT2), _CMP_GT_OQ);
+        m = _mm256_blendv_ps(m, _mm256_mul_ps(m, _mm256_set1_ps(0.5f)), big);
+        e = _mm256_add_ps(e, _mm256_and_ps(big, _mm256_set1_ps(1)));
+        __m256 t = _mm256_div_ps(_mm256_sub_ps(m, _mm256_set1_ps(1)), _mm256_add_ps(m, _mm256_set1_ps(1)));
+        __m256 t2 = _mm256_mul_ps(t, t);
+        __m256 series = _mm256_set1_ps(1.0f / 9);
+        series = _mm256_add_ps(_mm256_mul_ps(series, t2), _mm256_set1_ps(1.0f / 7));
+        series = _mm256_add_ps(_mm256_mul_ps(series, t2), _mm256_set1_ps(1.0f / 5));
+        series = _mm256_add_ps(_mm256_mul_ps(series, t2), _mm256_set1_ps(1.0f / 3));
+        series = _mm256_add_ps(_mm256_mul_ps(series, t2), _mm256_set1_ps(1));
+        return _mm256_add_ps(e, _mm256_mul_ps(_mm256_mul_ps(series, t), _mm256_set1_ps((float) (2 / M_LN2))));
+    }
+
+    // 2^y for y >= -126: 2^floor(y) from exponent bits, times √2 e^(g) with g = (fraction - ½) ln 2 in [-0.35, 0.35)
+    static __m256 exp2Lanes(__m256 y) {
+        y = _mm256_max_ps(y, _mm256_set1_ps(-126));
+        y = _mm256_min_ps(y, _mm256_set1_ps(127));
+        __m256 whole = _mm256_floor_ps(y);
+        __m256 g = _mm256_mul_ps(_mm256_sub_ps(_mm256_sub_ps(y, whole), _mm256_set1_ps(0.5f)),
+                                 _mm256_set1_ps((float) M_LN2));
+        __m256 series = _mm256_set1_ps(1.0f / 720);
+        series = _mm256_add_ps(_mm256_mul_ps(series, g), _mm256_set1_ps(1.0f / 120));
+        series = _mm256_add_ps(_mm256_mul_ps(series, g), _mm256_set1_ps(1.0f / 24));
+        series = _mm256_add_ps(_mm256_mul_ps(series, g), _mm256_set1_ps(1.0f / 6));
+        series = _mm256_add_ps(_mm256_mul_ps(series, g), _mm256_set1_ps(0.5f));
+        series = _mm256_add_ps(_mm256_mul_ps(series, g), _mm256_set1_ps(1));
+        series = _mm256_add_ps(_mm256_mul_ps(series, g), _mm256_set1_ps(1));
+        __m256i scale = _mm256_slli_epi32(_mm256_add_epi32(_mm256_cvtps_epi32(whole), _mm256_set1_epi32(127)), 23);
+        return _mm256_mul_ps(_mm256_mul_ps(series, _mm256_set1_ps((float) M_SQRT2)), _mm256_castsi256_ps(scale));
+    }
+
+    __m256 load(Column column, size_t k) const {
+        return _mm256_loadu_ps(&columns[column * capacity + k]);
+    }
+
+    // Colors of terms k ... k + 7
+    void shadeLanes(size_t k, float *r, float *g, float *b) const {
+        __m256 nx = load(NX, k), ny = load(NY, k), nz = load(NZ, k);
+        __m256 lx = load(LX, k), ly = load(LY, k), lz = load(LZ, k);
+        __m256 hx = _mm256_add_ps(lx, load(VX, k)), hy = _mm256_add_ps(ly, load(VY, k));
+        __m256 hz = _mm256_add_ps(lz, load(VZ, k));
+        __m256 nl = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(nx, lx), _mm256_mul_ps(ny, ly)), _mm256_mul_ps(nz, lz));
+        __m256 nh = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(nx, hx), _mm256_mul_ps(ny, hy)), _mm256_mul_ps(nz, hz));
+        __m256 hh = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(hx, hx), _mm256_mul_ps(hy, hy)), _mm256_mul_ps(hz, hz));
+        __m256 zero = _mm256_setzero_ps();
+        nl = _mm256_max_ps(zero, nl);
+        nh = _mm256_max_ps(zero, _mm256_div_ps(nh, _mm256_sqrt_ps(hh)));
+        // pow(nh, n) = 2^(n log2 nh), except that pow(x, 0) is 1 (even for x = 0)
+        // Powers below 2^-100 (far below what a pixel shows) are flushed to 0, as denormal products would be slow
+        __m256 n = load(EXPONENT, k);
+        __m256 y = _mm256_mul_ps(n, log2Lanes(_mm256_max_ps(nh, _mm256_set1_ps(FLT_MIN))));
+        __m256 power = _mm256_and_ps(exp2Lanes(y), _mm256_cmp_ps(y, _mm256_set1_ps(-100), _CMP_GE_OQ));
+        power = _mm256_blendv_ps(power, _mm256_set1_ps(1), _mm256_cmp_ps(n, zero, _CMP_EQ_OQ));
+        __m256 diffuse = _mm256_mul_ps(load(KD, k), nl);
+        __m256 specular = _mm256_mul_ps(load(KS, k), power);
+        _mm256_storeu_ps(r, _mm256_mul_ps(_mm256_add_ps(_mm256_mul_ps(load(DIFFUSE_R, k), diffuse),
+                                                        _mm256_mul_ps(load(SPECULAR_R, k), specular)),
+                                          load(LIGHT_R, k)));
+        _mm256_storeu_ps(g, _mm256_mul_ps(_mm256_add_ps(_mm256_mul_ps(load(DIFFUSE_G, k), diffuse),
+                                                        _mm256_mul_ps(load(SPECULAR_G, k), specular)),
+                                          load(LIGHT_G, k)));
+        _mm256_storeu_ps(b, _mm256_mul_ps(_mm256_add_ps(_mm256_mul_ps(load(DIFFUSE_B, k), diffuse),
+                                                        _mm256_mul_ps(load(SPECULAR_B, k), specular)),
+                                          load(LIGHT_B, k)));
+    }
+#endif
+
+};
+
+// Scales the throughput of the calling thread's shading batch (if any) by factor for as long as it exists, i.e. while
+// tracing a ray whose color is going to be multiplied by factor
+class ThroughputScope {
+    ShadingBatch *batch;
+    float saved;
+
+public:
+    ThroughputScope(ShadingBatch *batch, float factor) : batch(batch), saved(batch != nullptr ? batch->throughput : 1) {
+        if (batch != nullptr) {
+            batch->throughput = saved * factor;
+        }
+    }
+
+    ~ThroughputScope() {
+        if (batch != nullptr) {
+            batch->throughput = saved;
+        }
+    }
+};
+
+inline std::ostream &operator<<(std::ostream &out, const ShadingBatch &s) {
+    out << "ShadingBatch:" << "\t" << s.count << " / " << s.capacity << " terms";
+    return out;
+}
+
+// Shading batch of the calling thread, null when light terms are shaded right away
+extern thread_local ShadingBatch *activeShadingBatch;
+
+#endif
@@ -27,9 +27,27 @@ public:
             : renderType(TEXTURED), center(center), radius(radius), materialColor(color),
               textureIndex(textureIndex) {}
 
+    // Returns same sphere moved by offset
+    Sphere translated(const Vector3D &offset) const {
+        if (renderType == TEXTURE_LESS) {
+            return Sphere(center + offset, radius, materialColor);
+        }
+        return Sphere(center + offset, radius, materialColor, textureIndex);
+    }
+
+    // Same shape and position, regardless of material and texture
+    bool hasSameGeometry(const Sphere &s) const {
+        return center == s.center && radius == s.radius;
+    }
+
+    bool operator==(const Sphere &s) const {
+        return center == s.center && radius == s.radius && materialColor == s.materialColor
+               && renderType == s.renderType && textureIndex == s.textureIndex;
+    }
+
 };
 
-std::ostream &operator<<(std::ostream &out, const Sphere &s) {
+inline std::ostream &operator<<(std::ostream &out, const Sphere &s) {
     out << "Sphere:" << "\t" << s.center << "\t" << s.radius << "\t" << s.materialColor;
     return out;
 }
@@ -0,0 +1,41 @@
+#ifndef SURFACE_HIT_HPP
+#define SURFACE_HIT_HPP
+
+#include "texturecoordinates.hpp"
+
+// Geometric information of a point where a ray hits an object, independent of lights and materials
+class SurfaceHit {
+public:
+    // Global index of the object (spheres first, then triangles), -1 if nothing is hit
+    int objIndex;
+    // T parameter of the hit along the ray
+    float t;
+    // Point of intersection
+    Vector3D poi;
+    // Shading normal at point of intersection (interpolated if the object is smooth)
+    Vector3D normal;
+    // Texture coordinates at point of intersection (only meaningful for textured objects)
+    TextureCoordinates textureCoordinates;
+
+    // this is to easily print a given object to std for debugging
+    friend std::ostream &operator<<(std::ostream &, const SurfaceHit &);
+
+    SurfaceHit() : objIndex(-1), t(-1), poi(Vector3D()), normal(Vector3D()),
+                   textureCoordinates(TextureCoordinates()) {}
+
+    SurfaceHit(int objIndex, float t, Vector3D poi, Vector3D normal, TextureCoordinates textureCoordinates)
+            : objIndex(objIndex), t(t), poi(poi), normal(normal), textureCoordinates(textureCoordinates) {}
+
+    bool isMiss() const {
+        return objIndex < 0;
+    }
+
+};
+
+inline std::ostream &operator<<(std::ostream &out, const SurfaceHit &h) {
+    out << "SurfaceHit:" << "\t" << h.objIndex << "\t" << h.t << "\t" << h.poi << "\t" << h.normal << "\t"
+        << h.textureCoordinates;
+    return out;
+}
+
+#endif
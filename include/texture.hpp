@@ -4,12 +4,14 @@
 #include <fstream>
 #include <vector>
 #include <sstream>
+#include <unordered_map>
 #include "color.hpp"
+#include "filestamp.hpp"
 
 using namespace std;
 
 // Returns tokens after splitting input string with delimiter
-vector<string> split(const string &input, const string &delimiter) {
+inline vector<string> split(const string &input, const string &delimiter) {
     string inputCopy = input;
     vector<string> ans;
     int pos = 0;
@@ -39,6 +41,10 @@ public:
 
     Texture(const string &filename) : filename(filename), width(0), height(0), pixelMax(0) {}
 
+    const string &getFilename() const {
+        return filename;
+    }
+
     bool isValid() const {
         return width > 0 && height > 0;
     }
@@ -52,7 +58,8 @@ public:
                  << "\" could not be opened. Maybe it doesn't exist or has insufficient permissions." << endl;
             return false;
         }
-        cout << "Parsing texture file: " << filename << endl;
+        // Whole line at once, as textures can be decoded on several threads at once
+        cout << "Parsing texture file: " + filename + "\n" << flush;
         string line;
         getline(texturePPM, line);
         istringstream heading(line);
@@ -96,15 +103,47 @@ public:
         return true;
     }
 
+    // Coordinates are clamped to the texture, as hits let through just outside a triangle's edges (see
+    // CompactGeometry) extrapolate them beyond [0, 1]
     Color colorAt(const TextureCoordinates &textureCoordinates) const {
-        int i = round(textureCoordinates.u * (width - 1));
-        int j = round(textureCoordinates.v * (height - 1));
+        int i = min(width - 1, max(0, (int) round(textureCoordinates.u * (width - 1))));
+        int j = min(height - 1, max(0, (int) round(textureCoordinates.v * (height - 1))));
         return pixels[i][j];
     }
 };
 
+// Decoded textures kept across parses of scenes, so that unchanged texture files are not decoded again
+class TextureCache {
+    // filename -> (stamp of the file when decoded, texture)
+    unordered_map<string, pair<FileStamp, Texture>> textures;
+
+public:
+    // Number of texture files decoded so far
+    int decodes;
+
+    TextureCache() : decodes(0) {}
+
+    // Fills texture decoded from the file, decoding it only if it is not cached or has changed on disk since
+    // Returns false if the file could not be decoded
+    bool get(const string &filename, Texture &texture) {
+        FileStamp modified(filename);
+        auto cached = textures.find(filename);
+        if (cached != textures.end() && cached->second.first == modified) {
+            texture = cached->second.second;
+            return true;
+        }
+        Texture decoded(filename);
+        if (!decoded.parse()) {
+            return false;
+        }
+        decodes++;
+        textures[filename] = make_pair(modified, decoded);
+        texture = decoded;
+        return true;
+    }
+};
 
-std::ostream &operator<<(std::ostream &out, const Texture &i) {
+inline std::ostream &operator<<(std::ostream &out, const Texture &i) {
     out << "Texture:" << "\t" << i.width << "\t" << i.height << "\t" << i.pixelMax;
     return out;
 }
@@ -13,6 +13,10 @@ public:
 
     TextureCoordinates(float u, float v) : u(u), v(v) {}
 
+    bool operator==(const TextureCoordinates &b) const {
+        return this->u == b.u && this->v == b.v;
+    }
+
     TextureCoordinates operator+(const TextureCoordinates &b) const {
         return TextureCoordinates(this->u + b.u, this->v + b.v);
     }
@@ -24,7 +28,7 @@ public:
 
 };
 
-std::ostream &operator<<(std::ostream &out, const TextureCoordinates &tc) {
+inline std::ostream &operator<<(std::ostream &out, const TextureCoordinates &tc) {
     out << "Texture coor:" << "\t(" << tc.u << ", " << tc.v << ")";
     return out;
 }
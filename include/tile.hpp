@@ -0,0 +1,59 @@
+#ifndef TILE_HPP
+#define TILE_HPP
+
+#include <vector>
+#include <algorithm>
+
+using namespace std;
+
+// Rectangular block of pixels [x0, x1) x [y0, y1) of the output image
+class Tile {
+public:
+    int index;
+    int x0, y0, x1, y1;
+
+    // this is to easily print a given object to std for debugging
+    friend std::ostream &operator<<(std::ostream &, const Tile &);
+
+    Tile(int index, int x0, int y0, int x1, int y1) : index(index), x0(x0), y0(y0), x1(x1), y1(y1) {}
+
+    int width() const {
+        return x1 - x0;
+    }
+
+    int height() const {
+        return y1 - y0;
+    }
+
+};
+
+// Splits width x height image into tiles of size x size pixels (smaller at right and bottom edges)
+// Tiles are ordered row by row
+inline vector<Tile> tilesOf(int width, int height, int size) {
+    vector<Tile> tiles;
+    for (int y = 0; y < height; y += size) {
+        for (int x = 0; x < width; x += size) {
+            tiles.emplace_back(tiles.size(), x, y, min(x + size, width), min(y + size, height));
+        }
+    }
+    return tiles;
+}
+
+// Tiles of tilesOf(width, height, size) (with the same indices) overlapping region [x0, x1) x [y0, y1)
+inline vector<Tile> tilesOverlapping(int width, int height, int size, int x0, int y0, int x1, int y1) {
+    vector<Tile> tiles;
+    int tilesPerRow = (width + size - 1) / size;
+    for (int y = y0 / size * size; y < y1; y += size) {
+        for (int x = x0 / size * size; x < x1; x += size) {
+            tiles.emplace_back(y / size * tilesPerRow + x / size, x, y, min(x + size, width), min(y + size, height));
+        }
+    }
+    return tiles;
+}
+
+inline std::ostream &operator<<(std::ostream &out, const Tile &t) {
+    out << "Tile:" << "\t" << t.index << "\t(" << t.x0 << ", " << t.y0 << ") - (" << t.x1 << ", " << t.y1 << ")";
+    return out;
+}
+
+#endif
@@ -87,6 +87,32 @@ public:
               D(-v1.dot(surfaceNormal)),
               area((v2 - v1).cross(v3 - v1).abs() / 2) {}
 
+    // Returns same triangle moved by offset
+    Triangle translated(const Vector3D &offset) const {
+        switch (renderType) {
+            case FLAT_TEXTURE_LESS:
+                return Triangle(v1 + offset, v2 + offset, v3 + offset, materialColor);
+            case FLAT_TEXTURED:
+                return Triangle(v1 + offset, v2 + offset, v3 + offset, materialColor, t1, t2, t3, textureIndex);
+            case SMOOTH_TEXTURE_LESS:
+                return Triangle(v1 + offset, v2 + offset, v3 + offset, materialColor, n1, n2, n3);
+            default:
+                return Triangle(v1 + offset, v2 + offset, v3 + offset, materialColor, n1, n2, n3,
+                                t1, t2, t3, textureIndex);
+        }
+    }
+
+    bool operator==(const Triangle &t) const {
+        return renderType == t.renderType && v1 == t.v1 && v2 == t.v2 && v3 == t.v3
+               && n1 == t.n1 && n2 == t.n2 && n3 == t.n3 && t1 == t.t1 && t2 == t.t2 && t3 == t.t3
+               && materialColor == t.materialColor && textureIndex == t.textureIndex;
+    }
+
+    // Same shape and position, regardless of material and texture
+    bool hasSameGeometry(const Triangle &t) const {
+        return v1 == t.v1 && v2 == t.v2 && v3 == t.v3;
+    }
+
     // Returns interpolated normal given point of intersection
     Vector3D getInterpolatedNormal(const Vector3D &poi) const {
         Triangle a(poi, v2, v3, materialColor);
@@ -111,7 +137,7 @@ public:
 
 };
 
-std::ostream &operator<<(std::ostream &out, const Triangle &t) {
+inline std::ostream &operator<<(std::ostream &out, const Triangle &t) {
     string type;
     if (t.renderType == FLAT_TEXTURE_LESS) {
         type = "FLAT_TEXTURE_LESS";
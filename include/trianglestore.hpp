@@ -0,0 +1,310 @@
+#ifndef TRIANGLE_STORE_HPP
+#define TRIANGLE_STORE_HPP
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "config.hpp"
+#include "triangle.hpp"
+#include "bounds.hpp"
+
+using namespace std;
+
+// Triangle files are read by mapping them, so triangles are stored as they are laid out in memory
+static_assert(is_trivially_copyable<Triangle>::value && is_trivially_copyable<Bounds>::value,
+              "Triangles and boxes must be trivially copyable to be stored in triangle files");
+
+#define TRIANGLE_FILE_MAGIC "YARTTRIS"
+#define TRIANGLE_FILE_VERSION 1
+// Sections of a triangle file start at multiples of this (a multiple of the page size)
+#define TRIANGLE_FILE_ALIGNMENT 65536
+
+// How many pages of a triangle file (see TriangleStore) hold triangles, and how many of them are in memory
+class PageResidency {
+public:
+    long pages, residentPages;
+
+    // this is to easily print a given object to std for debugging
+    friend std::ostream &operator<<(std::ostream &, const PageResidency &);
+
+    PageResidency() : pages(0), residentPages(0) {}
+
+};
+
+// Triangles of a scene, either held in memory or read from a memory mapped triangle file
+// A triangle file holds a header, the triangles and then their boxes (see BVH::boundsFor), each section aligned to
+// TRIANGLE_FILE_ALIGNMENT. Triangles are written in Morton order (see reorderScene), so that triangles close in space
+// share pages: only the pages of triangles rays are tested against are ever read, while the hierarchy is built from
+// the boxes alone
+// Reads are the same either way, changing a mapped store first copies its triangles into memory
+class TriangleStore {
+    class Header {
+    public:
+        char magic[8];
+        uint32_t version;
+        uint32_t triangleSize;
+        uint64_t count;
+        uint64_t trianglesOffset;
+        uint64_t boundsOffset;
+        uint64_t geometryHash;
+    };
+
+    // Mapped file, unmapped once no store refers to it anymore
+    class Mapping {
+    public:
+        string filename;
+        void *address;
+        size_t bytes;
+        const Triangle *triangles;
+        const Bounds *bounds;
+        size_t count;
+        uint64_t geometryHash;
+
+        Mapping(const string &filename) : filename(filename), address(MAP_FAILED), bytes(0), triangles(nullptr),
+                                          bounds(nullptr), count(0), geometryHash(0) {}
+
+        ~Mapping() {
+            if (address != MAP_FAILED) {
+                munmap(address, bytes);
+            }
+        }
+
+    };
+
+    vector<Triangle> resident;
+    shared_ptr<const Mapping> mapping;
+    // Triangles of whichever of the two is used
+    const Triangle *first;
+
+    // this is to easily print a given object to std for debugging
+    friend std::ostream &operator<<(std::ostream &, const TriangleStore &);
+
+public:
+    TriangleStore() : first(nullptr) {}
+
+    TriangleStore(const TriangleStore &store) : resident(store.resident), mapping(store.mapping) {
+        point();
+    }
+
+    TriangleStore &operator=(const TriangleStore &store) {
+        // Triangles are not assignable, so they are copied into a new vector
+        vector<Triangle> copied(store.resident);
+        resident.swap(copied);
+        mapping = store.mapping;
+        point();
+        return *this;
+    }
+
+    size_t size() const {
+        return mapping ? mapping->count : resident.size();
+    }
+
+    bool empty() const {
+        return size() == 0;
+    }
+
+    const Triangle &operator[](size_t k) const {
+        return first[k];
+    }
+
+    const Triangle *begin() const {
+        return first;
+    }
+
+    const Triangle *end() const {
+        return first + size();
+    }
+
+    bool isMapped() const {
+        return mapping != nullptr;
+    }
+
+    // Box of triangle k in the hierarchy, read from the file for a mapped store so the triangle is not touched
+    Bounds boundsAt(size_t k) const {
+        return mapping ? mapping->bounds[k] : boundsOf(first[k]);
+    }
+
+    // Hash of the mapped triangles given to write (0 for a store held in memory), which stands in for hashing them
+    uint64_t geometryHash() const {
+        return mapping ? mapping->geometryHash : 0;
+    }
+
+    template<typename... Args>
+    void emplace_back(Args &&... args) {
+        makeResident();
+        resident.emplace_back(forward<Args>(args)...);
+        point();
+    }
+
+    void push_back(const Triangle &triangle) {
+        emplace_back(triangle);
+    }
+
+    void reserve(size_t count) {
+        makeResident();
+        resident.reserve(count);
+        point();
+    }
+
+    void clear() {
+        mapping.reset();
+        resident.clear();
+        point();
+    }
+
+    void swap(vector<Triangle> &triangles) {
+        makeResident();
+        resident.swap(triangles);
+        point();
+    }
+
+    // Maps given triangle file (see write) in place of the triangles held so far
+    // Returns false (after printing an error message) if it can not be read or was not written by write
+    bool map(const string &filename) {
+        shared_ptr<Mapping> mapped(new Mapping(filename));
+        int fd = open(filename.c_str(), O_RDONLY);
+        struct stat fileStat;
+        if (fd < 0 || fstat(fd, &fileStat) != 0) {
+            cerr << "Triangle file \"" << filename << "\" could not be opened: " << strerror(errno) << endl;
+            if (fd >= 0) {
+                close(fd);
+            }
+            return false;
+        }
+        mapped->bytes = fileStat.st_size;
+        if (mapped->bytes >= sizeof(Header)) {
+            mapped->address = mmap(nullptr, mapped->bytes, PROT_READ, MAP_SHARED, fd, 0);
+        }
+        close(fd);
+        if (mapped->address == MAP_FAILED) {
+            cerr << "Triangle file \"" << filename << "\" could not be mapped" << endl;
+            return false;
+        }
+        // Prefetch hint, see GEOMETRY_PREFETCH, given before the header is read so that reading it does not read ahead
+        madvise(mapped->address, mapped->bytes,
+                GEOMETRY_PREFETCH == 0 ? MADV_RANDOM : GEOMETRY_PREFETCH == 1 ? MADV_NORMAL : MADV_WILLNEED);
+        const Header &header = *(const Header *) mapped->address;
+        if (memcmp(header.magic, TRIANGLE_FILE_MAGIC, sizeof(header.magic)) != 0
+            || header.version != TRIANGLE_FILE_VERSION || header.triangleSize != sizeof(Triangle)
+            || header.trianglesOffset + header.count * sizeof(Triangle) > header.boundsOffset
+            || header.boundsOffset + header.count * sizeof(Bounds) > mapped->bytes) {
+            cerr << "Triangle file \"" << filename << "\" is invalid or was written by another build" << endl;
+            return false;
+        }
+        mapped->count = header.count;
+        mapped->geometryHash = header.geometryHash;
+        mapped->triangles = (const Triangle *) ((const char *) mapped->address + header.trianglesOffset);
+        mapped->bounds = (const Bounds *) ((const char *) mapped->address + header.boundsOffset);
+        resident.clear();
+        resident.shrink_to_fit();
+        mapping = mapped;
+        point();
+        return true;
+    }
+
+    // Writes triangles into a triangle file, which map reads, along with given hash of them (see geometryHash)
+    // Its pages are dropped from the page cache afterwards, so that a render mapping it reads only what it touches
+    static bool write(const string &filename, const TriangleStore &triangles, uint64_t geometryHash) {
+        Header header;
+        memcpy(header.magic, TRIANGLE_FILE_MAGIC, sizeof(header.magic));
+        header.version = TRIANGLE_FILE_VERSION;
+        header.triangleSize = sizeof(Triangle);
+        header.count = triangles.size();
+        header.trianglesOffset = aligned(sizeof(Header));
+        header.boundsOffset = aligned(header.trianglesOffset + header.count * sizeof(Triangle));
+        header.geometryHash = geometryHash;
+        ofstream out(filename, ios::binary | ios::trunc);
+        out.write((const char *) &header, sizeof(Header));
+        pad(out, header.trianglesOffset);
+        out.write((const char *) triangles.begin(), header.count * sizeof(Triangle));
+        pad(out, header.boundsOffset);
+        for (size_t k = 0; k < triangles.size(); ++k) {
+            Bounds bounds = triangles.boundsAt(k);
+            out.write((const char *) &bounds, sizeof(Bounds));
+        }
+        out.close();
+        if (out.fail()) {
+            cerr << "Triangle file \"" << filename << "\" could not be written" << endl;
+            return false;
+        }
+        int fd = open(filename.c_str(), O_RDONLY);
+        if (fd >= 0) {
+            fdatasync(fd);
+            posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+            close(fd);
+        }
+        return true;
+    }
+
+    // Pages of the mapped triangles and how many of them are in memory (none for a store held in memory)
+    PageResidency residency() const {
+        PageResidency residency;
+        if (!mapping || mapping->count == 0) {
+            return residency;
+        }
+        size_t pageSize = sysconf(_SC_PAGESIZE);
+        const char *base = (const char *) mapping->address;
+        size_t from = ((const char *) mapping->triangles - base) / pageSize * pageSize;
+        size_t to = (const char *) (mapping->triangles + mapping->count) - base;
+        vector<unsigned char> pages((to - from + pageSize - 1) / pageSize);
+        if (mincore((void *) (base + from), to - from, pages.data()) != 0) {
+            return residency;
+        }
+        residency.pages = pages.size();
+        for (unsigned char page : pages) {
+            residency.residentPages += page & 1;
+        }
+        return residency;
+    }
+
+private:
+    void point() {
+        first = mapping ? mapping->triangles : resident.data();
+    }
+
+    void makeResident() {
+        if (mapping) {
+            vector<Triangle> copied(begin(), end());
+            resident.swap(copied);
+            mapping.reset();
+        }
+    }
+
+    static uint64_t aligned(uint64_t offset) {
+        return (offset + TRIANGLE_FILE_ALIGNMENT - 1) / TRIANGLE_FILE_ALIGNMENT * TRIANGLE_FILE_ALIGNMENT;
+    }
+
+    static void pad(ofstream &out, uint64_t offset) {
+        while ((uint64_t) out.tellp() < offset) {
+            out.put(0);
+        }
+    }
+
+};
+
+inline std::ostream &operator<<(std::ostream &out, const PageResidency &r) {
+    out << "PageResidency:" << "\t" << r.residentPages << " of " << r.pages << " pages resident";
+    if (r.pages > 0) {
+        out << " (" << 100.0 * r.residentPages / r.pages << "%)";
+    }
+    return out;
+}
+
+inline std::ostream &operator<<(std::ostream &out, const TriangleStore &s) {
+    out << "TriangleStore:" << "\t" << s.size() << " triangles";
+    if (s.mapping) {
+        out << "\tmapped from \"" << s.mapping->filename << "\"";
+    }
+    return out;
+}
+
+#endif
@@ -1,6 +1,10 @@
 #ifndef VECTOR3D_HPP
 #define VECTOR3D_HPP
 
+#include <cmath>
+#include <iostream>
+#include "fastmath.hpp"
+
 class Vector3D {
 public:
     float x, y, z;
@@ -44,15 +48,22 @@ public:
         return this->x * this->x + this->y * this->y + this->z * this->z;
     }
 
+    // With FAST_MATH >= 2 by the approximate inverse square root of inverseSqrtNewton
     Vector3D unit() const {
+#if FAST_MATH >= 2
+        float absSquare = this->absSquare();
+        if (absSquare < 1e-12f) { return *this; }
+        else { return *this * inverseSqrtNewton(absSquare); }
+#else
         float abs = this->abs();
         if (abs < 1e-6) { return *this; }
         else { return *this * (1 / abs); }
+#endif
     }
 
 };
 
-std::ostream &operator<<(std::ostream &out, const Vector3D &v) {
+inline std::ostream &operator<<(std::ostream &out, const Vector3D &v) {
     out << "(" << v.x << ", " << v.y << ", " << v.z << ")";
     return out;
 }
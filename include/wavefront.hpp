@@ -0,0 +1,132 @@
+#ifndef WAVEFRONT_HPP
+#define WAVEFRONT_HPP
+
+#include <iostream>
+#include <vector>
+#include "config.hpp"
+#include "vector3d.hpp"
+#include "color.hpp"
+#include "ray.hpp"
+#include "scene.hpp"
+#include "camera.hpp"
+#include "denoise.hpp"
+#include "occluder.hpp"
+
+using namespace std;
+
+// Refractive indices and opacities of the media a ray is inside of, innermost on top
+// Takes the place of the two stacks traceRayRecursive copies along, a ray enters at most one medium per bounce so
+// RECURSIVE_DEPTH entries on top of the camera medium are enough
+class MediumStack {
+    float refractiveIndices[RECURSIVE_DEPTH + 1];
+    float opacities[RECURSIVE_DEPTH + 1];
+    int count;
+
+public:
+    MediumStack(float refractiveIndex, float opacity) : count(1) {
+        refractiveIndices[0] = refractiveIndex;
+        opacities[0] = opacity;
+    }
+
+    float topRefractiveIndex() const {
+        return refractiveIndices[count - 1];
+    }
+
+    float topOpacity() const {
+        return opacities[count - 1];
+    }
+
+    void push(float refractiveIndex, float opacity) {
+        if (count < RECURSIVE_DEPTH + 1) {
+            refractiveIndices[count] = refractiveIndex;
+            opacities[count] = opacity;
+            count++;
+        }
+    }
+
+    // The camera medium is never popped
+    void pop() {
+        if (count > 1) {
+            count--;
+        }
+    }
+
+};
+
+// A ray of the wavefront renderer: everything the call stack of traceRayRecursive would hold for it
+// Its color is not returned to a caller but added, scaled by throughput (the product of the reflection and
+// transmission factors along its path, and of the sample average), straight to its pixel
+class PathRay {
+public:
+    Ray ray;
+    int pixel;
+    float throughput;
+    int depth;
+    MediumStack media;
+    // Objects the ray can hit (see primaryCandidatesOf) for camera rays, null for the others
+    const vector<int> *candidates;
+
+    // this is to easily print a given object to std for debugging
+    friend std::ostream &operator<<(std::ostream &, const PathRay &);
+
+    PathRay(const Ray &ray, int pixel, float throughput, int depth, const MediumStack &media,
+            const vector<int> *candidates = nullptr)
+            : ray(ray), pixel(pixel), throughput(throughput), depth(depth), media(media), candidates(candidates) {}
+
+};
+
+// Light to shadow test for the hit of a ray of a wave, and the weight of its terms (see sampleLights)
+class ShadowQuery {
+public:
+    int hit;
+    int light;
+    float weight;
+
+    ShadowQuery(int hit, int light, float weight) : hit(hit), light(light), weight(weight) {}
+
+};
+
+// What renderImageWavefront did, to compare it to the recursive renderer
+class WavefrontStats {
+public:
+    // Waves are the rounds of intersect, shade, shadow and secondary stages, one per bounce of each chunk of pixels
+    int waves;
+    long cameraRays, secondaryRays, shadowQueries;
+    // Reflected and transmitted rays not traced as nothing they find can show (zero throughput, e.g. transmitted
+    // through opaque objects), and total internal reflections merged into the reflected ray they duplicate
+    long skippedRays, mergedRays;
+    OccluderStats occluders;
+
+    // this is to easily print a given object to std for debugging
+    friend std::ostream &operator<<(std::ostream &, const WavefrontStats &);
+
+    WavefrontStats() : waves(0), cameraRays(0), secondaryRays(0), shadowQueries(0), skippedRays(0), mergedRays(0) {}
+
+};
+
+inline std::ostream &operator<<(std::ostream &out, const PathRay &r) {
+    out << "PathRay:" << "\t" << r.ray << "\tpixel " << r.pixel << "\tthroughput " << r.throughput << "\tdepth "
+        << r.depth;
+    return out;
+}
+
+inline std::ostream &operator<<(std::ostream &out, const WavefrontStats &s) {
+    out << "WavefrontStats:" << "\t" << s.waves << " waves\t" << s.cameraRays << " camera, " << s.secondaryRays
+        << " secondary rays\t" << s.shadowQueries << " shadow queries\tskipped " << s.skippedRays << ", merged "
+        << s.mergedRays << " rays\n" << s.occluders;
+    return out;
+}
+
+// Renders all pixels into colors breadth first instead of depth first: rays of a chunk of WAVEFRONT_CAMERA_RAYS
+// camera rays go through the stages together, one bounce at a time
+// - intersect: rays sorted by octant of their direction and along a Morton curve of their origins, then traced
+// - shade: hits sorted by object (and so by material and texture), ambient terms added and lights to test queued
+// - shadow: queries sorted by light, then shadow tested, their terms shaded in a batch (see ShadingBatch)
+// - secondary: reflected and transmitted rays of the hits make up the next wave
+// Gives the image of renderImage (up to rounding of the order colors are summed in), except where random numbers
+// are used (depth of field, area lights, soft shadows, light sampling), which are drawn in a different order
+// If guides are given, what camera rays hit (the first wave) is recorded in them for denoiseImage
+WavefrontStats renderImageWavefront(const Scene &scene, const Camera &camera, vector<vector<Color> > &colors,
+                                    DenoiseGuides *guides = nullptr);
+
+#endif
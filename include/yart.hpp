@@ -0,0 +1,63 @@
+#ifndef YART_HPP
+#define YART_HPP
+
+// Library interface of the ray tracer: load a scene once, render it any number of times (also at once, from
+// several threads) with per call options into a framebuffer owned by the caller
+
+#include <memory>
+#include <string>
+#include "render.hpp"
+
+using namespace std;
+
+// Options of a single render, values left at their defaults fall back to what the scene file says
+class RenderOptions {
+public:
+    // Image size in pixels, scene's imsize if 0
+    int width, height;
+    // Camera placement and vertical field of view in degrees, used instead of the scene's if overrideCamera is set
+    // viewDir and upDir must be unit vectors
+    bool overrideCamera;
+    Vector3D eye, viewDir, upDir;
+    float vFovDeg;
+    // Camera rays per pixel and how far their origins are jittered, as set up by the scene's viewdist if 0 / negative
+    int samplesPerPixel;
+    float rayJitter;
+    // Region [x0, x1) x [y0, y1) of the image to render, whole image if empty
+    int x0, y0, x1, y1;
+    // If set, framebuffer holds only the region (x1 - x0 pixels per row) instead of the whole image
+    bool regionFramebuffer;
+    // Threads splitting the region between them, one per core if 0
+    int threads;
+    // Random numbers (depth of field, soft shadows) are seeded by this and the tile, so equal options give equal images
+    unsigned seed;
+
+    // this is to easily print a given object to std for debugging
+    friend std::ostream &operator<<(std::ostream &, const RenderOptions &);
+
+    RenderOptions() : width(0), height(0), overrideCamera(false), vFovDeg(0), samplesPerPixel(0), rayJitter(-1),
+                      x0(0), y0(0), x1(0), y1(0), regionFramebuffer(false), threads(0), seed(42) {}
+
+};
+
+inline std::ostream &operator<<(std::ostream &out, const RenderOptions &o) {
+    out << "RenderOptions:" << "\t" << o.width << "x" << o.height << "\t";
+    if (o.overrideCamera) {
+        out << o.eye << "\t" << o.viewDir << "\t" << o.upDir << "\t" << o.vFovDeg << "\t";
+    }
+    out << o.samplesPerPixel << " spp\t(" << o.x0 << ", " << o.y0 << ") - (" << o.x1 << ", " << o.y1 << ")";
+    return out;
+}
+
+// Parses scene file, returns null (after printing an error message) if it is invalid
+// Textures are decoded through textureCache if one is given, so scenes sharing textures decode them once
+unique_ptr<Scene> loadScene(const string &filename, TextureCache *textureCache = nullptr);
+
+// Renders scene into framebuffer, which holds width x height pixels (or only the region's, see regionFramebuffer) row
+// by row, 3 floats (r, g, b) each
+// Only pixels of the region are written, colors are not clamped
+// Scene is only read, so renders of one scene can run concurrently (each with its own framebuffer)
+// Returns false (and writes nothing) if options are invalid
+bool render(const Scene &scene, const RenderOptions &options, float *framebuffer);
+
+#endif
@@ -0,0 +1,195 @@
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <emmintrin.h>
+#include "denoise.hpp"
+
+using namespace std;
+
+// Albedos below this are not divided out of colors, as that would blow their noise up
+#define DENOISE_MIN_ALBEDO 1e-3f
+
+// 1D B3 spline kernel, the 5x5 kernel is its outer product
+static const float kernel[5] = {1.0f / 16, 1.0f / 4, 3.0f / 8, 1.0f / 4, 1.0f / 16};
+
+// e^-x of 4 lanes of x >= 0, as 2^y for y = -x log2(e): 2^floor(y) built in the exponent bits, times a polynomial of
+// 2^(y - floor(y)) (Cephes exp2f)
+// Relative error below 2e-7, lanes beyond 80 give e^-80
+static inline __m128 expNegative(__m128 x) {
+    __m128 y = _mm_mul_ps(_mm_min_ps(_mm_max_ps(x, _mm_setzero_ps()), _mm_set1_ps(80.0f)),
+                          _mm_set1_ps(-1.44269504f));
+    // floor(y): truncation rounds negative y up, so 1 is taken off where it did
+    __m128 whole = _mm_cvtepi32_ps(_mm_cvttps_epi32(y));
+    whole = _mm_sub_ps(whole, _mm_and_ps(_mm_cmpgt_ps(whole, y), _mm_set1_ps(1.0f)));
+    __m128 f = _mm_sub_ps(y, whole);
+    __m128 p = _mm_set1_ps(1.535336188319500e-4f);
+    p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(1.339887440266574e-3f));
+    p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(9.618437357674640e-3f));
+    p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(5.550332471162809e-2f));
+    p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(2.402264791363012e-1f));
+    p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(6.931472028550421e-1f));
+    p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(1.0f));
+    __m128i exponent = _mm_slli_epi32(_mm_add_epi32(_mm_cvttps_epi32(whole), _mm_set1_epi32(127)), 23);
+    return _mm_mul_ps(p, _mm_castsi128_ps(exponent));
+}
+
+// Colors of every pixel, in planes row by row like the guides
+struct ColorPlanes {
+    vector<float> r, g, b;
+
+    explicit ColorPlanes(size_t size) : r(size), g(size), b(size) {}
+};
+
+// Everything a pass reads: guides, colors and the edge stopping terms of its step
+struct DenoisePass {
+    const DenoiseGuides &guides;
+    const ColorPlanes &in;
+    ColorPlanes &out;
+    int step;
+    // 1 / sigma^2 of colors and normals, 1 / sigma of relative distances
+    float colorFactor, normalFactor, depthFactor;
+};
+
+// Filters pixel p = (i, j) with taps clamped to the image, one pixel at a time
+static void filterPixel(const DenoisePass &pass, int i, int j) {
+    const DenoiseGuides &g = pass.guides;
+    const ColorPlanes &in = pass.in;
+    int p = j * g.width + i;
+    float sum = 0, r = 0, gg = 0, b = 0;
+    for (int dy = -2; dy <= 2; ++dy) {
+        int y = j + dy * pass.step;
+        if (y < 0 || y >= g.height) {
+            continue;
+        }
+        for (int dx = -2; dx <= 2; ++dx) {
+            int x = i + dx * pass.step;
+            if (x < 0 || x >= g.width) {
+                continue;
+            }
+            int q = y * g.width + x;
+            float dr = in.r[q] - in.r[p], dg = in.g[q] - in.g[p], db = in.b[q] - in.b[p];
+            float nx = g.normalX[q] - g.normalX[p], ny = g.normalY[q] - g.normalY[p];
+            float nz = g.normalZ[q] - g.normalZ[p];
+            float dz = fabs(g.depth[q] - g.depth[p]);
+            float exponent = (dr * dr + dg * dg + db * db) * pass.colorFactor +
+                             (nx * nx + ny * ny + nz * nz) * pass.normalFactor +
+                             dz * pass.depthFactor / (max(g.depth[p], g.depth[q]) + 1e-6f);
+            float w = kernel[dx + 2] * kernel[dy + 2] * _mm_cvtss_f32(expNegative(_mm_set_ss(exponent)));
+            sum += w;
+            r += w * in.r[q];
+            gg += w * in.g[q];
+            b += w * in.b[q];
+        }
+    }
+    // The center tap has weight e^0, so sum is never 0
+    pass.out.r[p] = r / sum;
+    pass.out.g[p] = gg / sum;
+    pass.out.b[p] = b / sum;
+}
+
+// Filters pixels p to p + 3 of a row, all of whose taps are in the image
+static void filterPixels4(const DenoisePass &pass, int p) {
+    const DenoiseGuides &g = pass.guides;
+    const ColorPlanes &in = pass.in;
+    __m128 pr = _mm_loadu_ps(&in.r[p]), pg = _mm_loadu_ps(&in.g[p]), pb = _mm_loadu_ps(&in.b[p]);
+    __m128 pnx = _mm_loadu_ps(&g.normalX[p]), pny = _mm_loadu_ps(&g.normalY[p]);
+    __m128 pnz = _mm_loadu_ps(&g.normalZ[p]), pz = _mm_loadu_ps(&g.depth[p]);
+    __m128 colorFactor = _mm_set1_ps(pass.colorFactor), normalFactor = _mm_set1_ps(pass.normalFactor);
+    __m128 depthFactor = _mm_set1_ps(pass.depthFactor);
+    __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+    __m128 sum = _mm_setzero_ps(), r = _mm_setzero_ps(), gg = _mm_setzero_ps(), b = _mm_setzero_ps();
+    for (int dy = -2; dy <= 2; ++dy) {
+        for (int dx = -2; dx <= 2; ++dx) {
+            int q = p + (dy * g.width + dx) * pass.step;
+            __m128 qr = _mm_loadu_ps(&in.r[q]), qg = _mm_loadu_ps(&in.g[q]), qb = _mm_loadu_ps(&in.b[q]);
+            __m128 qz = _mm_loadu_ps(&g.depth[q]);
+            __m128 dr = _mm_sub_ps(qr, pr), dg = _mm_sub_ps(qg, pg), db = _mm_sub_ps(qb, pb);
+            __m128 nx = _mm_sub_ps(_mm_loadu_ps(&g.normalX[q]), pnx);
+            __m128 ny = _mm_sub_ps(_mm_loadu_ps(&g.normalY[q]), pny);
+            __m128 nz = _mm_sub_ps(_mm_loadu_ps(&g.normalZ[q]), pnz);
+            __m128 colorDistance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dr, dr), _mm_mul_ps(dg, dg)), _mm_mul_ps(db, db));
+            __m128 normalDistance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, nx), _mm_mul_ps(ny, ny)),
+                                               _mm_mul_ps(nz, nz));
+            __m128 dz = _mm_and_ps(_mm_sub_ps(qz, pz), absMask);
+            __m128 depthScale = _mm_add_ps(_mm_max_ps(pz, qz), _mm_set1_ps(1e-6f));
+            __m128 exponent = _mm_add_ps(_mm_add_ps(_mm_mul_ps(colorDistance, colorFactor),
+                                                    _mm_mul_ps(normalDistance, normalFactor)),
+                                         _mm_div_ps(_mm_mul_ps(dz, depthFactor), depthScale));
+            __m128 w = _mm_mul_ps(_mm_set1_ps(kernel[dx + 2] * kernel[dy + 2]), expNegative(exponent));
+            sum = _mm_add_ps(sum, w);
+            r = _mm_add_ps(r, _mm_mul_ps(w, qr));
+            gg = _mm_add_ps(gg, _mm_mul_ps(w, qg));
+            b = _mm_add_ps(b, _mm_mul_ps(w, qb));
+        }
+    }
+    _mm_storeu_ps(&pass.out.r[p], _mm_div_ps(r, sum));
+    _mm_storeu_ps(&pass.out.g[p], _mm_div_ps(gg, sum));
+    _mm_storeu_ps(&pass.out.b[p], _mm_div_ps(b, sum));
+}
+
+// Filters row j: 4 pixels at a time where all their taps are in the image, pixel by pixel near its sides
+static void filterRow(const DenoisePass &pass, int j) {
+    const DenoiseGuides &g = pass.guides;
+    int reach = 2 * pass.step;
+    int i = 0;
+    if (j >= reach && j < g.height - reach) {
+        for (; i < reach; ++i) {
+            filterPixel(pass, i, j);
+        }
+        for (; i + 4 <= g.width - reach; i += 4) {
+            filterPixels4(pass, j * g.width + i);
+        }
+    }
+    for (; i < g.width; ++i) {
+        filterPixel(pass, i, j);
+    }
+}
+
+void denoiseImage(const DenoiseGuides &guides, vector<vector<Color> > &colors, int threads) {
+    int width = guides.width, height = guides.height;
+    size_t size = (size_t) width * height;
+    ColorPlanes planes(size), filtered(size);
+    // Demodulate: filter lighting, not texture
+    auto divisorOf = [](float albedo) { return albedo > DENOISE_MIN_ALBEDO ? albedo : 1; };
+    for (int j = 0; j < height; ++j) {
+        for (int i = 0; i < width; ++i) {
+            size_t p = (size_t) j * width + i;
+            planes.r[p] = colors[i][j].getR() / divisorOf(guides.albedoR[p]);
+            planes.g[p] = colors[i][j].getG() / divisorOf(guides.albedoG[p]);
+            planes.b[p] = colors[i][j].getB() / divisorOf(guides.albedoB[p]);
+        }
+    }
+
+    threads = threads > 0 ? threads : max(1u, thread::hardware_concurrency());
+    threads = min(threads, height);
+    float colorSigma = DENOISE_COLOR_SIGMA;
+    for (int iteration = 0; iteration < DENOISE_ITERATIONS; ++iteration) {
+        // Colors get smoother pass by pass, so colors are told apart more finely
+        DenoisePass pass = {guides, planes, filtered, 1 << iteration, 1 / (colorSigma * colorSigma),
+                            1.0f / (DENOISE_NORMAL_SIGMA * DENOISE_NORMAL_SIGMA), 1.0f / DENOISE_DEPTH_SIGMA};
+        atomic<int> nextRow(0);
+        auto work = [&pass, &nextRow, height]() {
+            for (int j = nextRow++; j < height; j = nextRow++) {
+                filterRow(pass, j);
+            }
+        };
+        vector<thread> workers;
+        for (int t = 1; t < threads; ++t) {
+            workers.emplace_back(work);
+        }
+        work();
+        for (auto &worker : workers) {
+            worker.join();
+        }
+        swap(planes, filtered);
+        colorSigma /= 2;
+    }
+
+    for (int j = 0; j < height; ++j) {
+        for (int i = 0; i < width; ++i) {
+            size_t p = (size_t) j * width + i;
+            colors[i][j] = Color(planes.r[p] * divisorOf(guides.albedoR[p]), planes.g[p] * divisorOf(guides.albedoG[p]),
+                                 planes.b[p] * divisorOf(guides.albedoB[p]));
+        }
+    }
+}
@@ -1,456 +1,897 @@
 #include <iostream>
-#include <stack>
 #include <fstream>
 #include <algorithm>
 #include <cmath>
-#include <utility>
-#include "vector3d.hpp"
-#include "color.hpp"
-#include "ray.hpp"
-#include "sphere.hpp"
-#include "triangle.hpp"
-#include "scene.hpp"
-#include "intersections.hpp"
-#include "texture.hpp"
+#include <memory>
+#include <thread>
+#include <chrono>
+#include <ctime>
+#include <future>
+#include <deque>
+#include <mutex>
+#include <csignal>
+#include <cstring>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/wait.h>
+#include "render.hpp"
+#include "bounds.hpp"
+#include "scenediff.hpp"
+#include "animation.hpp"
+#include "yart.hpp"
+#include "jobqueue.hpp"
+#include "scenecache.hpp"
+#include "renderjob.hpp"
+#include "checkpoint.hpp"
+#include "reorder.hpp"
+#include "wavefront.hpp"
 
 using namespace std;
 
-#ifndef M_PI
-#define M_PI 3.1415926535
-#endif
-
-#define SHADOW_GRACE 1e-4
-#define RECURSIVE_RAY_GRACE 1e-3
-#define CAMERA_MEDIUM_REFRACTIVE_INDEX 1
-#define CAMERA_MEDIUM_OPACITY 0
-#define RECURSIVE_DEPTH 6
-#define SOFT_SHADOW_JITTER 0
-#define NUM_SHADOW_RAYS_PER_POI 1
-#define NUM_DISTRIBUTED_RAYS 10
-#define DISTRIBUTED_RAYS_JITTER 5e-2
-
-// Returns global index of object the ray first hits (in front of the origin) and corresponding T parameter of the hit
-// If ray does not hit any object both index and T parameter are returned -1
-pair<int, float> traceRay(const Ray &ray, const Scene &scene, float grace = 0) {
-    vector<float> Ts;
-    // Inspect intersection with all spheres
-    for (const auto &sphere : scene.spheres) {
-        float t = smallestNonNegativeT(ray, sphere, grace);
-        Ts.push_back(t);
-    }
-    // Inspect intersection with all triangles
-    for (const auto &triangle : scene.triangles) {
-        float t = smallestNonNegativeT(ray, triangle, grace);
-        Ts.push_back(t);
-    }
-    // Find smallest non-negative t
-    int minTIndex = indexOfSmallestNonNegativeElement(Ts);
-
-    return {minTIndex, minTIndex < 0 ? -1 : Ts[minTIndex]};
+// Returns name of output image next to the scene file, e.g. (scene.txt, _0001) -> scene_0001.ppm
+string outputFilenameFor(const string &filename, const string &suffix = "") {
+    string outputFileString(filename);
+    int len = outputFileString.size();
+    outputFileString.replace(len - 3, 3, "ppm");
+    outputFileString.insert(len - 4, suffix);
+    return outputFileString;
 }
 
-// Given point of intersection, unit direction to light source, light and scene
-// Calculates if there is a shadow cast on point of intersection by the light source
-// By casting a shadow ray from poi in unit direction to light source
-float shadowFactor(const Vector3D &poi, const Vector3D &Li, const Light &light, const Scene &scene) {
-    float S = 1;
-    Ray shadowRay(poi, Li);
-    pair<int, float> shadow_minTIndex_minT = traceRay(shadowRay, scene, SHADOW_GRACE);
-    // Shadow ray hit something
-    if (shadow_minTIndex_minT.first >= 0) {
-        if (light.type == 0) {
-            // Directional light => Shadow exists
-            S = 0;
-        } else {
-            // Positional light => Check for distance of hit
-            Vector3D hitPoint = shadowRay.pointAt(shadow_minTIndex_minT.second);
-            Vector3D hitVector = hitPoint - poi;
-            Vector3D lightVector = light.vector - poi;
-            if (hitVector.absSquare() < lightVector.absSquare()) {
-                S = 0;
-            }
+// Writes pixel array as PPM image
+void writeImage(const string &outputFileString, int width, int height, const vector<vector<Color> > &colors) {
+    // Creating PPM image
+    ofstream outputFile;
+    outputFile.open(outputFileString);
+
+    // Filling in the header
+    outputFile << "P3" << endl << "# image autogenerated using a simple ray tracer" << endl;
+    outputFile << width << " " << height << endl;
+    outputFile << 255 << endl;
+
+    // Filling in the body
+    for (int j = 0; j < height; ++j) {
+        for (int i = 0; i < width; ++i) {
+            // Write the R G B values of a pixel in seperate line
+            outputFile << colors[i][j].to8BitScale() << endl;
         }
     }
-    return S;
+
+    // Closing the output stream
+    outputFile.close();
 }
 
-// Given point of intersection, unit direction to light source, light and scene
-// Foreach point of intersection by ray from poi to light source decreases shadow factor
-float shadowFactorSubtractive(const Vector3D &poi, const Vector3D &Li, const Light &light, const Scene &scene) {
-    float S = 1;
-    Ray shadowRay(poi, Li);
-    if (light.type == 0) {
-        // Directional light => Shadow exists
-        // Inspect intersection with all spheres
-        for (const auto &sphere : scene.spheres) {
-            float t = smallestNonNegativeT(shadowRay, sphere, SHADOW_GRACE);
-            if (t > -1) {
-                S = S * (1 - sphere.materialColor.opacity);
-            }
+// Returns wall clock seconds elapsed since start
+float secondsSince(const chrono::steady_clock::time_point &start) {
+    return chrono::duration<float>(chrono::steady_clock::now() - start).count();
+}
+
+// Watch mode: stays resident, and every time the scene file changes re-parses it
+// And re-renders only the tiles whose rays could have been affected by the change
+int watch(const string &filename) {
+    TextureCache textureCache;
+    unique_ptr<Scene> scene(new Scene(filename));
+    scene->textureCache = &textureCache;
+    FileStamp lastModified(filename);
+    if (!scene->parse()) {
+        return -1;
+    }
+
+    vector<vector<Color> > colors = blankImage(scene->imWidth, scene->imHeight);
+    vector<Tile> tiles;
+    vector<TileFootprint> footprints;
+    SceneDiff diff;
+    diff.needsFullRender = true;
+    while (true) {
+        // Re-render affected tiles, recording what their rays touch in the new scene
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        if (diff.needsFullRender) {
+            colors = blankImage(scene->imWidth, scene->imHeight);
+            tiles = tilesOf(scene->imWidth, scene->imHeight, TILE_SIZE);
+            footprints.assign(tiles.size(), TileFootprint());
         }
-        // Inspect intersection with all triangles
-        for (const auto &triangle : scene.triangles) {
-            float t = smallestNonNegativeT(shadowRay, triangle, SHADOW_GRACE);
-            if (t > -1) {
-                S = S * (1 - triangle.materialColor.opacity);
+        Camera camera(*scene);
+        // Rays are recorded within scene box grown a bit, so that objects moving a little keep edits incremental
+        Bounds sceneBounds = sceneBoundsOf(*scene);
+        sceneBounds = sceneBounds.padded((sceneBounds.max - sceneBounds.min).abs() * WATCH_BOUNDS_MARGIN);
+        vector<vector<int> > candidates = primaryCandidatesOf(*scene, camera, scene->imWidth, scene->imHeight, tiles,
+                                                              TILE_SIZE);
+        int rendered = 0;
+        for (size_t k = 0; k < tiles.size(); ++k) {
+            if (!diff.affects(footprints[k])) {
+                continue;
             }
+            footprints[k] = TileFootprint(sceneBounds);
+            renderTile(*scene, camera, tiles[k], colors, &footprints[k], &candidates[k]);
+            rendered++;
+            printf("Rendering: %d%% complete\r", (int) ((float) (k + 1) * 100 / tiles.size()));
+            fflush(stdout);
         }
-    } else {
-        // Positional light => Check for distance of hit
-        // Inspect intersection with all spheres
-        for (const auto &sphere : scene.spheres) {
-            float t = smallestNonNegativeT(shadowRay, sphere, SHADOW_GRACE);
-            if (t > -1) {
-                Vector3D hitPoint = shadowRay.pointAt(t);
-                Vector3D hitVector = hitPoint - poi;
-                Vector3D lightVector = light.vector - poi;
-                if (hitVector.absSquare() < lightVector.absSquare()) {
-                    S = S * (1 - sphere.materialColor.opacity);
-                }
+        writeImage(outputFilenameFor(filename), scene->imWidth, scene->imHeight, colors);
+        cout << "Rendered " << rendered << " of " << tiles.size() << " tiles in "
+             << secondsSince(start) << " s. Watching \"" << filename << "\" for changes."
+             << endl;
+
+        // Wait for the next successfully parsed version of the scene file
+        while (true) {
+            this_thread::sleep_for(chrono::milliseconds(WATCH_POLL_INTERVAL_MS));
+            FileStamp modified(filename);
+            if (modified == lastModified) {
+                continue;
             }
-        }
-        // Inspect intersection with all triangles
-        for (const auto &triangle : scene.triangles) {
-            float t = smallestNonNegativeT(shadowRay, triangle, SHADOW_GRACE);
-            if (t > -1) {
-                Vector3D hitPoint = shadowRay.pointAt(t);
-                Vector3D hitVector = hitPoint - poi;
-                Vector3D lightVector = light.vector - poi;
-                if (hitVector.absSquare() < lightVector.absSquare()) {
-                    S = S * (1 - triangle.materialColor.opacity);
+            lastModified = modified;
+            int decodes = textureCache.decodes;
+            unique_ptr<Scene> next(new Scene(filename));
+            next->textureCache = &textureCache;
+            if (!next->parse()) {
+                cerr << "Keeping last rendered image." << endl;
+                continue;
+            }
+            diff = diffScenes(*scene, *next, textureCache.decodes != decodes);
+            // Objects are referred by global index, which shifts for triangles if the number of spheres changes
+            int shift = (int) next->spheres.size() - (int) scene->spheres.size();
+            if (shift != 0 && !diff.needsFullRender) {
+                for (size_t k = 0; k < tiles.size(); ++k) {
+                    if (!diff.affects(footprints[k])) {
+                        footprints[k].shiftObjects(scene->spheres.size(), shift);
+                    }
                 }
             }
+            scene = move(next);
+            break;
         }
     }
-    return S;
 }
 
-// Given ray, scene and intersecting object and point
-// returns appropriate color to fill in the corresponding pixel of output image
-Color phongColorForSphere(const Ray &ray, const Scene &scene, const Sphere &sphere, const Vector3D &poi) {
-    // Blinn-phong illumination model
-    // I = Od * ka + Sum over lights [Si * Ilight (Od * kd * (N.L) + Os * ks * (N.H)^n)]
-    // Intersection with a sphere
-    MaterialColor color = sphere.materialColor;
-    Vector3D N = (poi - sphere.center).unit();
-    Vector3D V = (scene.eye - poi).unit();
-    Color diffusion;
-    // Diffusion color based on texture
-    if (sphere.renderType == TEXTURE_LESS) {
-        diffusion = color.diffusion;
-    } else {
-        float phi = acos(N.y);
-        float theta = atan2(N.x, N.z);
-        TextureCoordinates textureCoordinates((theta + M_PI) / (2 * M_PI), phi / M_PI);
-        diffusion = scene.textures[sphere.textureIndex].colorAt(textureCoordinates);
-    }
-    // First term of blinn-phong model
-    Color phongColor = diffusion * color.ka;
-    for (auto &light: scene.lights) {
-        // Shadow factor determination
-        float S = 0;
-        for (int j = 0; j < NUM_SHADOW_RAYS_PER_POI; j++) {
-            Vector3D Lj = light.poiToLightUnitVector(poi, SOFT_SHADOW_JITTER);
-            S += shadowFactorSubtractive(poi, Lj, light, scene);
+// Animation mode: renders every frame of a track applied to a base scene, into scene_0000.ppm, scene_0001.ppm, ...
+// Scene and textures are parsed once; per frame only animated objects move and the hierarchy over them is refit
+// Frame N + 1 is set up and frame N - 1 is written while frame N renders
+int animate(const string &filename, const string &trackFilename) {
+    Scene base(filename);
+    if (!base.parse()) {
+        return -1;
+    }
+    AnimationTrack track(trackFilename);
+    if (!track.parse(base)) {
+        return -1;
+    }
+    cout << track << endl;
+
+    // Two frames are in flight at a time, one rendering and one being set up
+    Scene frameScenes[2] = {base, base};
+    base.textures.clear();
+    float builtCost[2] = {base.bvh.cost(), base.bvh.cost()};
+    auto setUpFrame = [&](int frame) {
+        Scene &scene = frameScenes[frame % 2];
+        track.apply(frame, base, scene);
+        if (track.objectTracks.empty()) {
+            return;
         }
-        S = S / NUM_SHADOW_RAYS_PER_POI;
+        scene.bvh.refit(scene.spheres, scene.triangles, scene.instances);
+        // A refit hierarchy degrades as objects move apart, rebuild once it got too costly
+        if (scene.bvh.cost() > builtCost[frame % 2] * BVH_REFIT_MAX_COST_GROWTH) {
+            scene.bvh.build(scene.spheres, scene.triangles, scene.instances);
+            builtCost[frame % 2] = scene.bvh.cost();
+        }
+    };
 
-        // Second and third terms of blinn-phong model
-        Vector3D Li = light.poiToLightUnitVector(poi);
-        Vector3D Hi = (Li + V).unit();
-        Color secondTerm = diffusion * color.kd * max(0.0, (double) N.dot(Li));
-        Color thirdTerm = color.specular * color.ks * pow(max(0.0, (double) N.dot(Hi)), color.n);
-        Color weightedTerm = (secondTerm + thirdTerm) * light.color * S;
-        phongColor = phongColor + weightedTerm;
+    future<void> setUp = async(launch::async, setUpFrame, 0);
+    future<void> written = async(launch::async, [] {});
+    for (int frame = 0; frame < track.frames; frame++) {
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        setUp.get();
+        if (frame + 1 < track.frames) {
+            setUp = async(launch::async, setUpFrame, frame + 1);
+        }
+        const Scene &scene = frameScenes[frame % 2];
+        vector<vector<Color> > colors = blankImage(scene.imWidth, scene.imHeight);
+        // Every frame renders as a separate run on the same scene would
+        seedRand(42);
+        renderImage(scene, Camera(scene), colors);
+        written.get();
+        char suffix[16];
+        snprintf(suffix, sizeof(suffix), "_%04d", frame);
+        written = async(launch::async, writeImage, outputFilenameFor(filename, suffix), scene.imWidth,
+                        scene.imHeight, move(colors));
+        cout << "Frame " << frame + 1 << " of " << track.frames << " rendered in "
+             << secondsSince(start) << " s." << endl;
     }
+    written.get();
+    return 0;
+}
+
+// Counters of the render server, shared by its threads
+class ServerStats {
+public:
+    mutex lock;
+    int completed, failed, rejected;
+    float totalSeconds, maxSeconds;
 
-    return phongColor;
+    ServerStats() : completed(0), failed(0), rejected(0), totalSeconds(0), maxSeconds(0) {}
+
+    void addCompleted(float seconds) {
+        lock_guard<mutex> guard(lock);
+        completed++;
+        totalSeconds += seconds;
+        maxSeconds = max(maxSeconds, seconds);
+    }
+};
+
+// Renders a queued job and answers its client with the image (or where it was written) and the job's latencies
+void runJob(RenderJob &job, SceneCache &cache, ServerStats &stats) {
+    chrono::steady_clock::time_point started = chrono::steady_clock::now();
+    float queueSeconds = chrono::duration<float>(started - job.received).count();
+    bool hit;
+    shared_ptr<const Scene> scene = cache.get(job.sceneName, job.sceneText, hit);
+    float loadSeconds = secondsSince(started);
+    if (scene == nullptr) {
+        job.connection->writeAll("error scene is invalid\n");
+        lock_guard<mutex> guard(stats.lock);
+        stats.failed++;
+        return;
+    }
+
+    chrono::steady_clock::time_point renderStart = chrono::steady_clock::now();
+    RenderOptions options = job.options;
+    if (options.threads <= 0) {
+        options.threads = max(1, (int) thread::hardware_concurrency() / SERVER_WORKERS);
+    }
+    int width = options.width > 0 ? options.width : scene->imWidth;
+    int height = options.height > 0 ? options.height : scene->imHeight;
+    vector<float> framebuffer(3 * (size_t) width * height);
+    if (!render(*scene, options, framebuffer.data())) {
+        job.connection->writeAll("error render options are invalid\n");
+        lock_guard<mutex> guard(stats.lock);
+        stats.failed++;
+        return;
+    }
+    float renderSeconds = secondsSince(renderStart);
+
+    string image = binaryPPMOf(width, height, framebuffer);
+    if (!job.outputFilename.empty()) {
+        ofstream output(job.outputFilename.c_str(), ios::binary);
+        if (!(output << image)) {
+            job.connection->writeAll("error output file could not be written\n");
+            lock_guard<mutex> guard(stats.lock);
+            stats.failed++;
+            return;
+        }
+    }
+    float totalSeconds = secondsSince(job.received);
+    ostringstream metrics;
+    metrics << width << " " << height << " cache=" << (hit ? "hit" : "miss") << " queue_ms=" << queueSeconds * 1000
+            << " load_ms=" << loadSeconds * 1000 << " render_ms=" << renderSeconds * 1000
+            << " total_ms=" << totalSeconds * 1000;
+    if (job.outputFilename.empty()) {
+        job.connection->writeAll("ok " + metrics.str() + " image=" + to_string(image.size()) + "\n" + image);
+    } else {
+        job.connection->writeAll("ok " + metrics.str() + " written=" + job.outputFilename + "\n");
+    }
+    stats.addCompleted(totalSeconds);
+    // Whole line at once, so that lines of concurrent jobs do not interleave
+    cout << job.sceneName + " " + metrics.str() + "\n" << flush;
 }
 
-// Given ray, scene and intersecting object and point
-// returns appropriate color to fill in the corresponding pixel of output image
-Color phongColorForTriangle(const Ray &ray, const Scene &scene, const Triangle &triangle, const Vector3D &poi) {
-    // Blinn-phong illumination model
-    // I = Od * ka + Sum over lights [Si * Ilight (Od * kd * (N.L) + Os * ks * (N.H)^n)]
-    // Intersection with an Triangle
-    MaterialColor color = triangle.materialColor;
-    Vector3D V = (scene.eye - poi).unit();
-    Vector3D N;
-    Color diffusion;
-    // Diffusion color and normal based on texture and smoothness
-    if (triangle.renderType == FLAT_TEXTURE_LESS) {
-        N = triangle.surfaceNormal.unit();
-        diffusion = color.diffusion;
-    } else if (triangle.renderType == FLAT_TEXTURED) {
-        N = triangle.surfaceNormal.unit();
-        TextureCoordinates textureCoordinates = triangle.getInterpolatedTextureCoordinates(poi);
-        diffusion = scene.textures[triangle.textureIndex].colorAt(textureCoordinates);
-    } else if (triangle.renderType == SMOOTH_TEXTURE_LESS) {
-        N = triangle.getInterpolatedNormal(poi);
-        diffusion = color.diffusion;
-    } else if (triangle.renderType == SMOOTH_TEXTURED) {
-        N = triangle.getInterpolatedNormal(poi);
-        TextureCoordinates textureCoordinates = triangle.getInterpolatedTextureCoordinates(poi);
-        diffusion = scene.textures[triangle.textureIndex].colorAt(textureCoordinates);
-    }
-    // First term of blinn-phong model
-    Color phongColor = diffusion * color.ka;
-    for (auto &light: scene.lights) {
-        // Shadow factor determination
-        float S = 0;
-        for (int j = 0; j < NUM_SHADOW_RAYS_PER_POI; j++) {
-            Vector3D Lj = light.poiToLightUnitVector(poi, SOFT_SHADOW_JITTER);
-            S += shadowFactorSubtractive(poi, Lj, light, scene);
+// Server mode: listens on a unix domain socket and renders jobs sent to it (see README for the protocol)
+// Parsed scenes are kept across jobs, so that a job for an already seen scene only pays for rendering
+// Jobs wait in a bounded queue for one of SERVER_WORKERS workers, a job that does not fit is refused as busy
+// With a positive bakeResolution, lightmaps of scenes are baked as they are parsed, see SceneCache
+int serve(const string &socketPath, int bakeResolution) {
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (socketPath.size() >= sizeof(address.sun_path)) {
+        cerr << "Socket path \"" << socketPath << "\" is too long" << endl;
+        return -1;
+    }
+    strcpy(address.sun_path, socketPath.c_str());
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(socketPath.c_str());
+    if (listener < 0 || bind(listener, (sockaddr *) &address, sizeof(address)) != 0 ||
+        listen(listener, SERVER_QUEUE_SIZE) != 0) {
+        cerr << "Could not listen on socket \"" << socketPath << "\": " << strerror(errno) << endl;
+        return -1;
+    }
+    signal(SIGPIPE, SIG_IGN);
+    cout << "Listening on \"" << socketPath << "\"" << endl;
+
+    SceneCache cache(SERVER_SCENE_CACHE_SIZE, bakeResolution);
+    JobQueue<unique_ptr<RenderJob> > queue(SERVER_QUEUE_SIZE);
+    ServerStats stats;
+    vector<thread> workers;
+    for (int k = 0; k < SERVER_WORKERS; k++) {
+        workers.emplace_back([&]() {
+            unique_ptr<RenderJob> job;
+            while (queue.pop(job)) {
+                runJob(*job, cache, stats);
+                job.reset();
+            }
+        });
+    }
+
+    while (true) {
+        int fd = accept(listener, nullptr, nullptr);
+        if (fd < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            cerr << "Could not accept connection: " << strerror(errno) << endl;
+            break;
+        }
+        // A client that stops sending mid-request can not hold up the server for long
+        timeval timeout = {SERVER_READ_TIMEOUT_S, 0};
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        unique_ptr<RenderJob> job(new RenderJob(fd));
+        string error;
+        if (!job->read(SERVER_MAX_SCENE_BYTES, error)) {
+            job->connection->writeAll("error " + error + "\n");
+        } else if (job->isStats) {
+            lock_guard<mutex> guard(stats.lock);
+            ostringstream oss;
+            oss << "ok completed=" << stats.completed << " failed=" << stats.failed << " rejected=" << stats.rejected
+                << " queued=" << queue.size() << " cached=" << cache.size() << " hits=" << cache.hits
+                << " misses=" << cache.misses << " mean_ms="
+                << (stats.completed > 0 ? stats.totalSeconds * 1000 / stats.completed : 0)
+                << " max_ms=" << stats.maxSeconds * 1000 << "\n";
+            job->connection->writeAll(oss.str());
+        } else if (!queue.tryPush(job)) {
+            job->connection->writeAll("busy\n");
+            lock_guard<mutex> guard(stats.lock);
+            stats.rejected++;
         }
-        S = S / NUM_SHADOW_RAYS_PER_POI;
+    }
+    queue.close();
+    for (auto &worker : workers) {
+        worker.join();
+    }
+    close(listener);
+    return -1;
+}
 
-        // Second and third terms of blinn-phong model
-        Vector3D Li = light.poiToLightUnitVector(poi);
-        Vector3D Hi = (Li + V).unit();
-        Color secondTerm = diffusion * color.kd * max(0.0, (double) N.dot(Li));
-        Color thirdTerm = color.specular * color.ks * pow(max(0.0, (double) N.dot(Hi)), color.n);
-        Color weightedTerm = (secondTerm + thirdTerm) * light.color * S;
-        phongColor = phongColor + weightedTerm;
+// Stream mode: renders the image a band of TILE_SIZE rows at a time, and appends each band to a binary PPM image as
+// soon as it is done (while the next one renders), so that memory holds a couple of bands instead of the whole image
+// Every CHECKPOINT_INTERVAL_S seconds the rows written so far are flushed to disk and recorded in a checkpoint file, from
+// which a resumed render (that truncates the image to them) goes on
+int stream(const string &filename, bool resume, bool reorder) {
+    unique_ptr<Scene> scene = loadScene(filename);
+    if (!scene) {
+        return -1;
+    }
+    if (reorder) {
+        cout << reorderScene(*scene) << endl;
+    }
+    int width = scene->imWidth, height = scene->imHeight;
+    RenderOptions options;
+    options.x1 = width;
+    options.regionFramebuffer = true;
+
+    // Image depends on scene text (textures are assumed unchanged), on the object order, and on tiling and seed through
+    // the random numbers
+    ifstream sceneFile(filename.c_str(), ios::binary);
+    string sceneText((istreambuf_iterator<char>(sceneFile)), istreambuf_iterator<char>());
+    int tileSize = TILE_SIZE;
+    uint64_t hash = fnv1a(sceneText.data(), sceneText.size());
+    hash = fnv1a(&tileSize, sizeof(int), hash);
+    hash = fnv1a(&options.seed, sizeof(options.seed), hash);
+    hash = fnv1a(&reorder, sizeof(bool), hash);
+    string checkpointFileString(filename);
+    checkpointFileString.replace(checkpointFileString.size() - 3, 3, "ckpt");
+    Checkpoint checkpoint(hash, width, height);
+
+    string outputFileString = outputFilenameFor(filename);
+    string header = binaryPPMHeaderOf(width, height);
+    FILE *outputFile;
+    bool written;
+    if (resume) {
+        if (!checkpoint.load(checkpointFileString)) {
+            return -1;
+        }
+        // Rows after the checkpoint may be partly written, they are rendered again
+        long end = header.size() + 3L * width * checkpoint.rowsDone;
+        outputFile = fopen(outputFileString.c_str(), "r+b");
+        struct stat fileStat;
+        if (outputFile == nullptr || fstat(fileno(outputFile), &fileStat) != 0 || fileStat.st_size < end) {
+            cerr << "Output file named \"" << outputFileString << "\" is missing or shorter than its checkpoint." << endl;
+            return -1;
+        }
+        cout << "Resuming from row " << checkpoint.rowsDone << " of " << height << "." << endl;
+        written = ftruncate(fileno(outputFile), end) == 0 && fseek(outputFile, end, SEEK_SET) == 0;
+    } else {
+        outputFile = fopen(outputFileString.c_str(), "wb");
+        if (outputFile == nullptr) {
+            cerr << "Output file named \"" << outputFileString << "\" could not be created." << endl;
+            return -1;
+        }
+        written = fwrite(header.data(), 1, header.size(), outputFile) == header.size();
     }
 
-    return phongColor;
+    chrono::steady_clock::time_point lastCheckpoint = chrono::steady_clock::now();
+    future<bool> bandWritten;
+    vector<float> band;
+    // Checkpoints start at a band, so that the rows of a resumed render are tiled like the uninterrupted one's
+    for (int y = checkpoint.rowsDone; y < height && written; y += TILE_SIZE) {
+        options.y0 = y;
+        options.y1 = min(y + TILE_SIZE, height);
+        band.assign(3 * (size_t) width * (options.y1 - options.y0), 0);
+        render(*scene, options, band.data());
+        written = !bandWritten.valid() || bandWritten.get();
+        // Every row before this band is written now, and none is being written
+        if (written && y > checkpoint.rowsDone && secondsSince(lastCheckpoint) >= CHECKPOINT_INTERVAL_S) {
+            checkpoint.rowsDone = y;
+            written = fflush(outputFile) == 0 && fsync(fileno(outputFile)) == 0 && checkpoint.save(checkpointFileString);
+            lastCheckpoint = chrono::steady_clock::now();
+        }
+        bandWritten = async(launch::async, [outputFile](const string &pixels) {
+            return fwrite(pixels.data(), 1, pixels.size(), outputFile) == pixels.size();
+        }, binaryPixelsOf(band));
+        printf("Rendering: %d%% complete\r", (int) ((float) options.y1 * 100 / height));
+        fflush(stdout);
+    }
+    written = (!bandWritten.valid() || bandWritten.get()) && written;
+    if (fclose(outputFile) != 0 || !written) {
+        cerr << "Output file named \"" << outputFileString << "\" could not be written." << endl;
+        return -1;
+    }
+    // Image is complete, there is nothing left to resume
+    remove(checkpointFileString.c_str());
+    cout << endl;
+    return 0;
 }
 
-Color traceRayRecursive(const Ray &ray, const Scene &scene, const float grace,
-                        const int depth, stack<float> refractiveIndices, stack<float> opacities) {
-    pair<int, float> minTIndex_minT = traceRay(ray, scene, grace);
-    int objIndex = minTIndex_minT.first;
-    float paramT = minTIndex_minT.second;
-    int noSpheres = scene.spheres.size();
-
-    // no intersection with anything
-    if (objIndex < 0) {
-        // return variant of bg color
-        return scene.bgColor;
-    }
-
-    Color reflectedColor;
-    Color transmittedColor;
-    Color tirColor;
-    Vector3D poi = ray.pointAt(paramT);
-    // ray intersects an object and can still recurse
-    if (depth > 0) {
-        const Vector3D I = (ray.origin - poi).unit();
-        const stack<float> refractiveIndicesCopy = refractiveIndices;
-        const float prevRI = refractiveIndicesCopy.top();
-        const stack<float> opacitiesCopy = opacities;
-
-        // next object RI, opacity and normal at POI
-        float nextRI = 0;
-        float nextOpacity = -1;
-        Vector3D N;
-        if (objIndex < noSpheres) {
-            Sphere sphere = scene.spheres[objIndex];
-            nextRI = sphere.materialColor.refractiveIndex;
-            nextOpacity = sphere.materialColor.opacity;
-            N = (poi - sphere.center).unit();
-        } else {
-            Triangle triangle = scene.triangles[objIndex - noSpheres];
-            nextRI = triangle.materialColor.refractiveIndex;
-            nextOpacity = triangle.materialColor.opacity;
-            N = triangle.surfaceNormal.unit();
+// Distributed mode worker: loads the scene once, then renders the tiles the coordinator asks for until it hangs up
+// It first answers "ready <width> <height>", then each request "tile <index>" with "done <index>" and the tile's
+// pixels (3 floats each, row by row)
+void renderTilesFor(Connection &coordinator, const string &filename, bool reorder) {
+    unique_ptr<Scene> scene = loadScene(filename);
+    if (scene && reorder) {
+        reorderScene(*scene);
+    }
+    if (!scene || !coordinator.writeAll("ready " + to_string(scene->imWidth) + " " + to_string(scene->imHeight) + "\n")) {
+        return;
+    }
+    vector<Tile> tiles = tilesOf(scene->imWidth, scene->imHeight, TILE_SIZE);
+    RenderOptions options;
+    options.regionFramebuffer = true;
+    options.threads = 1;
+    string line;
+    while (coordinator.readLine(line)) {
+        istringstream iss(line);
+        string keyword;
+        int index;
+        if (!(iss >> keyword >> index) || keyword != "tile" || index < 0 || index >= (int) tiles.size()) {
+            return;
+        }
+        const Tile &tile = tiles[index];
+        options.x0 = tile.x0;
+        options.y0 = tile.y0;
+        options.x1 = tile.x1;
+        options.y1 = tile.y1;
+        vector<float> pixels(3 * tile.width() * tile.height());
+        render(*scene, options, pixels.data());
+        string reply = "done " + to_string(index) + "\n";
+        reply.append((const char *) pixels.data(), pixels.size() * sizeof(float));
+        if (!coordinator.writeAll(reply)) {
+            return;
         }
+    }
+}
 
-        // Entering or exiting object
-        if (N.dot(I) < 0) {
-            // Case refers to ray exiting object
-            // Correcting normal
-            N = N * -1;
-            // Removing top of refractive indices and opacities stack
-            if (refractiveIndices.size() > 1) {
-                refractiveIndices.pop();
-            }
-            if (opacities.size() > 1) {
-                opacities.pop();
+// Worker process as seen by the coordinator
+class WorkerProcess {
+public:
+    pid_t pid;
+    int fd;
+    unique_ptr<Connection> connection;
+    // Tiles sent to the worker and not yet rendered
+    vector<int> tiles;
+    // When the worker was last heard from, or last given tiles while it had none
+    chrono::steady_clock::time_point lastHeard;
+
+    WorkerProcess(pid_t pid, int fd) : pid(pid), fd(fd), connection(new Connection(fd)),
+                                       lastHeard(chrono::steady_clock::now()) {}
+
+    // Milliseconds left until the worker is overdue (at least 0)
+    int millisecondsLeft() const {
+        return max(0, (int) ((WORKER_TIMEOUT_S - secondsSince(lastHeard)) * 1000));
+    }
+};
+
+// Distributed mode: forks worker processes that each load the scene, hands tiles out to them over socket pairs and
+// assembles the image from what they send back
+// Tiles of a worker that dies are handed out again, tiles are seeded by their index so it does not matter who renders
+// which tile. A worker that does not answer for WORKER_TIMEOUT_S seconds is killed and treated as dead
+int distribute(const string &filename, int workerCount, bool reorder) {
+    signal(SIGPIPE, SIG_IGN);
+    vector<WorkerProcess> workers;
+    for (int k = 0; k < workerCount; k++) {
+        int fds[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+            cerr << "Could not create socket pair: " << strerror(errno) << endl;
+            return -1;
+        }
+        pid_t pid = fork();
+        if (pid == 0) {
+            // Worker keeps only its own end, so that it sees the coordinator hang up
+            close(fds[0]);
+            for (auto &worker : workers) {
+                close(worker.fd);
             }
-            // Correcting nextRI and nextOpacity
-            nextRI = refractiveIndices.top();
-            nextOpacity = opacities.top();
-        } else {
-            refractiveIndices.push(nextRI);
-            opacities.push(nextOpacity);
+            Connection coordinator(fds[1]);
+            renderTilesFor(coordinator, filename, reorder);
+            _exit(0);
+        }
+        close(fds[1]);
+        if (pid < 0) {
+            close(fds[0]);
+            cerr << "Could not start worker: " << strerror(errno) << endl;
+            continue;
         }
+        workers.emplace_back(pid, fds[0]);
+    }
 
-        const float cosThetaI = N.dot(I);
-        const float F0 = pow((nextRI - prevRI) / (nextRI + prevRI), 2);
-
-        // Reflection
-        const float Fr = F0 + (1 - F0) * pow((1 - cosThetaI), 5);
-        const Vector3D R = (N * 2 * cosThetaI - I).unit();
-        const Ray reflectedRay(poi, R);
-        // the nextRI = prevRI as ray doesn't leave medium
-        reflectedColor = traceRayRecursive(reflectedRay, scene, grace, depth - 1, refractiveIndicesCopy, opacitiesCopy);
-        reflectedColor = reflectedColor * Fr;
-
-        // Refraction
-        const float underSqrtTerm = 1 - (pow((prevRI / nextRI), 2) * (1 - pow(cosThetaI, 2)));
-        if (underSqrtTerm >= 0) {
-            // normal refraction
-            const Vector3D T = (N * -sqrt(underSqrtTerm) + (N * cosThetaI - I) * (prevRI / nextRI)).unit();
-            const Ray transmittedRay(poi, T);
-            transmittedColor = traceRayRecursive(transmittedRay, scene, grace, depth - 1, refractiveIndices, opacities);
-            transmittedColor = transmittedColor * (1 - Fr) * (1 - nextOpacity);
+    // Every worker loads the scene, image size is taken from the first one that did
+    // They load at the same time, so all of them get WORKER_TIMEOUT_S seconds from now
+    int width = 0, height = 0;
+    for (auto &worker : workers) {
+        string line, keyword;
+        pollfd ready = {worker.fd, POLLIN, 0};
+        if ((worker.connection->hasBuffered() || poll(&ready, 1, worker.millisecondsLeft()) > 0)
+            && worker.connection->readLine(line)) {
+            istringstream(line) >> keyword >> width >> height;
         } else {
-            // total internal reflection
-            // this can be optimized as this tracing is same as the reflected ray tracing in the same recursion depth
-            tirColor = traceRayRecursive(reflectedRay, scene, grace, depth - 1, refractiveIndicesCopy, opacitiesCopy);
-            tirColor = tirColor * (1 - Fr);
+            cerr << "Worker " << worker.pid << " could not load the scene." << endl;
+            kill(worker.pid, SIGKILL);
+            worker.connection.reset();
         }
     }
-
-    // phongColor = ambient + diffuse + specular + shadows
-    Color phongColor;
-    if (objIndex < noSpheres) {
-        Sphere sphere = scene.spheres[objIndex];
-        phongColor = phongColorForSphere(ray, scene, sphere, poi);
-    } else {
-        Triangle triangle = scene.triangles[objIndex - noSpheres];
-        phongColor = phongColorForTriangle(ray, scene, triangle, poi);
+    vector<Tile> tiles = tilesOf(width, height, TILE_SIZE);
+    deque<int> pending;
+    for (const Tile &tile : tiles) {
+        pending.push_back(tile.index);
     }
-    return phongColor + reflectedColor + transmittedColor + tirColor;
+    vector<vector<Color> > colors = blankImage(width, height);
+    size_t tilesDone = 0;
+    // Worker is killed too, in case it is alive but hung
+    auto dead = [&pending](WorkerProcess &worker, const string &what) {
+        cerr << "Worker " << worker.pid << " " << what << ", handing out its " << worker.tiles.size() << " tiles again."
+             << endl;
+        kill(worker.pid, SIGKILL);
+        pending.insert(pending.begin(), worker.tiles.begin(), worker.tiles.end());
+        worker.tiles.clear();
+        worker.connection.reset();
+    };
+    while (tilesDone < tiles.size()) {
+        vector<pollfd> fds;
+        vector<WorkerProcess *> polled;
+        // Until the first polled worker is overdue
+        int timeout = WORKER_TIMEOUT_S * 1000;
+        for (auto &worker : workers) {
+            if (worker.connection && worker.tiles.empty()) {
+                worker.lastHeard = chrono::steady_clock::now();
+            }
+            while (worker.connection && worker.tiles.size() < WORKER_TILES_IN_FLIGHT && !pending.empty()) {
+                worker.tiles.push_back(pending.front());
+                pending.pop_front();
+                if (!worker.connection->writeAll("tile " + to_string(worker.tiles.back()) + "\n")) {
+                    dead(worker, "died");
+                }
+            }
+            if (worker.connection && !worker.tiles.empty()) {
+                fds.push_back({worker.fd, POLLIN, 0});
+                polled.push_back(&worker);
+                timeout = min(timeout, worker.millisecondsLeft());
+            }
+        }
+        if (fds.empty()) {
+            cerr << "No worker is left to render the scene." << endl;
+            break;
+        }
+        if (poll(fds.data(), fds.size(), timeout) < 0 && errno != EINTR) {
+            cerr << "Could not wait for workers: " << strerror(errno) << endl;
+            break;
+        }
+        for (size_t k = 0; k < fds.size(); ++k) {
+            WorkerProcess &worker = *polled[k];
+            if (fds[k].revents == 0) {
+                if (worker.millisecondsLeft() == 0) {
+                    dead(worker, "did not answer in " + to_string(WORKER_TIMEOUT_S) + " s");
+                }
+                continue;
+            }
+            worker.lastHeard = chrono::steady_clock::now();
+            // Replies read together with an earlier one are already buffered
+            do {
+                string line, keyword, pixels;
+                int index = -1;
+                if (!worker.connection->readLine(line) || !(istringstream(line) >> keyword >> index)
+                    || find(worker.tiles.begin(), worker.tiles.end(), index) == worker.tiles.end()
+                    || !worker.connection->readBytes(3 * tiles[index].width() * tiles[index].height() * sizeof(float),
+                                                      pixels)) {
+                    dead(worker, "died");
+                    break;
+                }
+                const Tile &tile = tiles[index];
+                const float *pixel = (const float *) pixels.data();
+                for (int j = tile.y0; j < tile.y1; j++) {
+                    for (int i = tile.x0; i < tile.x1; i++, pixel += 3) {
+                        colors[i][j] = Color(pixel[0], pixel[1], pixel[2]);
+                    }
+                }
+                worker.tiles.erase(find(worker.tiles.begin(), worker.tiles.end(), index));
+                tilesDone++;
+            } while (worker.connection->hasBuffered());
+        }
+        printf("Rendering: %d%% complete\r", (int) ((float) tilesDone * 100 / max((size_t) 1, tiles.size())));
+        fflush(stdout);
+    }
+    cout << endl;
+    // Hanging up tells the workers to exit
+    for (auto &worker : workers) {
+        worker.connection.reset();
+        waitpid(worker.pid, nullptr, 0);
+    }
+    if (tiles.empty() || tilesDone < tiles.size()) {
+        return -1;
+    }
+    writeImage(outputFilenameFor(filename), width, height, colors);
+    return 0;
 }
 
-int main(int argc, char *argv[]) {
-    // Initializing random seed
-    srand(42);
-
-    // Restricting number of commandline arguments
-    if (argc != 2) {
-        cerr << "Usage: " << argv[0] << " <inputfile>" << endl;
-        exit(-1);
+// Pack mode: writes the triangles of the scene file, in Morton order, into a triangle file next to it (.tris) and a
+// copy of the scene file that maps it instead of listing its faces (_packed.txt), see TriangleStore
+// Packing holds the scene in memory once, rendering the packed scene only reads the pages of triangles rays touch
+int pack(const string &filename) {
+    Scene scene(filename);
+    if (!scene.parse()) {
+        return -1;
+    }
+    if (scene.triangles.isMapped()) {
+        cerr << "Scene file \"" << filename << "\" already maps a triangle file." << endl;
+        return -1;
+    }
+    cout << reorderScene(scene) << endl;
+    string triangleFilename(filename);
+    triangleFilename.replace(triangleFilename.size() - 3, 3, "tris");
+    string packedFilename(filename);
+    packedFilename.insert(packedFilename.size() - 4, "_packed");
+    // Stored for primaryVisibilityHash, which does not read mapped triangles
+    uint64_t geometryHash = 14695981039346656037ULL;
+    for (const auto &triangle : scene.triangles) {
+        geometryHash = fnv1a(triangle, geometryHash);
+    }
+    if (!TriangleStore::write(triangleFilename, scene.triangles, geometryHash)) {
+        return -1;
+    }
+    // Faces and the vertices, normals and texture coordinates they are made of are left out, except inside meshes
+    ifstream input(filename);
+    ofstream output(packedFilename);
+    string line;
+    bool inMesh = false;
+    while (getline(input, line)) {
+        string keyword;
+        istringstream(line) >> keyword;
+        inMesh = keyword == "mesh" || (inMesh && keyword != "endmesh");
+        if (inMesh || (keyword != "f" && keyword != "v" && keyword != "vn" && keyword != "vt")) {
+            output << line << endl;
+        }
     }
+    output << "trianglefile " << triangleFilename << endl;
+    output.close();
+    if (output.fail()) {
+        cerr << "Packed scene file \"" << packedFilename << "\" could not be written." << endl;
+        return -1;
+    }
+    cout << "Packed " << scene.triangles.size() << " triangles into \"" << triangleFilename << "\", scene file \""
+         << packedFilename << "\" maps them." << endl;
+    return 0;
+}
 
+// Renders the scene file into an image next to it
+// With relight, primary hits are also cached in (and later reused from) a geometry buffer file next to it
+// With prepass, primary hits are rasterized instead of traced
+// With reorder, degenerate and duplicate triangles are dropped and objects are sorted for memory locality
+// With compact, triangles are encoded compactly (after reordering, which makes their clusters tighter)
+// With wavefront, the image is rendered by renderImageWavefront instead of renderImage
+// With denoise, the image is denoised after rendering, guided by what its camera rays hit
+// With a positive bakeResolution, shadows on triangles are baked into lightmaps of that resolution (see
+// bakeLightmaps) before rendering and shaded from them
+int renderFile(const string &filename, bool relight, bool prepass, bool reorder, bool compact, bool wavefront,
+               bool denoise, int bakeResolution) {
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
     // Read scene description from input file
-    string filename(argv[1]);
     Scene scene(filename);
     if (!scene.parse()) {
         return -1;
-    };
+    }
     cout << scene;
-
-    // Preliminary calculations
-    Vector3D u = scene.viewDir.cross(scene.upDir);
-    Vector3D v = u.cross(scene.viewDir);
-    Vector3D n = u.cross(v);
-
-    float d = scene.imHeight / (2 * tan(scene.vFovDeg * M_PI / 360));
-    float viewingWindowWidth = scene.imWidth;
-    float viewingWindowHeight = scene.imHeight;
-    if (scene.viewingDistance > 0) {
-        viewingWindowWidth = (scene.viewingDistance / d) * scene.imWidth;
-        viewingWindowHeight = (scene.viewingDistance / d) * scene.imHeight;
-        d = scene.viewingDistance;
+    if (reorder) {
+        cout << reorderScene(scene) << endl;
+    }
+    if (compact) {
+        cout << scene.compactTriangles() << endl;
+    }
+    if (bakeResolution > 0) {
+        cout << bakeLightmaps(scene, bakeResolution) << endl;
     }
 
-    Vector3D imageCenter = scene.eye + scene.viewDir.unit() * d;
-    Vector3D ul = imageCenter - u * (viewingWindowWidth / 2) + v * (viewingWindowHeight / 2);
-    Vector3D ur = imageCenter + u * (viewingWindowWidth / 2) + v * (viewingWindowHeight / 2);
-    Vector3D ll = imageCenter - u * (viewingWindowWidth / 2) - v * (viewingWindowHeight / 2);
-    Vector3D lr = imageCenter + u * (viewingWindowWidth / 2) - v * (viewingWindowHeight / 2);
-
-    Vector3D delWidth = (ur - ul) * (1 / ((float) scene.imWidth - 1));
-    Vector3D delHeight = (ll - ul) * (1 / ((float) scene.imHeight - 1));
+    // Preliminary calculations
+    Camera camera(scene);
+    // Initializing random seed
+    seedRand(42);
 
     // Initialize pixel array for output image
-    vector<vector<Color> > colors;
-    for (int i = 0; i < scene.imWidth; i++) {
-        vector<Color> col;
-        col.resize(scene.imHeight);
-        colors.push_back(col);
-    }
-
-    // Ray tracing per pixel
-    for (int j = 0; j < scene.imHeight; j++) {
-        for (int i = 0; i < scene.imWidth; i++) {
-            // (i, j) pixel coordinate
-            Vector3D pixelCoordinate = ul + delWidth * i + delHeight * j;
-            // trace this ray in the scene recursively to produce a color for the pixel
-            stack<float> refractiveIndices;
-            refractiveIndices.push(CAMERA_MEDIUM_REFRACTIVE_INDEX);
-            stack<float> opacities;
-            opacities.push(CAMERA_MEDIUM_OPACITY);
-
-            if (scene.viewingDistance > 0) {
-                // Control NUM_DISTRIBUTED_RAYS, DISTRIBUTED_RAYS_JITTER to change distributed ray tracing effects
-                // Set NUM_DISTRIBUTED_RAYS = 1, DISTRIBUTED_RAYS_JITTER = 0 for disabling distributed ray tracing
-                for (int distributed_i = 0; distributed_i < NUM_DISTRIBUTED_RAYS; distributed_i++) {
-                    // Create ray and add jitter to ray origin
-                    Ray ray;
-                    if (scene.isParallelProjection) {
-                        // ray from pixel projection on eye plane in direction of normal to image plane
-                        ray = Ray(pixelCoordinate - scene.viewDir.unit() * d +
-                                  Vector3D(getRand(), getRand(), getRand()).unit() * DISTRIBUTED_RAYS_JITTER,
-                                  scene.viewDir);
-                    } else {
-                        // ray from eye to that pixel
-                        Vector3D origin =
-                                scene.eye + Vector3D(getRand(), getRand(), getRand()).unit() * DISTRIBUTED_RAYS_JITTER;
-                        ray = Ray(origin, (pixelCoordinate - origin).unit());
-                    }
-                    Color color = traceRayRecursive(ray, scene,
-                                                    RECURSIVE_RAY_GRACE, RECURSIVE_DEPTH,
-                                                    refractiveIndices,
-                                                    opacities);
-                    // Keep track of color
-                    colors[i][j] = colors[i][j] + color;
-                }
-                colors[i][j] = colors[i][j] * (1.0 / NUM_DISTRIBUTED_RAYS);
-            } else {
-                // Create ray and add jitter to ray origin
-                Ray ray;
-                if (scene.isParallelProjection) {
-                    // ray from pixel projection on eye plane in direction of normal to image plane
-                    ray = Ray(pixelCoordinate - scene.viewDir.unit() * d, scene.viewDir);
-                } else {
-                    // ray from eye to that pixel
-                    Vector3D origin = scene.eye;
-                    ray = Ray(scene.eye, (pixelCoordinate - origin).unit());
-                }
-                Color color = traceRayRecursive(ray, scene,
-                                                RECURSIVE_RAY_GRACE, RECURSIVE_DEPTH,
-                                                refractiveIndices,
-                                                opacities);
-                // Keep track of color
-                colors[i][j] = color;
-            }
-
-            // Show progress
-            if (i == 0) {
-                printf("Rendering: %d%% complete\r", (int) ((float) (j + 1) * 100 / scene.imHeight));
-            }
+    vector<vector<Color> > colors = blankImage(scene.imWidth, scene.imHeight);
+
+    // Relighting: primary hits depend only on camera and geometry
+    // So they are cached in a geometry buffer and reused as long as camera and geometry stay unchanged
+    uint64_t visibilityHash = fnv1a(&camera.rayJitter, sizeof(float), primaryVisibilityHash(scene));
+    string gBufferFileString(filename);
+    gBufferFileString.replace(gBufferFileString.size() - 3, 3, "gbuf");
+    GBuffer gBuffer(visibilityHash, scene.imWidth, scene.imHeight, camera.samplesPerPixel);
+    bool gBufferCached = relight && gBuffer.load(gBufferFileString);
+    if (relight) {
+        cout << (gBufferCached ? "Reusing" : "Building") << " geometry buffer \"" << gBufferFileString << "\"" << endl;
+    }
+    // Primary visibility prepass: camera rays are not traced, their hits are found by rasterizing into the buffer
+    if (prepass && !gBufferCached) {
+        chrono::steady_clock::time_point prepassStart = chrono::steady_clock::now();
+        if (rasterizePrimaryHits(scene, camera, gBuffer)) {
+            cout << "Rasterized primary visibility in " << secondsSince(prepassStart) << " s." << endl;
+        } else {
+            cout << "Primary visibility prepass needs a camera without depth of field, tracing camera rays." << endl;
         }
     }
 
+    // Startup: parsing, with texture decodes and hierarchy build overlapped, and whatever of them was left after it
+    cout << "Time to first ray: " << secondsSince(start) << " s (" << scene.backgroundWaitSeconds
+         << " s of it waiting for textures and hierarchy after parsing)." << endl;
+    if (scene.triangles.isMapped()) {
+        cout << "Mapped triangles before rendering: " << scene.triangles.residency() << endl;
+    }
+    DenoiseGuides guides(denoise ? scene.imWidth : 0, denoise ? scene.imHeight : 0);
+    chrono::steady_clock::time_point renderStart = chrono::steady_clock::now();
+    if (wavefront) {
+        WavefrontStats stats = renderImageWavefront(scene, camera, colors, denoise ? &guides : nullptr);
+        cout << endl << stats << endl;
+    } else {
+        RenderStats stats = renderImage(scene, camera, colors, relight || prepass ? &gBuffer : nullptr,
+                                        denoise ? &guides : nullptr);
+        cout << endl << stats << endl;
+    }
+    cout << "Rendered in " << secondsSince(renderStart) << " s." << endl;
+    if (denoise) {
+        chrono::steady_clock::time_point denoiseStart = chrono::steady_clock::now();
+        denoiseImage(guides, colors);
+        cout << "Denoised in " << secondsSince(denoiseStart) << " s." << endl;
+    }
+    if (scene.triangles.isMapped()) {
+        cout << "Mapped triangles after rendering: " << scene.triangles.residency() << endl;
+    }
 
-    // Write the final image to an output file
-    string outputFileString(filename);
-    int len = outputFileString.size();
-    outputFileString.replace(len - 3, 3, "ppm");
+    if (relight && !gBufferCached && gBuffer.isComplete()) {
+        gBuffer.save(gBufferFileString);
+    }
 
-    // Creating PPM image
-    ofstream outputFile;
-    outputFile.open(outputFileString);
+    writeImage(outputFilenameFor(filename), scene.imWidth, scene.imHeight, colors);
 
-    // Filling in the header
-    outputFile << "P3" << endl << "# image autogenerated using a simple ray tracer" << endl;
-    outputFile << scene.imWidth << " " << scene.imHeight << endl;
-    outputFile << 255 << endl;
+    return 0;
+}
 
-    // Filling in the body
-    for (int j = 0; j < scene.imHeight; ++j) {
-        for (int i = 0; i < scene.imWidth; ++i) {
-            // Write the R G B values of a pixel in seperate line
-            outputFile << colors[i][j].to8BitScale() << endl;
+int main(int argc, char *argv[]) {
+    // Parsing commandline arguments
+    string filename;
+    bool relight = false;
+    bool watchMode = false;
+    bool streamMode = false;
+    bool resume = false;
+    bool prepass = false;
+    bool reorder = false;
+    bool compact = false;
+    bool wavefront = false;
+    bool denoise = false;
+    bool bake = false;
+    int bakeResolution = LIGHTMAP_RESOLUTION;
+    bool packMode = false;
+    int workerCount = 0;
+    string trackFilename;
+    string socketPath;
+    for (int k = 1; k < argc; k++) {
+        string arg(argv[k]);
+        if (arg == "--relight") {
+            relight = true;
+        } else if (arg == "--prepass") {
+            prepass = true;
+        } else if (arg == "--wavefront") {
+            wavefront = true;
+        } else if (arg == "--reorder") {
+            reorder = true;
+        } else if (arg == "--compact") {
+            compact = true;
+        } else if (arg == "--denoise") {
+            denoise = true;
+        } else if (arg == "--bake") {
+            bake = true;
+            // Optional resolution, a scene file is never a positive number alone
+            if (k + 1 < argc && string(argv[k + 1]).find_first_not_of("0123456789") == string::npos &&
+                atoi(argv[k + 1]) > 0) {
+                bakeResolution = atoi(argv[++k]);
+            }
+        } else if (arg == "--pack") {
+            packMode = true;
+        } else if (arg == "--watch") {
+            watchMode = true;
+        } else if (arg == "--stream") {
+            streamMode = true;
+        } else if (arg == "--resume") {
+            streamMode = true;
+            resume = true;
+        } else if (arg == "--animate" && k + 1 < argc) {
+            trackFilename = argv[++k];
+        } else if (arg == "--workers" && k + 1 < argc && atoi(argv[k + 1]) > 0) {
+            workerCount = atoi(argv[++k]);
+        } else if (arg == "--serve" && k + 1 < argc) {
+            socketPath = argv[++k];
+        } else if (filename.empty() && arg.compare(0, 2, "--") != 0) {
+            filename = arg;
+        } else {
+            filename.clear();
+            break;
         }
     }
+    if (!socketPath.empty() && filename.empty()) {
+        return serve(socketPath, bake ? bakeResolution : 0);
+    }
+    // Streaming, distributing, watching and animating are modes of their own, at most one of them is taken
+    int modes = (int) streamMode + (int) (workerCount > 0) + (int) watchMode + (int) !trackFilename.empty();
+    bool modesUnsupported = modes > 1;
+    // Geometry buffers (and the prepass filling them) hold the primary hits of a whole image rendered in one process
+    bool relightUnsupported = (relight || prepass) && (streamMode || workerCount > 0 || watchMode ||
+                                                       !trackFilename.empty());
+    // Watching and animating match objects between parses by their position in the file, which reordering changes
+    bool reorderUnsupported = reorder && (watchMode || !trackFilename.empty());
+    // The wavefront renderer renders whole images in one process, from traced camera rays
+    bool wavefrontUnsupported = wavefront && (relight || prepass || streamMode || workerCount > 0 || watchMode ||
+                                              !trackFilename.empty());
+    // Triangles are encoded once, for renders of a whole image in one process from a scene that does not change
+    bool compactUnsupported = compact && (streamMode || workerCount > 0 || watchMode || !trackFilename.empty());
+    // Denoising filters a whole image rendered in one process
+    bool denoiseUnsupported = denoise && (streamMode || workerCount > 0 || watchMode || !trackFilename.empty());
+    // Lightmaps are baked once for a scene that does not change, and shaded from by the recursive renderer
+    bool bakeUnsupported = bake && (wavefront || streamMode || workerCount > 0 || watchMode || !trackFilename.empty());
+    // Packing only writes files
+    bool packUnsupported = packMode && argc != 3;
+    if (filename.empty() || !socketPath.empty() || modesUnsupported || relightUnsupported || reorderUnsupported ||
+        wavefrontUnsupported || compactUnsupported || denoiseUnsupported || bakeUnsupported || packUnsupported) {
+        cerr << "Usage: " << argv[0] << " [--reorder] [--relight | --prepass | --wavefront | --stream | --resume |"
+             << " --workers <n>]"
+             << " <inputfile>" << endl;
+        cerr << "       " << argv[0] << " [--reorder] [--compact] [--denoise] [--relight | --prepass | --wavefront]"
+             << " <inputfile>" << endl;
+        cerr << "       " << argv[0] << " [--reorder] [--compact] [--denoise] --bake [<n>] [--relight | --prepass]"
+             << " <inputfile>" << endl;
+        cerr << "       " << argv[0] << " [--watch | --animate <trackfile>] <inputfile>" << endl;
+        cerr << "       " << argv[0] << " --pack <inputfile>" << endl;
+        cerr << "       " << argv[0] << " [--bake [<n>]] --serve <socketpath>" << endl;
+        exit(-1);
+    }
 
-    // Closing the output stream
-    outputFile.close();
+    if (packMode) {
+        return pack(filename);
+    }
 
-    return 0;
+    if (watchMode) {
+        return watch(filename);
+    }
+    if (!trackFilename.empty()) {
+        return animate(filename, trackFilename);
+    }
+    if (workerCount > 0) {
+        return distribute(filename, workerCount, reorder);
+    }
+    if (streamMode) {
+        return stream(filename, resume, reorder);
+    }
+    return renderFile(filename, relight, prepass, reorder, compact, wavefront, denoise, bake ? bakeResolution : 0);
 }
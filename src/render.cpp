@@ -0,0 +1,1090 @@
+#include <cfloat>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include "render.hpp"
+#include "intersections.hpp"
+#include "shading.hpp"
+#include "scenediff.hpp"
+
+using namespace std;
+
+#ifndef M_PI
+#define M_PI 3.1415926535
+#endif
+
+thread_local TileFootprint *activeFootprint = nullptr;
+thread_local ShadingBatch *activeShadingBatch = nullptr;
+thread_local PacketHitCache *activePacketHits = nullptr;
+thread_local DenoiseGuides *activeDenoiseGuides = nullptr;
+thread_local OccluderCache *activeOccluders = nullptr;
+thread_local PixelShadingCache *activePixelShading = nullptr;
+
+// Returns T parameter of ray hitting object with given global index, -1 if it does not hit (in front of the origin)
+float smallestNonNegativeT(const Ray &ray, const Scene &scene, int objIndex, float grace) {
+    int noSpheres = scene.spheres.size();
+    if (objIndex < noSpheres) {
+        return smallestNonNegativeT(ray, scene.spheres[objIndex], grace);
+    }
+    int k = objIndex - noSpheres;
+    if (scene.compact.isEncoded(k)) {
+        return scene.compact.smallestNonNegativeT(ray, k, grace);
+    }
+    return smallestNonNegativeT(ray, scene.storedTriangleOf(objIndex), grace);
+}
+
+// Tests ray against object with given index in the hierarchy (see BVH) and calls hit(objIndex, t) for every hit
+// For an instance, the ray is moved into object space of its mesh, whose hierarchy is traversed up to tMax, and
+// triangles it hits are reported by global index
+template<typename Hit>
+void intersectObject(const Ray &ray, const Scene &scene, int index, float grace, const float &tMax, Hit hit) {
+    int noObjects = scene.noObjects();
+    if (index < noObjects) {
+        float t = smallestNonNegativeT(ray, scene, index, grace);
+        if (t >= 0) {
+            hit(index, t);
+        }
+        return;
+    }
+    const Instance &instance = scene.instances[index - noObjects];
+    const Mesh &mesh = scene.meshes[instance.mesh];
+    Ray objectRay = instance.transform.toObject(ray);
+    int firstObject = noObjects + instance.firstObject;
+    mesh.bvh.traverse(objectRay, 0, tMax, [&](int k) {
+        float t = smallestNonNegativeT(objectRay, mesh.triangles[k], grace);
+        if (t >= 0) {
+            hit(firstObject + k, t);
+        }
+    });
+}
+
+pair<int, float> traceRay(const Ray &ray, const Scene &scene, float grace, const vector<int> *candidates) {
+    int minTIndex = -1;
+    float minT = FLT_MAX;
+    auto closest = [&](int objIndex, float t) {
+        if (t < minT || (t == minT && objIndex < minTIndex)) {
+            minTIndex = objIndex;
+            minT = t;
+        }
+    };
+    auto inspect = [&](int index) {
+        intersectObject(ray, scene, index, grace, minT, closest);
+    };
+    // Testing many candidates one by one is slower than traversing the hierarchy, which is used for them instead
+    if (candidates != nullptr && candidates->size() <= PRIMARY_CANDIDATES_MAX) {
+        for (int objIndex : *candidates) {
+            inspect(objIndex);
+        }
+    } else {
+        // Inspect intersection with objects whose boxes the ray passes through, until nothing nearer can be hit
+        scene.bvh.traverse(ray, 0, minT, inspect);
+    }
+
+    if (activeFootprint != nullptr) {
+        if (minTIndex >= 0) {
+            activeFootprint->touch(minTIndex);
+        }
+        activeFootprint->addSegment(ray, grace, minTIndex < 0 ? FLT_MAX : minT);
+    }
+
+    return {minTIndex, minTIndex < 0 ? -1 : minT};
+}
+
+void traceRayPacket(const Ray *rays, int count, const Scene &scene, float grace, const vector<int> *candidates,
+                    pair<int, float> *results) {
+    RayPacket packet(rays, count);
+    if (count < 2 || !packet.isCoherent()) {
+        for (int k = 0; k < count; ++k) {
+            results[k] = traceRay(rays[k], scene, grace, candidates);
+        }
+        return;
+    }
+    int noSpheres = scene.spheres.size();
+    int noObjects = scene.noObjects();
+    int minTIndex[PACKET_SIZE];
+    float minT[PACKET_SIZE];
+    for (int lane = 0; lane < PACKET_SIZE; ++lane) {
+        minTIndex[lane] = -1;
+        minT[lane] = FLT_MAX;
+    }
+    auto inspect = [&](int objIndex, int mask) {
+        // Instances are traced ray by ray, in object space of their meshes
+        if (objIndex >= noObjects) {
+            for (int lane = 0; lane < PACKET_SIZE; ++lane) {
+                if (mask >> lane & 1) {
+                    intersectObject(rays[lane], scene, objIndex, grace, minT[lane], [&](int hitIndex, float t) {
+                        if (t < minT[lane] || (t == minT[lane] && hitIndex < minTIndex[lane])) {
+                            minTIndex[lane] = hitIndex;
+                            minT[lane] = t;
+                        }
+                    });
+                }
+            }
+            return;
+        }
+        float t[PACKET_SIZE];
+        if (objIndex >= noSpheres && (mask & (mask - 1)) != 0) {
+            int k = objIndex - noSpheres;
+            if (scene.compact.isEncoded(k)) {
+                Vector3D v1, v2, v3;
+                scene.compact.corners(k, v1, v2, v3);
+                float tolerance, grazingTolerance;
+                scene.compact.tolerancesOf(k, v1, v2, v3, tolerance, grazingTolerance);
+                packet.intersect(v1, v2, v3, grace, tolerance, grazingTolerance, t);
+            } else {
+                packet.intersect(scene.storedTriangleOf(objIndex), grace, t);
+            }
+        } else {
+            for (int lane = 0; lane < PACKET_SIZE; ++lane) {
+                if (mask >> lane & 1) {
+                    t[lane] = smallestNonNegativeT(rays[lane], scene, objIndex, grace);
+                }
+            }
+        }
+        for (int lane = 0; lane < PACKET_SIZE; ++lane) {
+            if ((mask >> lane & 1) && t[lane] >= 0 &&
+                (t[lane] < minT[lane] || (t[lane] == minT[lane] && objIndex < minTIndex[lane]))) {
+                minTIndex[lane] = objIndex;
+                minT[lane] = t[lane];
+            }
+        }
+    };
+    if (candidates != nullptr && candidates->size() <= PRIMARY_CANDIDATES_MAX) {
+        for (int objIndex : *candidates) {
+            inspect(objIndex, packet.activeMask);
+        }
+    } else {
+        scene.bvh.traversePacket(packet, minT, inspect);
+    }
+
+    for (int k = 0; k < count; ++k) {
+        if (activeFootprint != nullptr) {
+            if (minTIndex[k] >= 0) {
+                activeFootprint->touch(minTIndex[k]);
+            }
+            activeFootprint->addSegment(rays[k], grace, minTIndex[k] < 0 ? FLT_MAX : minT[k]);
+        }
+        results[k] = {minTIndex[k], minTIndex[k] < 0 ? -1 : minT[k]};
+    }
+}
+
+// Given point of intersection, unit direction to light source, light and scene
+// Calculates if there is a shadow cast on point of intersection by the light source
+// By casting a shadow ray from poi in unit direction to light source
+float shadowFactor(const Vector3D &poi, const Vector3D &Li, const Light &light, const Scene &scene) {
+    float S = 1;
+    Ray shadowRay(poi, Li);
+    pair<int, float> shadow_minTIndex_minT = traceRay(shadowRay, scene, SHADOW_GRACE);
+    // Shadow ray hit something
+    if (shadow_minTIndex_minT.first >= 0) {
+        if (light.type == 0) {
+            // Directional light => Shadow exists
+            S = 0;
+        } else {
+            // Positional light => Check for distance of hit
+            Vector3D hitPoint = shadowRay.pointAt(shadow_minTIndex_minT.second);
+            Vector3D hitVector = hitPoint - poi;
+            Vector3D lightVector = light.vector - poi;
+            if (hitVector.absSquare() < lightVector.absSquare()) {
+                S = 0;
+            }
+        }
+    }
+    return S;
+}
+
+// Returns T parameter of ray hitting the object with given global index (a triangle of an instance too, unlike
+// smallestNonNegativeT), -1 if it does not hit
+float objectT(const Ray &ray, const Scene &scene, int objIndex, float grace) {
+    if (objIndex < scene.noObjects()) {
+        return smallestNonNegativeT(ray, scene, objIndex, grace);
+    }
+    const Instance &instance = scene.instances[scene.instanceOf(objIndex)];
+    return smallestNonNegativeT(instance.transform.toObject(ray), scene.storedTriangleOf(objIndex), grace);
+}
+
+// Given point of intersection, unit direction to light source, light, its index in the scene (-1 if it is not one of
+// the scene's lights), scene and point on the light Li aims at
+// Foreach point of intersection by ray from poi to light source decreases shadow factor
+// With a last occluder cache, the opaque object that last blocked a shadow ray toward light is tested first, and if
+// it blocks this one too the shadow factor is 0 without traversing the hierarchy
+float shadowFactorSubtractive(const Vector3D &poi, const Vector3D &Li, const Light &light, int lightIndex,
+                              const Scene &scene, const Vector3D &lightPoint) {
+    float S = 1;
+    Ray shadowRay(poi, Li);
+    // Directional light => Shadow exists for every hit
+    // Positional light => Check for distance of hit (Li is unit, so hits beyond the light are skipped too)
+    Vector3D lightVector = lightPoint - poi;
+    float maxT = light.type == 0 ? FLT_MAX : lightVector.abs() * (1 + 1e-3) + SHADOW_GRACE;
+    auto blocks = [&](float t) {
+        return t >= 0 && (light.type == 0 || (shadowRay.pointAt(t) - poi).absSquare() < lightVector.absSquare());
+    };
+    // Lights are cached by their index, so a light that is not one of the scene's is not
+    OccluderCache *cache = lightIndex >= 0 ? activeOccluders : nullptr;
+    int lastOccluder = cache != nullptr ? cache->lastOccluder(lightIndex) : -1;
+    if (lastOccluder >= 0) {
+        cache->stats.lookups++;
+        if (blocks(objectT(shadowRay, scene, lastOccluder, SHADOW_GRACE))) {
+            cache->stats.hits++;
+            cache->stats.blocked++;
+            // Nothing else along the ray can change a shadow factor of 0, so the occluder is all it depends on
+            if (activeFootprint != nullptr) {
+                activeFootprint->touch(lastOccluder);
+                activeFootprint->addSegment(shadowRay, SHADOW_GRACE, light.type == 0 ? FLT_MAX : lightVector.abs());
+            }
+            return 0;
+        }
+    }
+    vector<int> occluders;
+    scene.bvh.traverse(shadowRay, 0, maxT, [&](int index) {
+        intersectObject(shadowRay, scene, index, SHADOW_GRACE, maxT, [&](int objIndex, float t) {
+            if (blocks(t)) {
+                occluders.push_back(objIndex);
+            }
+        });
+    });
+    // Attenuate in order of global index, so result does not depend on the order of traversal
+    sort(occluders.begin(), occluders.end());
+    int opaqueOccluder = -1;
+    for (int objIndex : occluders) {
+        const MaterialColor &color = scene.materialColorOf(objIndex);
+        S = S * (1 - color.opacity);
+        if (activeFootprint != nullptr) { activeFootprint->touch(objIndex); }
+        if (opaqueOccluder < 0 && color.opacity >= 1) {
+            opaqueOccluder = objIndex;
+        }
+    }
+    if (cache != nullptr && opaqueOccluder >= 0) {
+        cache->remember(lightIndex, opaqueOccluder);
+        cache->stats.blocked++;
+    }
+    if (activeFootprint != nullptr) {
+        activeFootprint->addSegment(shadowRay, SHADOW_GRACE, light.type == 0 ? FLT_MAX : lightVector.abs());
+    }
+    return S;
+}
+
+// Given point of intersection, unit direction to light source, light, its index (or -1) and scene
+float shadowFactorSubtractive(const Vector3D &poi, const Vector3D &Li, const Light &light, int lightIndex,
+                              const Scene &scene) {
+    return shadowFactorSubtractive(poi, Li, light, lightIndex, scene, light.vector);
+}
+
+// Order in which nU x nV strata (numbered row by row) of an area light are sampled
+// First come strata spread over the whole light, so that the probe rays among them see all of it:
+// corners of a quad, evenly spaced points of the rim of a sphere's disk (u is radius, v is angle there)
+vector<int> strataOrder(const Light &light, int nU, int nV) {
+    vector<int> order;
+    vector<bool> taken(nU * nV, false);
+    auto take = [&](int iu, int iv) {
+        int q = iv * nU + iu;
+        if (!taken[q]) {
+            taken[q] = true;
+            order.push_back(q);
+        }
+    };
+    if (light.type == LIGHT_QUAD) {
+        take(0, 0);
+        take(nU - 1, nV - 1);
+        take(nU - 1, 0);
+        take(0, nV - 1);
+    } else {
+        for (int k = 0; k < SHADOW_PROBE_RAYS; ++k) {
+            take(nU - 1, k * nV / SHADOW_PROBE_RAYS);
+        }
+    }
+    for (int q = 0; q < nU * nV; ++q) {
+        take(q % nU, q / nU);
+    }
+    return order;
+}
+
+// Fraction of light reaching poi from light, averaged over several shadow rays
+// Area lights are sampled at stratified points, point lights at jittered positions
+// SHADOW_PROBE_RAYS rays are cast first and only if they disagree (poi is in a penumbra)
+// is the rest of the budget (AREA_LIGHT_SAMPLES or NUM_SHADOW_RAYS_PER_POI) spent
+// lightIndex is the light's index in the scene, -1 if it is not one of the scene's lights (see shadowFactorSubtractive)
+float shadowFactorFor(const Vector3D &poi, const Light &light, int lightIndex, const Scene &scene) {
+    int nU = 1, nV = 1;
+    vector<int> order;
+    if (light.isArea()) {
+        nU = max(1, (int) sqrt((float) AREA_LIGHT_SAMPLES));
+        nV = max(1, AREA_LIGHT_SAMPLES / nU);
+        order = strataOrder(light, nU, nV);
+    }
+    int budget = light.isArea() ? nU * nV : NUM_SHADOW_RAYS_PER_POI;
+    int probes = min(budget, SHADOW_PROBE_RAYS);
+    float S = 0;
+    float firstS = 0;
+    bool agree = true;
+    for (int k = 0; k < budget; ++k) {
+        if (k == probes && agree) {
+            return S / probes;
+        }
+        float Sk;
+        if (light.isArea()) {
+            int q = order[k];
+            float u = (q % nU + getRandUniform()) / nU;
+            float v = (q / nU + getRandUniform()) / nV;
+            Vector3D lightPoint = light.pointOnLight(poi, u, v);
+            Sk = shadowFactorSubtractive(poi, (lightPoint - poi).unit(), light, lightIndex, scene, lightPoint);
+        } else {
+            Vector3D Lj = light.poiToLightUnitVector(poi, SOFT_SHADOW_JITTER);
+            Sk = shadowFactorSubtractive(poi, Lj, light, lightIndex, scene);
+        }
+        if (k == 0) {
+            firstS = Sk;
+        } else if (Sk != firstS) {
+            agree = false;
+        }
+        S += Sk;
+    }
+    return S / budget;
+}
+
+// Hit of triangle with given global index at poi (T parameter paramT)
+SurfaceHit surfaceHitFor(const Triangle &triangle, int objIndex, float paramT, const Vector3D &poi) {
+    // Normal and texture coordinates based on texture and smoothness
+    if (triangle.renderType == FLAT_TEXTURE_LESS) {
+        return SurfaceHit(objIndex, paramT, poi, triangle.surfaceNormal.unit(), TextureCoordinates());
+    } else if (triangle.renderType == FLAT_TEXTURED) {
+        return SurfaceHit(objIndex, paramT, poi, triangle.surfaceNormal.unit(),
+                          triangle.getInterpolatedTextureCoordinates(poi));
+    } else if (triangle.renderType == SMOOTH_TEXTURE_LESS) {
+        return SurfaceHit(objIndex, paramT, poi, triangle.getInterpolatedNormal(poi), TextureCoordinates());
+    } else {
+        return SurfaceHit(objIndex, paramT, poi, triangle.getInterpolatedNormal(poi),
+                          triangle.getInterpolatedTextureCoordinates(poi));
+    }
+}
+
+SurfaceHit surfaceHitFor(const Ray &ray, const Scene &scene, int objIndex, float paramT) {
+    int noSpheres = scene.spheres.size();
+    Vector3D poi = ray.pointAt(paramT);
+    if (objIndex < noSpheres) {
+        const Sphere &sphere = scene.spheres[objIndex];
+        Vector3D N = (poi - sphere.center).unit();
+        if (sphere.renderType == TEXTURE_LESS) {
+            return SurfaceHit(objIndex, paramT, poi, N, TextureCoordinates());
+        }
+        float phi = acosFast(N.y);
+        float theta = atan2Fast(N.x, N.z);
+        return SurfaceHit(objIndex, paramT, poi, N, TextureCoordinates((theta + M_PI) / (2 * M_PI), phi / M_PI));
+    }
+    if (objIndex < scene.noObjects() && !scene.compact.isEncoded(objIndex - noSpheres)) {
+        return surfaceHitFor(scene.storedTriangleOf(objIndex), objIndex, paramT, poi);
+    }
+    // Triangles of instances are moved into world space, compactly encoded ones decoded
+    return surfaceHitFor(scene.triangleAt(objIndex), objIndex, paramT, poi);
+}
+
+Color diffusionAt(const Scene &scene, const SurfaceHit &hit) {
+    int noSpheres = scene.spheres.size();
+    if (hit.objIndex < noSpheres) {
+        const Sphere &sphere = scene.spheres[hit.objIndex];
+        if (sphere.renderType == TEXTURE_LESS) {
+            return sphere.materialColor.diffusion;
+        }
+        return scene.textures[sphere.textureIndex].colorAt(hit.textureCoordinates);
+    }
+    int textureIndex = scene.textureIndexOf(hit.objIndex);
+    if (textureIndex < 0) {
+        return scene.materialColorOf(hit.objIndex).diffusion;
+    }
+    return scene.textures[textureIndex].colorAt(hit.textureCoordinates);
+}
+
+// Picks LIGHT_SAMPLES of the lights at lightIndices (with repetition) in proportion to their unshadowed
+// blinn-phong terms at poi, and sets weights so that the weighted sum over picked lights is on average the full sum
+// A light picked m times out of k with probability p each time gets weight m / (k * p), unpicked ones get 0
+void sampleLights(const Scene &scene, const vector<int> &lightIndices, const Vector3D &poi, const Vector3D &N,
+                  const Vector3D &V, const MaterialColor &color, vector<float> &weights) {
+    vector<float> estimates;
+    float total = 0;
+    for (int k : lightIndices) {
+        const Light &light = scene.lights[k];
+        Vector3D Li = (light.type == 0 ? light.vector * -1 : light.vector - poi).unit();
+        Vector3D Hi = (Li + V).unit();
+        float estimate = intensityOf(light) * (color.kd * max(0.0f, N.dot(Li)) +
+                                               color.ks * powInteger(max(0.0f, N.dot(Hi)), color.n));
+        estimates.push_back(estimate);
+        total += estimate;
+    }
+    vector<int> picks(lightIndices.size(), 0);
+    if (total > 0) {
+        for (int sample = 0; sample < LIGHT_SAMPLES; ++sample) {
+            float u = getRandUniform() * total;
+            size_t m = 0;
+            while (m + 1 < estimates.size() && (u >= estimates[m] || estimates[m] <= 0)) {
+                u -= estimates[m];
+                m++;
+            }
+            picks[m]++;
+        }
+    }
+    for (size_t m = 0; m < lightIndices.size(); ++m) {
+        weights[m] = picks[m] == 0 ? 0 : picks[m] * total / (LIGHT_SAMPLES * estimates[m]);
+    }
+}
+
+// Fraction of light with given index reaching poi, taken from the pixel shading cache if the primary hit being shaded
+// has it there and it is settled (see PixelShadingCache), added to it if it has none
+float cachedShadowFactorFor(const Vector3D &poi, int lightIndex, const Scene &scene) {
+    PixelShadingCache *cache = activePixelShading;
+    if (cache == nullptr || cache->current < 0) {
+        return shadowFactorFor(poi, scene.lights[lightIndex], lightIndex, scene);
+    }
+    float &cached = cache->entries[cache->current].shadowFactors[lightIndex];
+    if (cached == 0 || cached == 1) {
+        cache->stats.reusedShadowFactors++;
+        return cached;
+    }
+    float S = shadowFactorFor(poi, scene.lights[lightIndex], lightIndex, scene);
+    cache->stats.shadowFactors++;
+    if (cached < 0) {
+        cached = S;
+    }
+    return S;
+}
+
+// Sets lightIndices to the lights that can light poi and weights to what their terms are weighted by
+// Lights whose terms are bounded by LIGHT_CULL_THRESHOLD are skipped
+// If LIGHT_SAMPLES > 0 and more lights are left than that, only a weighted sample of them gets a non-zero weight
+void selectLights(const Scene &scene, const Vector3D &poi, const Vector3D &N, const Vector3D &V,
+                  const MaterialColor &color, vector<int> &lightIndices, vector<float> &weights) {
+    lightIndices.clear();
+    scene.lightTree.collect(scene.lights, poi, N, V, color.kd, color.ks, color.n, LIGHT_CULL_THRESHOLD,
+                            lightIndices);
+    weights.assign(lightIndices.size(), 1);
+    if (LIGHT_SAMPLES > 0 && lightIndices.size() > LIGHT_SAMPLES) {
+        sampleLights(scene, lightIndices, poi, N, V, color, weights);
+    }
+}
+
+// Adds second and third terms of blinn-phong model, with shadows, of the lights selectLights selects
+// Only lights with a non-zero weight are shadow tested
+// With a shading batch, the terms are gathered into it (after shadow testing) instead of added
+void addLightTerms(Color &phongColor, const Scene &scene, const Vector3D &poi, const Vector3D &N, const Vector3D &V,
+                   const Color &diffusion, const MaterialColor &color) {
+    vector<int> lightIndices;
+    vector<float> weights;
+    selectLights(scene, poi, N, V, color, lightIndices, weights);
+    for (size_t m = 0; m < lightIndices.size(); ++m) {
+        if (weights[m] == 0) {
+            continue;
+        }
+        const Light &light = scene.lights[lightIndices[m]];
+        // Shadow factor determination
+        float S = cachedShadowFactorFor(poi, lightIndices[m], scene);
+
+        // Second and third terms of blinn-phong model
+        Vector3D Li = light.poiToLightUnitVector(poi);
+        if (activeShadingBatch != nullptr) {
+            if (S > 0) {
+                activeShadingBatch->add(N, Li, V, diffusion, color.specular, color.kd, color.ks, color.n,
+                                        light.color * (S * weights[m]));
+            }
+            continue;
+        }
+        Vector3D Hi = (Li + V).unit();
+        Color secondTerm = diffusion * color.kd * max(0.0, (double) N.dot(Li));
+        Color thirdTerm = color.specular * color.ks * powInteger(max(0.0, (double) N.dot(Hi)), color.n);
+        Color weightedTerm = (secondTerm + thirdTerm) * light.color * (S * weights[m]);
+        phongColor = phongColor + weightedTerm;
+    }
+}
+
+// Adds second and third terms of blinn-phong model at poi of the triangle with given lightmap index, with the shadow
+// factors of its lightmap instead of casting shadow rays
+// Lights and their weights are the ones addLightTerms takes, so only how shadows are found differs
+// Terms are added even with a shading batch, as there is nothing to batch
+void addBakedLightTerms(Color &phongColor, const Scene &scene, int index, const Triangle &triangle,
+                        const Vector3D &poi, const Vector3D &N, const Vector3D &V, const Color &diffusion,
+                        const MaterialColor &color) {
+    // Buffers of the calling thread, reused by every hit it shades
+    static thread_local vector<int> lightIndices;
+    static thread_local vector<float> weights, shadowFactors;
+    selectLights(scene, poi, N, V, color, lightIndices, weights);
+    if (lightIndices.empty()) {
+        return;
+    }
+    shadowFactors.resize(scene.lights.size());
+    scene.lightmaps.shadowFactorsAt(index, triangle, poi, shadowFactors.data());
+    for (size_t m = 0; m < lightIndices.size(); ++m) {
+        float S = shadowFactors[lightIndices[m]];
+        if (weights[m] == 0 || S <= 0) {
+            continue;
+        }
+        const Light &light = scene.lights[lightIndices[m]];
+        Vector3D Li = light.poiToLightUnitVector(poi);
+        Vector3D Hi = (Li + V).unit();
+        Color secondTerm = diffusion * color.kd * max(0.0, (double) N.dot(Li));
+        Color thirdTerm = color.specular * color.ks * powInteger(max(0.0, (double) N.dot(Hi)), color.n);
+        phongColor = phongColor + (secondTerm + thirdTerm) * light.color * (S * weights[m]);
+    }
+}
+
+LightmapStats bakeLightmaps(Scene &scene, int resolution, int threads) {
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    int noSpheres = scene.spheres.size();
+    int noLights = scene.lights.size();
+    // Texels of about the same size on all triangles, resolution of them along the diagonal of the scene
+    Bounds bounds = sceneBoundsOf(scene);
+    float texelSize = bounds.isEmpty() ? 1 : (bounds.max - bounds.min).abs() / max(1, resolution);
+    vector<int> resolutions;
+    for (int objIndex = noSpheres; objIndex < scene.noObjects() && resolution > 0; ++objIndex) {
+        Triangle triangle = scene.triangleAt(objIndex);
+        float longestEdge = max((triangle.v2 - triangle.v1).abs(), max((triangle.v3 - triangle.v2).abs(),
+                                                                       (triangle.v1 - triangle.v3).abs()));
+        resolutions.push_back(max(1, min(resolution, (int) ceil(longestEdge / texelSize))));
+    }
+    Lightmaps &lightmaps = scene.lightmaps;
+    lightmaps.resize(resolutions, noLights);
+
+    threads = threads > 0 ? threads : max(1u, thread::hardware_concurrency());
+    threads = max(1, min(threads, lightmaps.noTriangles));
+    atomic<int> nextTriangle(0);
+    auto work = [&]() {
+        // Neighbouring texels are mostly shadowed by the same objects
+        OccluderCache occluders;
+        activeOccluders = SHADOW_OCCLUDER_CACHE ? &occluders : nullptr;
+        for (int k = nextTriangle++; k < lightmaps.noTriangles; k = nextTriangle++) {
+            // Random numbers are reseeded per triangle, so lightmaps are the same for any number of threads
+            seedRand(42 + k);
+            Triangle triangle = scene.triangleAt(noSpheres + k);
+            int r = lightmaps.resolutions[k];
+            for (int b = 0; b <= r; ++b) {
+                for (int a = 0; a + b <= r; ++a) {
+                    float beta = (float) a / r, gamma = (float) b / r;
+                    Vector3D poi = triangle.v1 * (1 - beta - gamma) + triangle.v2 * beta + triangle.v3 * gamma;
+                    float *texel = lightmaps.texelOf(k, a, b);
+                    for (int l = 0; l < noLights; ++l) {
+                        texel[l] = shadowFactorFor(poi, scene.lights[l], l, scene);
+                    }
+                }
+            }
+        }
+        activeOccluders = nullptr;
+    };
+    vector<thread> workers;
+    for (int t = 1; t < threads; ++t) {
+        workers.emplace_back(work);
+    }
+    work();
+    for (auto &worker : workers) {
+        worker.join();
+    }
+
+    LightmapStats stats;
+    stats.triangles = lightmaps.noTriangles;
+    stats.unbakedTriangles = scene.noInstancedTriangles();
+    stats.lights = noLights;
+    stats.maxResolution = resolutions.empty() ? 0 : *max_element(resolutions.begin(), resolutions.end());
+    stats.texels = noLights > 0 ? lightmaps.texels.size() / noLights : 0;
+    stats.shadowTests = lightmaps.texels.size();
+    stats.megabytes = (lightmaps.texels.size() * sizeof(float) + lightmaps.firstTexels.size() *
+                       (sizeof(size_t) + sizeof(int))) / 1048576.0f;
+    stats.seconds = chrono::duration<float>(chrono::steady_clock::now() - start).count();
+    return stats;
+}
+
+// Given ray, scene, intersecting object and hit
+// returns appropriate color to fill in the corresponding pixel of output image
+Color phongColorForSphere(const Ray &ray, const Scene &scene, const Vector3D &eye, const Sphere &sphere,
+                          const SurfaceHit &hit) {
+    // Blinn-phong illumination model
+    // I = Od * ka + Sum over lights [Si * Ilight (Od * kd * (N.L) + Os * ks * (N.H)^n)]
+    // Intersection with a sphere
+    MaterialColor color = sphere.materialColor;
+    const Vector3D &poi = hit.poi;
+    const Vector3D &N = hit.normal;
+    Vector3D V = (eye - poi).unit();
+    Color diffusion;
+    // Diffusion color based on texture
+    if (sphere.renderType == TEXTURE_LESS) {
+        diffusion = color.diffusion;
+    } else {
+        diffusion = scene.textures[sphere.textureIndex].colorAt(hit.textureCoordinates);
+    }
+    // First term of blinn-phong model
+    Color phongColor = diffusion * color.ka;
+    addLightTerms(phongColor, scene, poi, N, V, diffusion, color);
+
+    return phongColor;
+}
+
+// Given ray, scene, intersecting object and hit
+// returns appropriate color to fill in the corresponding pixel of output image
+Color phongColorForTriangle(const Ray &ray, const Scene &scene, const Vector3D &eye, const Triangle &triangle,
+                            const SurfaceHit &hit) {
+    // Blinn-phong illumination model
+    // I = Od * ka + Sum over lights [Si * Ilight (Od * kd * (N.L) + Os * ks * (N.H)^n)]
+    // Intersection with an Triangle
+    MaterialColor color = triangle.materialColor;
+    const Vector3D &poi = hit.poi;
+    const Vector3D &N = hit.normal;
+    Vector3D V = (eye - poi).unit();
+    Color diffusion;
+    // Diffusion color based on texture
+    if (triangle.renderType == FLAT_TEXTURE_LESS || triangle.renderType == SMOOTH_TEXTURE_LESS) {
+        diffusion = color.diffusion;
+    } else {
+        diffusion = scene.textures[triangle.textureIndex].colorAt(hit.textureCoordinates);
+    }
+    // First term of blinn-phong model
+    Color phongColor = diffusion * color.ka;
+    int index = hit.objIndex - scene.spheres.size();
+    if (index < scene.lightmaps.noTriangles) {
+        addBakedLightTerms(phongColor, scene, index, triangle, poi, N, V, diffusion, color);
+    } else {
+        addLightTerms(phongColor, scene, poi, N, V, diffusion, color);
+    }
+
+    return phongColor;
+}
+
+Color shadeHitRecursive(const Ray &ray, const Scene &scene, const Vector3D &eye, const SurfaceHit &hit,
+                        const float grace, const int depth, stack<float> refractiveIndices,
+                        stack<float> opacities) {
+    int objIndex = hit.objIndex;
+    int noSpheres = scene.spheres.size();
+
+    // no intersection with anything
+    if (hit.isMiss()) {
+        // return variant of bg color
+        return scene.bgColor;
+    }
+
+    Color reflectedColor;
+    Color transmittedColor;
+    Color tirColor;
+    const Vector3D &poi = hit.poi;
+    // ray intersects an object and can still recurse
+    if (depth > 0) {
+        const Vector3D I = (ray.origin - poi).unit();
+        const stack<float> refractiveIndicesCopy = refractiveIndices;
+        const float prevRI = refractiveIndicesCopy.top();
+        const stack<float> opacitiesCopy = opacities;
+
+        // next object RI, opacity and normal at POI
+        float nextRI = 0;
+        float nextOpacity = -1;
+        Vector3D N;
+        if (objIndex < noSpheres) {
+            Sphere sphere = scene.spheres[objIndex];
+            nextRI = sphere.materialColor.refractiveIndex;
+            nextOpacity = sphere.materialColor.opacity;
+            N = (poi - sphere.center).unit();
+        } else {
+            Triangle triangle = scene.triangleAt(objIndex);
+            nextRI = triangle.materialColor.refractiveIndex;
+            nextOpacity = triangle.materialColor.opacity;
+            N = triangle.surfaceNormal.unit();
+        }
+
+        // Entering or exiting object
+        if (N.dot(I) < 0) {
+            // Case refers to ray exiting object
+            // Correcting normal
+            N = N * -1;
+            // Removing top of refractive indices and opacities stack
+            if (refractiveIndices.size() > 1) {
+                refractiveIndices.pop();
+            }
+            if (opacities.size() > 1) {
+                opacities.pop();
+            }
+            // Correcting nextRI and nextOpacity
+            nextRI = refractiveIndices.top();
+            nextOpacity = opacities.top();
+        } else {
+            refractiveIndices.push(nextRI);
+            opacities.push(nextOpacity);
+        }
+
+        const float cosThetaI = N.dot(I);
+        const float F0 = powInteger((nextRI - prevRI) / (nextRI + prevRI), 2);
+
+        // Reflection
+        const float Fr = F0 + (1 - F0) * powInteger((1 - cosThetaI), 5);
+        const Vector3D R = (N * 2 * cosThetaI - I).unit();
+        const Ray reflectedRay(poi, R);
+        // the nextRI = prevRI as ray doesn't leave medium
+        {
+            ThroughputScope scope(activeShadingBatch, Fr);
+            reflectedColor = traceRayRecursive(reflectedRay, scene, eye, grace, depth - 1, refractiveIndicesCopy,
+                                               opacitiesCopy);
+        }
+        reflectedColor = reflectedColor * Fr;
+
+        // Refraction
+        const float underSqrtTerm = 1 - (powInteger((prevRI / nextRI), 2) * (1 - powInteger(cosThetaI, 2)));
+        if (underSqrtTerm >= 0) {
+            // normal refraction
+            const Vector3D T = (N * -sqrt(underSqrtTerm) + (N * cosThetaI - I) * (prevRI / nextRI)).unit();
+            const Ray transmittedRay(poi, T);
+            {
+                ThroughputScope scope(activeShadingBatch, (1 - Fr) * (1 - nextOpacity));
+                transmittedColor = traceRayRecursive(transmittedRay, scene, eye, grace, depth - 1, refractiveIndices,
+                                                     opacities);
+            }
+            transmittedColor = transmittedColor * (1 - Fr) * (1 - nextOpacity);
+        } else {
+            // total internal reflection
+            // this can be optimized as this tracing is same as the reflected ray tracing in the same recursion depth
+            {
+                ThroughputScope scope(activeShadingBatch, 1 - Fr);
+                tirColor = traceRayRecursive(reflectedRay, scene, eye, grace, depth - 1, refractiveIndicesCopy,
+                                             opacitiesCopy);
+            }
+            tirColor = tirColor * (1 - Fr);
+        }
+    }
+
+    // phongColor = ambient + diffuse + specular + shadows
+    Color phongColor;
+    if (activeOccluders != nullptr) {
+        activeOccluders->depth = depth;
+    }
+    // Primary hits of a pixel's depth of field samples share shadow factors
+    bool primaryHit = activePixelShading != nullptr && depth == RECURSIVE_DEPTH;
+    if (primaryHit) {
+        activePixelShading->begin(objIndex, poi, eye, scene.lights.size());
+    }
+    if (objIndex < noSpheres) {
+        Sphere sphere = scene.spheres[objIndex];
+        phongColor = phongColorForSphere(ray, scene, eye, sphere, hit);
+    } else {
+        Triangle triangle = scene.triangleAt(objIndex);
+        phongColor = phongColorForTriangle(ray, scene, eye, triangle, hit);
+    }
+    if (primaryHit) {
+        activePixelShading->end();
+    }
+    return phongColor + reflectedColor + transmittedColor + tirColor;
+}
+
+// Hit of ray given what traceRay returned for it
+SurfaceHit surfaceHitOf(const Ray &ray, const Scene &scene, const pair<int, float> &minTIndex_minT) {
+    if (minTIndex_minT.first < 0) {
+        return SurfaceHit();
+    }
+    return surfaceHitFor(ray, scene, minTIndex_minT.first, minTIndex_minT.second);
+}
+
+SurfaceHit traceSurfaceHit(const Ray &ray, const Scene &scene, const float grace, const vector<int> *candidates) {
+    return surfaceHitOf(ray, scene, traceRay(ray, scene, grace, candidates));
+}
+
+// Returns what traceRay returns for the camera ray of (i, j) pixel of the camera's image, if its camera rays are not
+// jittered
+// With a packet hit cache, the rays of the 2x2 block of pixels whose top left pixel this is are traced together as
+// a packet (if they are of the same tile, so that candidates are theirs too), and the others' hits cached
+pair<int, float> traceCameraRay(const Ray &ray, const Scene &scene, const Camera &camera, int i, int j,
+                                const vector<int> *candidates) {
+    // Pixels are keyed by their index in the image rendered, which need not be of the scene file's size
+    int pixel = j * camera.width + i;
+    pair<int, float> hit;
+    if (activePacketHits == nullptr || !CAMERA_RAY_PACKETS || camera.rayJitter > 0) {
+        return traceRay(ray, scene, RECURSIVE_RAY_GRACE, candidates);
+    }
+    if (activePacketHits->take(pixel, hit)) {
+        return hit;
+    }
+    bool blockCorner = i % 2 == 0 && j % 2 == 0;
+    bool sameTile = i / TILE_SIZE == (i + 1) / TILE_SIZE && j / TILE_SIZE == (j + 1) / TILE_SIZE;
+    if (!blockCorner || !sameTile) {
+        return traceRay(ray, scene, RECURSIVE_RAY_GRACE, candidates);
+    }
+    Ray rays[PACKET_SIZE];
+    int pixels[PACKET_SIZE];
+    int count = 0;
+    for (int dj = 0; dj < 2 && j + dj < camera.height; ++dj) {
+        for (int di = 0; di < 2 && i + di < camera.width; ++di) {
+            rays[count] = di == 0 && dj == 0 ? ray : camera.rayThrough(i + di, j + dj, 0);
+            pixels[count++] = (j + dj) * camera.width + i + di;
+        }
+    }
+    if (count == 0) {
+        return traceRay(ray, scene, RECURSIVE_RAY_GRACE, candidates);
+    }
+    pair<int, float> results[PACKET_SIZE];
+    traceRayPacket(rays, count, scene, RECURSIVE_RAY_GRACE, candidates, results);
+    for (int k = 1; k < count; ++k) {
+        activePacketHits->put(pixels[k], results[k]);
+    }
+    return results[0];
+}
+
+Color traceRayRecursive(const Ray &ray, const Scene &scene, const Vector3D &eye, const float grace,
+                        const int depth, stack<float> refractiveIndices, stack<float> opacities) {
+    SurfaceHit hit = traceSurfaceHit(ray, scene, grace);
+    return shadeHitRecursive(ray, scene, eye, hit, grace, depth, refractiveIndices, opacities);
+}
+
+Color renderPixel(const Scene &scene, const Camera &camera, int i, int j, GBuffer *gBuffer,
+                  const vector<int> *candidates) {
+    // trace this ray in the scene recursively to produce a color for the pixel
+    stack<float> refractiveIndices;
+    refractiveIndices.push(CAMERA_MEDIUM_REFRACTIVE_INDEX);
+    stack<float> opacities;
+    opacities.push(CAMERA_MEDIUM_OPACITY);
+
+    int samplesPerPixel = camera.samplesPerPixel;
+    float rayJitter = camera.rayJitter;
+    bool gBufferCached = gBuffer != nullptr && gBuffer->isComplete();
+    // Terms gathered into the shading batch are averaged like the colors of the rays
+    ThroughputScope scope(activeShadingBatch, samplesPerPixel > 1 ? 1.0f / samplesPerPixel : 1);
+    // With depth of field, rays of all samples are created first and traced as packets
+    vector<Ray> rays;
+    vector<pair<int, float> > rayHits;
+    if (!gBufferCached && CAMERA_RAY_PACKETS && samplesPerPixel > 1) {
+        for (int sample = 0; sample < samplesPerPixel; sample++) {
+            rays.push_back(camera.rayThrough(i, j, rayJitter));
+        }
+        rayHits.resize(samplesPerPixel);
+        for (int sample = 0; sample < samplesPerPixel; sample += PACKET_SIZE) {
+            traceRayPacket(&rays[sample], min(PACKET_SIZE, samplesPerPixel - sample), scene, RECURSIVE_RAY_GRACE,
+                           candidates, &rayHits[sample]);
+        }
+    }
+    // Samples share shadows only with the other samples of their pixel
+    if (activePixelShading != nullptr) {
+        activePixelShading->clear();
+    }
+    Color pixelColor;
+    for (int sample = 0; sample < samplesPerPixel; sample++) {
+        // Create ray (with jitter to ray origin) and find its first hit, unless both are cached
+        Ray ray = gBufferCached ? gBuffer->rayAt(i, j, sample)
+                                : !rays.empty() ? rays[sample] : camera.rayThrough(i, j, rayJitter);
+        SurfaceHit hit = gBufferCached ? gBuffer->hitAt(i, j, sample)
+                                       : surfaceHitOf(ray, scene, !rayHits.empty() ? rayHits[sample]
+                                                                  : traceCameraRay(ray, scene, camera, i, j,
+                                                                                   candidates));
+        if (gBuffer != nullptr && !gBufferCached) {
+            gBuffer->add(ray, hit);
+        }
+        if (activeDenoiseGuides != nullptr) {
+            activeDenoiseGuides->add(j * activeDenoiseGuides->width + i, ray, hit,
+                                     hit.isMiss() ? Color() : diffusionAt(scene, hit),
+                                     samplesPerPixel > 1 ? 1.0f / samplesPerPixel : 1);
+        }
+        Color color = shadeHitRecursive(ray, scene, camera.eye, hit,
+                                        RECURSIVE_RAY_GRACE, RECURSIVE_DEPTH,
+                                        refractiveIndices,
+                                        opacities);
+        // Keep track of color
+        pixelColor = pixelColor + color;
+    }
+    if (samplesPerPixel > 1) {
+        pixelColor = pixelColor * (1.0 / samplesPerPixel);
+    }
+    return pixelColor;
+}
+
+// Sets [i0, i1] x [j0, j1] to the pixels whose camera rays (with origins jittered by up to jitter) can hit something
+// in box (with a margin for rounding), returns false if there are none
+bool pixelRangeOf(const Camera &camera, const Bounds &box, int width, int height, float jitter, int &i0, int &j0,
+                  int &i1, int &j1) {
+    Vector3D W = camera.viewDir.unit();
+    float minI = FLT_MAX, minJ = FLT_MAX, maxI = -FLT_MAX, maxJ = -FLT_MAX;
+    // Bounds over corners of |z - d| / (z - jitter) and |X| / z, X being a corner relative to the eye and z its depth
+    float maxFocusRatio = 0, maxSecant = 0;
+    for (int corner = 0; corner < 8; ++corner) {
+        Vector3D p((corner & 1) ? box.max.x : box.min.x, (corner & 2) ? box.max.y : box.min.y,
+                   (corner & 4) ? box.max.z : box.min.z);
+        if (!camera.isParallelProjection) {
+            // Box reaching behind the eye (or its jittered origins) projects to no bounded range, every pixel may see it
+            float z = (p - camera.eye).dot(W);
+            if (z <= jitter) {
+                minI = minJ = -FLT_MAX;
+                maxI = maxJ = FLT_MAX;
+                break;
+            }
+            maxFocusRatio = max(maxFocusRatio, fabs(z - camera.d) / (z - jitter));
+            maxSecant = max(maxSecant, (p - camera.eye).abs() / z);
+            // Point on viewing window in line with the eye and the corner
+            p = camera.eye + (p - camera.eye) * (camera.d / z);
+        }
+        // Parallel rays are along W, which is normal to both pixel steps, so the corner itself gives the pixel
+        float i = (p - camera.ul).dot(camera.delWidth) / camera.delWidth.absSquare();
+        float j = (p - camera.ul).dot(camera.delHeight) / camera.delHeight.absSquare();
+        minI = min(minI, i);
+        maxI = max(maxI, i);
+        minJ = min(minJ, j);
+        maxJ = max(maxJ, j);
+    }
+    // A ray from origin jittered by up to jitter through a point at depth z crosses the viewing window at most
+    // jitter * |z - d| / (z - jitter) * (1 + |X| / z) away from the eye's ray through it
+    // Parallel rays are only shifted by the jitter
+    float shift = camera.isParallelProjection ? jitter : jitter * maxFocusRatio * (1 + maxSecant);
+    float margin = shift / min(camera.delWidth.abs(), camera.delHeight.abs()) + PROJECTED_BOUNDS_MARGIN;
+    i0 = (int) max(0.0f, ceil(max(minI, -1.0f) - margin));
+    j0 = (int) max(0.0f, ceil(max(minJ, -1.0f) - margin));
+    i1 = (int) min(width - 1.0f, floor(min(maxI, (float) width) + margin));
+    j1 = (int) min(height - 1.0f, floor(min(maxJ, (float) height) + margin));
+    return i0 <= i1 && j0 <= j1;
+}
+
+bool rasterizePrimaryHits(const Scene &scene, const Camera &camera, GBuffer &gBuffer) {
+    if (camera.rayJitter > 0 || camera.samplesPerPixel != 1) {
+        return false;
+    }
+    int width = scene.imWidth, height = scene.imHeight;
+    vector<Ray> rays;
+    rays.reserve((size_t) width * height);
+    for (int j = 0; j < height; j++) {
+        for (int i = 0; i < width; i++) {
+            rays.push_back(camera.rayThrough(i, j, 0));
+        }
+    }
+    // Visibility buffer: nearest object and its T for every pixel
+    vector<int> objIndices(rays.size(), -1);
+    vector<float> depths(rays.size(), FLT_MAX);
+    int noObjects = scene.noObjects() + scene.instances.size();
+    // Objects in order of global index (instances last, as their triangles), so that of equally near hits the first
+    // one stays like in traceRay
+    for (int index = 0; index < noObjects; ++index) {
+        Bounds box = scene.hierarchyBoundsOf(index);
+        int i0, j0, i1, j1;
+        if (!pixelRangeOf(camera, box, width, height, 0, i0, j0, i1, j1)) {
+            continue;
+        }
+        for (int j = j0; j <= j1; j++) {
+            for (int i = i0; i <= i1; i++) {
+                size_t pixel = (size_t) j * width + i;
+                intersectObject(rays[pixel], scene, index, RECURSIVE_RAY_GRACE, depths[pixel],
+                                [&](int objIndex, float t) {
+                                    if (t < depths[pixel] || (t == depths[pixel] && objIndex < objIndices[pixel])) {
+                                        objIndices[pixel] = objIndex;
+                                        depths[pixel] = t;
+                                    }
+                                });
+            }
+        }
+    }
+    for (size_t pixel = 0; pixel < rays.size(); ++pixel) {
+        gBuffer.add(rays[pixel], objIndices[pixel] < 0 ? SurfaceHit()
+                                                       : surfaceHitFor(rays[pixel], scene, objIndices[pixel],
+                                                                       depths[pixel]));
+    }
+    return true;
+}
+
+vector<vector<int> > primaryCandidatesOf(const Scene &scene, const Camera &camera, int width, int height,
+                                        const vector<Tile> &tiles, int tileSize) {
+    vector<vector<int> > candidates(tiles.size());
+    if (tiles.empty()) {
+        return candidates;
+    }
+    // Tiles are a rectangle of the grid of tiles, row by row
+    int firstColumn = tiles.front().x0 / tileSize, firstRow = tiles.front().y0 / tileSize;
+    int columns = tiles.back().x0 / tileSize - firstColumn + 1;
+    int lastColumn = firstColumn + columns - 1, lastRow = tiles.back().y0 / tileSize;
+    int noObjects = scene.noObjects() + scene.instances.size();
+    for (int objIndex = 0; objIndex < noObjects; ++objIndex) {
+        Bounds box = scene.hierarchyBoundsOf(objIndex);
+        int i0, j0, i1, j1;
+        if (!pixelRangeOf(camera, box, width, height, camera.rayJitter, i0, j0, i1, j1)) {
+            continue;
+        }
+        for (int row = max(firstRow, j0 / tileSize); row <= min(lastRow, j1 / tileSize); ++row) {
+            for (int column = max(firstColumn, i0 / tileSize); column <= min(lastColumn, i1 / tileSize); ++column) {
+                // Once there are too many, traceRay does not use them, so that only needs to be seen
+                vector<int> &tileCandidates = candidates[(row - firstRow) * columns + column - firstColumn];
+                if (tileCandidates.size() <= PRIMARY_CANDIDATES_MAX) {
+                    tileCandidates.push_back(objIndex);
+                }
+            }
+        }
+    }
+    return candidates;
+}
+
+RenderStats renderImage(const Scene &scene, const Camera &camera, vector<vector<Color> > &colors, GBuffer *gBuffer,
+                        DenoiseGuides *guides) {
+    vector<Tile> tiles = tilesOf(scene.imWidth, scene.imHeight, TILE_SIZE);
+    vector<vector<int> > candidates = primaryCandidatesOf(scene, camera, scene.imWidth, scene.imHeight, tiles,
+                                                          TILE_SIZE);
+    int tilesPerRow = (scene.imWidth + TILE_SIZE - 1) / TILE_SIZE;
+    // Light terms are added to pixels as they are shaded, so pixels start black
+    ShadingBatch batch(SHADING_BATCH_SIZE, [&colors, &scene](int pixel, const Color &color) {
+        Color &pixelColor = colors[pixel % scene.imWidth][pixel / scene.imWidth];
+        pixelColor = pixelColor + color;
+    });
+    activeShadingBatch = SHADING_BATCH_SIZE > 0 ? &batch : nullptr;
+    PacketHitCache packetHits;
+    activePacketHits = &packetHits;
+    activeDenoiseGuides = guides;
+    OccluderCache occluders;
+    activeOccluders = SHADOW_OCCLUDER_CACHE ? &occluders : nullptr;
+    PixelShadingCache pixelShading(DOF_SHADING_TOLERANCE);
+    activePixelShading = DOF_SHADING_TOLERANCE > 0 && camera.samplesPerPixel > 1 ? &pixelShading : nullptr;
+    // Ray tracing per pixel
+    for (int j = 0; j < scene.imHeight; j++) {
+        for (int i = 0; i < scene.imWidth; i++) {
+            batch.pixel = j * scene.imWidth + i;
+            colors[i][j] = Color();
+            Color color = renderPixel(scene, camera, i, j, gBuffer,
+                                      &candidates[j / TILE_SIZE * tilesPerRow + i / TILE_SIZE]);
+            colors[i][j] = colors[i][j] + color;
+
+            // Show progress
+            if (i == 0) {
+                printf("Rendering: %d%% complete\r", (int) ((float) (j + 1) * 100 / scene.imHeight));
+            }
+        }
+    }
+    batch.shade();
+    activeShadingBatch = nullptr;
+    activePacketHits = nullptr;
+    activeDenoiseGuides = nullptr;
+    activeOccluders = nullptr;
+    activePixelShading = nullptr;
+    RenderStats stats;
+    stats.occluders = occluders.stats;
+    stats.pixelShading = pixelShading.stats;
+    return stats;
+}
+
+void renderTile(const Scene &scene, const Camera &camera, const Tile &tile, vector<vector<Color> > &colors,
+                TileFootprint *footprint, const vector<int> *candidates) {
+    seedRand(42 + tile.index);
+    activeFootprint = footprint;
+    // Light terms are added to pixels as they are shaded, so pixels start black
+    ShadingBatch batch(SHADING_BATCH_SIZE, [&colors, &tile](int pixel, const Color &color) {
+        Color &pixelColor = colors[tile.x0 + pixel % tile.width()][tile.y0 + pixel / tile.width()];
+        pixelColor = pixelColor + color;
+    });
+    activeShadingBatch = SHADING_BATCH_SIZE > 0 ? &batch : nullptr;
+    PacketHitCache packetHits;
+    activePacketHits = &packetHits;
+    OccluderCache occluders;
+    activeOccluders = SHADOW_OCCLUDER_CACHE ? &occluders : nullptr;
+    PixelShadingCache pixelShading(DOF_SHADING_TOLERANCE);
+    activePixelShading = DOF_SHADING_TOLERANCE > 0 && camera.samplesPerPixel > 1 ? &pixelShading : nullptr;
+    for (int j = tile.y0; j < tile.y1; j++) {
+        for (int i = tile.x0; i < tile.x1; i++) {
+            batch.pixel = (j - tile.y0) * tile.width() + i - tile.x0;
+            colors[i][j] = Color();
+            Color color = renderPixel(scene, camera, i, j, nullptr, candidates);
+            colors[i][j] = colors[i][j] + color;
+        }
+    }
+    batch.shade();
+    activeShadingBatch = nullptr;
+    activePacketHits = nullptr;
+    activeOccluders = nullptr;
+    activePixelShading = nullptr;
+    activeFootprint = nullptr;
+}
+
+vector<vector<Color> > blankImage(int width, int height) {
+    vector<vector<Color> > colors;
+    for (int i = 0; i < width; i++) {
+        vector<Color> col;
+        col.resize(height);
+        colors.push_back(col);
+    }
+    return colors;
+}
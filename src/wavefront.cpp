@@ -0,0 +1,223 @@
+#include <algorithm>
+#include <cstdint>
+#include "render.hpp"
+#include "shading.hpp"
+#include "reorder.hpp"
+#include "wavefront.hpp"
+
+using namespace std;
+
+// Sorts rays by the octant of their direction, and along a Morton curve of their origins within an octant, so that
+// rays traced one after the other take the same way through the hierarchy
+// Camera rays share their origin, so they keep their row by row order within an octant
+void sortRays(vector<PathRay> &rays, const Bounds &bounds) {
+    vector<pair<uint64_t, int>> keys;
+    keys.reserve(rays.size());
+    for (size_t k = 0; k < rays.size(); ++k) {
+        const Vector3D &direction = rays[k].ray.direction;
+        uint64_t octant = (direction.x < 0 ? 1 : 0) | (direction.y < 0 ? 2 : 0) | (direction.z < 0 ? 4 : 0);
+        keys.emplace_back(octant << 32 | mortonCode(rays[k].ray.origin, bounds), k);
+    }
+    sort(keys.begin(), keys.end());
+    vector<PathRay> sorted;
+    sorted.reserve(rays.size());
+    for (const auto &key : keys) {
+        sorted.push_back(rays[key.second]);
+    }
+    rays.swap(sorted);
+}
+
+// Queues ray into the next wave, unless nothing it finds can show
+void spawnRay(vector<PathRay> &next, const PathRay &ray, WavefrontStats &stats) {
+    if (ray.throughput == 0) {
+        stats.skippedRays++;
+        return;
+    }
+    next.push_back(ray);
+    stats.secondaryRays++;
+}
+
+// Reflected and transmitted rays of the hit of parent, as shadeHitRecursive traces them
+void spawnSecondaryRays(const Scene &scene, const PathRay &parent, const SurfaceHit &hit, vector<PathRay> &next,
+                        WavefrontStats &stats) {
+    int objIndex = hit.objIndex;
+    int noSpheres = scene.spheres.size();
+    const Vector3D &poi = hit.poi;
+    const Vector3D I = (parent.ray.origin - poi).unit();
+    const float prevRI = parent.media.topRefractiveIndex();
+    MediumStack media = parent.media;
+
+    // next object RI, opacity and normal at POI
+    const MaterialColor &color = scene.materialColorOf(objIndex);
+    float nextRI = color.refractiveIndex;
+    float nextOpacity = color.opacity;
+    Vector3D N = objIndex < noSpheres ? (poi - scene.spheres[objIndex].center).unit()
+                                      : scene.triangleAt(objIndex).surfaceNormal.unit();
+
+    // Entering or exiting object
+    if (N.dot(I) < 0) {
+        N = N * -1;
+        media.pop();
+        nextRI = media.topRefractiveIndex();
+        nextOpacity = media.topOpacity();
+    } else {
+        media.push(nextRI, nextOpacity);
+    }
+
+    const float cosThetaI = N.dot(I);
+    const float F0 = powInteger((nextRI - prevRI) / (nextRI + prevRI), 2);
+
+    // Reflection, the reflected ray stays in the medium of its parent
+    const float Fr = F0 + (1 - F0) * powInteger((1 - cosThetaI), 5);
+    const Vector3D R = (N * 2 * cosThetaI - I).unit();
+    const Ray reflectedRay(poi, R);
+
+    // Refraction
+    const float underSqrtTerm = 1 - (powInteger((prevRI / nextRI), 2) * (1 - powInteger(cosThetaI, 2)));
+    if (underSqrtTerm >= 0) {
+        spawnRay(next, PathRay(reflectedRay, parent.pixel, parent.throughput * Fr, parent.depth - 1, parent.media),
+                 stats);
+        const Vector3D T = (N * -sqrt(underSqrtTerm) + (N * cosThetaI - I) * (prevRI / nextRI)).unit();
+        spawnRay(next, PathRay(Ray(poi, T), parent.pixel, parent.throughput * ((1 - Fr) * (1 - nextOpacity)),
+                               parent.depth - 1, media), stats);
+    } else {
+        // Total internal reflection traces the reflected ray again (in the same medium), with weight 1 - Fr
+        // So the reflected ray is traced once with both weights
+        spawnRay(next, PathRay(reflectedRay, parent.pixel, parent.throughput * (Fr + (1 - Fr)), parent.depth - 1,
+                               parent.media), stats);
+        stats.mergedRays++;
+    }
+}
+
+WavefrontStats renderImageWavefront(const Scene &scene, const Camera &camera, vector<vector<Color> > &colors,
+                                    DenoiseGuides *guides) {
+    WavefrontStats stats;
+    int width = scene.imWidth, height = scene.imHeight;
+    vector<Tile> tiles = tilesOf(width, height, TILE_SIZE);
+    vector<vector<int> > candidates = primaryCandidatesOf(scene, camera, width, height, tiles, TILE_SIZE);
+    int tilesPerRow = (width + TILE_SIZE - 1) / TILE_SIZE;
+    Bounds bounds = sceneBoundsOf(scene);
+    auto addToPixel = [&colors, width](int pixel, const Color &color) {
+        Color &pixelColor = colors[pixel % width][pixel / width];
+        pixelColor = pixelColor + color;
+    };
+    ShadingBatch batch(SHADING_BATCH_SIZE, addToPixel);
+    // Shadow queries are sorted by light, so consecutive ones mostly end on the same occluder
+    OccluderCache occluders;
+    activeOccluders = SHADOW_OCCLUDER_CACHE ? &occluders : nullptr;
+
+    int samplesPerPixel = camera.samplesPerPixel;
+    float sampleWeight = samplesPerPixel > 1 ? 1.0f / samplesPerPixel : 1;
+    int rowsPerChunk = max(1, WAVEFRONT_CAMERA_RAYS / max(1, width * samplesPerPixel));
+    vector<PathRay> rays, next;
+    vector<SurfaceHit> hits;
+    vector<int> order;
+    vector<Color> diffusions;
+    vector<ShadowQuery> queries;
+    vector<int> lightIndices;
+    vector<float> weights;
+    for (int j0 = 0; j0 < height; j0 += rowsPerChunk) {
+        int j1 = min(height, j0 + rowsPerChunk);
+        // Generate: camera rays of the chunk, pixels start black as everything is added to them
+        rays.clear();
+        for (int j = j0; j < j1; j++) {
+            for (int i = 0; i < width; i++) {
+                colors[i][j] = Color();
+                const vector<int> *tileCandidates = &candidates[j / TILE_SIZE * tilesPerRow + i / TILE_SIZE];
+                for (int sample = 0; sample < samplesPerPixel; sample++) {
+                    rays.emplace_back(camera.rayThrough(i, j, camera.rayJitter), j * width + i, sampleWeight,
+                                      RECURSIVE_DEPTH,
+                                      MediumStack(CAMERA_MEDIUM_REFRACTIVE_INDEX, CAMERA_MEDIUM_OPACITY),
+                                      tileCandidates);
+                }
+            }
+        }
+        stats.cameraRays += rays.size();
+
+        for (bool cameraWave = true; !rays.empty(); cameraWave = false) {
+            stats.waves++;
+            // Intersect
+            sortRays(rays, bounds);
+            hits.clear();
+            for (const PathRay &ray : rays) {
+                hits.push_back(traceSurfaceHit(ray.ray, scene, RECURSIVE_RAY_GRACE, ray.candidates));
+            }
+            if (guides != nullptr && cameraWave) {
+                for (size_t k = 0; k < rays.size(); ++k) {
+                    guides->add(rays[k].pixel, rays[k].ray, hits[k],
+                                hits[k].isMiss() ? Color() : diffusionAt(scene, hits[k]), sampleWeight);
+                }
+            }
+
+            // Shade: misses first, then hits object by object
+            order.resize(rays.size());
+            for (size_t k = 0; k < order.size(); ++k) {
+                order[k] = k;
+            }
+            stable_sort(order.begin(), order.end(), [&hits](int a, int b) {
+                return hits[a].objIndex < hits[b].objIndex;
+            });
+            diffusions.resize(rays.size());
+            queries.clear();
+            for (int k : order) {
+                const SurfaceHit &hit = hits[k];
+                if (hit.isMiss()) {
+                    addToPixel(rays[k].pixel, scene.bgColor * rays[k].throughput);
+                    continue;
+                }
+                const MaterialColor &color = scene.materialColorOf(hit.objIndex);
+                Vector3D V = (camera.eye - hit.poi).unit();
+                diffusions[k] = diffusionAt(scene, hit);
+                // First term of blinn-phong model
+                addToPixel(rays[k].pixel, diffusions[k] * color.ka * rays[k].throughput);
+                lightIndices.clear();
+                scene.lightTree.collect(scene.lights, hit.poi, hit.normal, V, color.kd, color.ks, color.n,
+                                        LIGHT_CULL_THRESHOLD, lightIndices);
+                weights.assign(lightIndices.size(), 1);
+                if (LIGHT_SAMPLES > 0 && lightIndices.size() > LIGHT_SAMPLES) {
+                    sampleLights(scene, lightIndices, hit.poi, hit.normal, V, color, weights);
+                }
+                for (size_t m = 0; m < lightIndices.size(); ++m) {
+                    if (weights[m] != 0) {
+                        queries.emplace_back(k, lightIndices[m], weights[m]);
+                    }
+                }
+            }
+
+            // Shadow: second and third terms of blinn-phong model of the lights reaching the hits
+            stable_sort(queries.begin(), queries.end(), [](const ShadowQuery &a, const ShadowQuery &b) {
+                return a.light < b.light;
+            });
+            stats.shadowQueries += queries.size();
+            for (const ShadowQuery &query : queries) {
+                const SurfaceHit &hit = hits[query.hit];
+                const Light &light = scene.lights[query.light];
+                float S = shadowFactorFor(hit.poi, light, query.light, scene);
+                Vector3D Li = light.poiToLightUnitVector(hit.poi);
+                if (S > 0) {
+                    const MaterialColor &color = scene.materialColorOf(hit.objIndex);
+                    batch.pixel = rays[query.hit].pixel;
+                    batch.throughput = rays[query.hit].throughput;
+                    batch.add(hit.normal, Li, (camera.eye - hit.poi).unit(), diffusions[query.hit], color.specular,
+                              color.kd, color.ks, color.n, light.color * (S * query.weight));
+                }
+            }
+
+            // Secondary: rays of hits that can still recurse
+            next.clear();
+            for (int k : order) {
+                if (!hits[k].isMiss() && rays[k].depth > 0) {
+                    spawnSecondaryRays(scene, rays[k], hits[k], next, stats);
+                }
+            }
+            rays.swap(next);
+        }
+        batch.shade();
+
+        // Show progress
+        printf("Rendering: %d%% complete\r", (int) ((float) j1 * 100 / height));
+    }
+    activeOccluders = nullptr;
+    stats.occluders = occluders.stats;
+    return stats;
+}
@@ -0,0 +1,97 @@
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include "yart.hpp"
+#include "shading.hpp"
+
+using namespace std;
+
+unique_ptr<Scene> loadScene(const string &filename, TextureCache *textureCache) {
+    unique_ptr<Scene> scene(new Scene(filename));
+    scene->textureCache = textureCache;
+    if (!scene->parse()) {
+        return nullptr;
+    }
+    return scene;
+}
+
+bool render(const Scene &scene, const RenderOptions &options, float *framebuffer) {
+    int width = options.width > 0 ? options.width : scene.imWidth;
+    int height = options.height > 0 ? options.height : scene.imHeight;
+    bool wholeImage = options.x1 <= options.x0 || options.y1 <= options.y0;
+    int x0 = wholeImage ? 0 : options.x0, y0 = wholeImage ? 0 : options.y0;
+    int x1 = wholeImage ? width : options.x1, y1 = wholeImage ? height : options.y1;
+    if (framebuffer == nullptr || width < 2 || height < 2 || x0 < 0 || y0 < 0 || x1 > width || y1 > height) {
+        return false;
+    }
+    if (options.overrideCamera && (options.vFovDeg <= 0 || options.vFovDeg >= 180 ||
+                                   fabs(options.viewDir.dot(options.upDir)) >= 1)) {
+        return false;
+    }
+    Camera camera = options.overrideCamera
+                    ? Camera(options.eye, options.viewDir, options.upDir, options.vFovDeg, width, height,
+                             scene.viewingDistance, scene.isParallelProjection)
+                    : Camera(scene.eye, scene.viewDir, scene.upDir, scene.vFovDeg, width, height,
+                             scene.viewingDistance, scene.isParallelProjection);
+    if (options.samplesPerPixel > 0) {
+        camera.samplesPerPixel = options.samplesPerPixel;
+    }
+    if (options.rayJitter >= 0) {
+        camera.rayJitter = options.rayJitter;
+    }
+
+    // Tiles of the whole image overlapping the region, so that a region made of whole tiles renders the same as it does
+    // in the whole image
+    vector<Tile> tiles = tilesOverlapping(width, height, TILE_SIZE, x0, y0, x1, y1);
+    vector<vector<int> > candidates = primaryCandidatesOf(scene, camera, width, height, tiles, TILE_SIZE);
+    int threads = options.threads > 0 ? options.threads : max(1u, thread::hardware_concurrency());
+    threads = min(threads, (int) tiles.size());
+    atomic<int> nextTile(0);
+    auto work = [&]() {
+        // Pixels of the batch are offsets into the framebuffer, light terms are added to them as they are shaded
+        ShadingBatch batch(SHADING_BATCH_SIZE, [framebuffer](int offset, const Color &color) {
+            float *pixel = framebuffer + 3 * (size_t) offset;
+            pixel[0] += color.getR();
+            pixel[1] += color.getG();
+            pixel[2] += color.getB();
+        });
+        activeShadingBatch = SHADING_BATCH_SIZE > 0 ? &batch : nullptr;
+        PacketHitCache packetHits;
+        activePacketHits = &packetHits;
+        OccluderCache occluders;
+        activeOccluders = SHADOW_OCCLUDER_CACHE ? &occluders : nullptr;
+        PixelShadingCache pixelShading(DOF_SHADING_TOLERANCE);
+        activePixelShading = DOF_SHADING_TOLERANCE > 0 && camera.samplesPerPixel > 1 ? &pixelShading : nullptr;
+        for (int k = nextTile++; k < (int) tiles.size(); k = nextTile++) {
+            const Tile &tile = tiles[k];
+            seedRand(options.seed + tile.index);
+            for (int j = max(tile.y0, y0); j < min(tile.y1, y1); j++) {
+                for (int i = max(tile.x0, x0); i < min(tile.x1, x1); i++) {
+                    size_t offset = options.regionFramebuffer ? (size_t) (j - y0) * (x1 - x0) + (i - x0)
+                                                              : (size_t) j * width + i;
+                    float *pixel = framebuffer + 3 * offset;
+                    pixel[0] = pixel[1] = pixel[2] = 0;
+                    batch.pixel = offset;
+                    Color color = renderPixel(scene, camera, i, j, nullptr, &candidates[k]);
+                    pixel[0] += color.getR();
+                    pixel[1] += color.getG();
+                    pixel[2] += color.getB();
+                }
+            }
+        }
+        batch.shade();
+        activeShadingBatch = nullptr;
+        activePacketHits = nullptr;
+        activeOccluders = nullptr;
+        activePixelShading = nullptr;
+    };
+    vector<thread> workers;
+    for (int t = 1; t < threads; ++t) {
+        workers.emplace_back(work);
+    }
+    work();
+    for (auto &worker : workers) {
+        worker.join();
+    }
+    return true;
+}
@@ -0,0 +1,64 @@
+// Checks that camera rays traced in packets hit what they hit when traced one by one, for images of other sizes than
+// the scene file's too (packet hits are cached by pixel of the image rendered)
+// Usage: camera_packets [--compact] <inputfile>, returns nonzero if any pixel differs
+// With compact, triangles are encoded compactly first, whose tolerances packets evaluate with SSE too
+
+#include <iostream>
+#include "yart.hpp"
+
+using namespace std;
+
+// Traces camera rays of every pixel of a width x height image of scene tile by tile, as render does, returns how many
+// of them hit another object or at another T parameter than traceRay says
+int mismatchesAt(const Scene &scene, int width, int height) {
+    Camera camera(scene.eye, scene.viewDir, scene.upDir, scene.vFovDeg, width, height, scene.viewingDistance,
+                  scene.isParallelProjection);
+    camera.rayJitter = 0;
+    PacketHitCache packetHits;
+    activePacketHits = &packetHits;
+    int mismatches = 0;
+    for (const Tile &tile : tilesOverlapping(width, height, TILE_SIZE, 0, 0, width, height)) {
+        for (int j = tile.y0; j < tile.y1; j++) {
+            for (int i = tile.x0; i < tile.x1; i++) {
+                Ray ray = camera.rayThrough(i, j, 0);
+                pair<int, float> expected = traceRay(ray, scene, RECURSIVE_RAY_GRACE);
+                pair<int, float> hit = traceCameraRay(ray, scene, camera, i, j, nullptr);
+                if (hit != expected) {
+                    if (mismatches++ < 5) {
+                        cerr << width << "x" << height << " pixel (" << i << ", " << j << "): hit " << hit.first
+                             << " at " << hit.second << ", expected " << expected.first << " at " << expected.second
+                             << endl;
+                    }
+                }
+            }
+        }
+    }
+    activePacketHits = nullptr;
+    return mismatches;
+}
+
+int main(int argc, char *argv[]) {
+    bool compact = argc == 3 && string(argv[1]) == "--compact";
+    if (argc != 2 && !compact) {
+        cerr << "Usage: " << argv[0] << " [--compact] <inputfile>" << endl;
+        return -1;
+    }
+    const char *filename = argv[argc - 1];
+    unique_ptr<Scene> scene = loadScene(filename);
+    if (scene == nullptr) {
+        return -1;
+    }
+    if (compact) {
+        cout << scene->compactTriangles() << endl;
+    }
+    int w = scene->imWidth, h = scene->imHeight;
+    // Scene's size, larger and smaller ones, and one narrower than a tile
+    int sizes[][2] = {{w, h}, {2 * w, 2 * h}, {w / 2 + 1, h / 3 + 1}, {TILE_SIZE - 3, TILE_SIZE + 5}};
+    int failed = 0;
+    for (auto &size : sizes) {
+        int mismatches = mismatchesAt(*scene, size[0], size[1]);
+        cout << filename << " at " << size[0] << "x" << size[1] << ": " << mismatches << " mismatches" << endl;
+        failed += mismatches > 0;
+    }
+    return failed;
+}
@@ -0,0 +1,46 @@
+#!/bin/bash
+# Renders every scene of examples/ with and without FAST_MATH, fails if any 8 bit channel value of any image differs
+# by more than the bound the README gives for it
+# Usage: tests/fastmath.sh [level [bound]], level 1 and bound 1 by default
+# Builds both renderers (with CXX, -O2 and OPTFLAGS) in a temporary directory, images are written next to the scenes
+
+level=${1:-1}
+bound=${2:-1}
+cxx=${CXX:-g++}
+build=$(mktemp -d)
+trap 'rm -rf "$build"' EXIT
+
+for mode in 0 "$level"; do
+    $cxx -std=c++11 -pthread -Iinclude -O2 $OPTFLAGS -DFAST_MATH=$mode src/*.cpp -o "$build/raytracer$mode" || exit 1
+done
+
+# Prints the largest difference between values of two P3 images of the same size, or "size" if sizes differ
+maxDiff() {
+    paste <(grep -v '^#' "$1" | tr -s ' \t' '\n\n' | grep .) <(grep -v '^#' "$2" | tr -s ' \t' '\n\n' | grep .) |
+        awk 'NR == 2 || NR == 3 { if ($1 != $2) { size = 1; exit } }
+             NR > 4 { d = $1 - $2; if (d < 0) d = -d; if (d > max) max = d }
+             END { print size ? "size" : max + 0 }'
+}
+
+failed=0
+for scene in $(find examples -name '*.txt' | sort); do
+    image=${scene%.txt}.ppm
+    if ! "$build/raytracer0" "$scene" > /dev/null 2>&1; then
+        echo "$scene: not rendered, skipped"
+        continue
+    fi
+    mv "$image" "$build/exact.ppm"
+    if ! "$build/raytracer$level" "$scene" > /dev/null 2>&1; then
+        echo "$scene: FAILED, not rendered with FAST_MATH $level"
+        failed=1
+        continue
+    fi
+    diff=$(maxDiff "$build/exact.ppm" "$image")
+    if [ "$diff" = size ] || [ "$diff" -gt "$bound" ]; then
+        echo "$scene: FAILED, differs by $diff"
+        failed=1
+    else
+        echo "$scene: differs by $diff"
+    fi
+done
+exit $failed